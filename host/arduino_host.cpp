@@ -0,0 +1,291 @@
+/*
+ * Host implementation of the Arduino shims in host/include
+ */
+#include <Arduino.h>
+#include <FS.h>
+#include <SD_MMC.h>
+#include <LittleFS.h>
+#include <Wire.h>
+
+#include <stdarg.h>
+#include <mutex>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+HostSerial Serial;
+HardwareSerial Serial1;
+HostEsp ESP;
+SDMMCFS SD_MMC;
+LittleFSFS LittleFS;
+TwoWire Wire(0);
+
+int HostSerial::printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vfprintf(stderr, format, args);
+    va_end(args);
+    return len;
+}
+
+namespace fs
+{
+
+class FileImpl
+{
+public:
+    ~FileImpl() { close(); }
+
+    void close()
+    {
+        if (file)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+        if (dir)
+        {
+            closedir(dir);
+            dir = nullptr;
+        }
+    }
+
+    FILE *file = nullptr;
+    DIR *dir = nullptr;
+    std::string hostPath;
+    std::string path;
+    std::string name;
+};
+
+File::operator bool() const
+{
+    return impl && (impl->file || impl->dir);
+}
+
+size_t File::write(const uint8_t *buf, size_t size)
+{
+    return (impl && impl->file) ? fwrite(buf, 1, size, impl->file) : 0;
+}
+
+size_t File::read(uint8_t *buf, size_t size)
+{
+    return (impl && impl->file) ? fread(buf, 1, size, impl->file) : 0;
+}
+
+int File::read()
+{
+    return (impl && impl->file) ? fgetc(impl->file) : -1;
+}
+
+int File::available()
+{
+    if (!impl || !impl->file)
+    {
+        return 0;
+    }
+    long pos = ftell(impl->file);
+    return (int)(size() - pos);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+    return impl && impl->file && fseek(impl->file, pos, (int)mode) == 0;
+}
+
+size_t File::position()
+{
+    return (impl && impl->file) ? ftell(impl->file) : 0;
+}
+
+size_t File::size()
+{
+    struct stat st;
+    if (!impl || stat(impl->hostPath.c_str(), &st) != 0)
+    {
+        return 0;
+    }
+    if (impl->file)
+    {
+        fflush(impl->file);
+        stat(impl->hostPath.c_str(), &st);
+    }
+    return st.st_size;
+}
+
+void File::flush()
+{
+    if (impl && impl->file)
+    {
+        fflush(impl->file);
+    }
+}
+
+void File::close()
+{
+    if (impl)
+    {
+        impl->close();
+    }
+}
+
+const char *File::name()
+{
+    return impl ? impl->name.c_str() : "";
+}
+
+const char *File::path()
+{
+    return impl ? impl->path.c_str() : "";
+}
+
+bool File::isDirectory()
+{
+    return impl && impl->dir;
+}
+
+File File::openNextFile()
+{
+    if (!impl || !impl->dir)
+    {
+        return File();
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(impl->dir)) != nullptr)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        auto child = std::make_shared<FileImpl>();
+        child->path = impl->path + (impl->path.back() == '/' ? "" : "/") + entry->d_name;
+        child->hostPath = impl->hostPath + "/" + entry->d_name;
+        child->name = entry->d_name;
+
+        struct stat st;
+        if (stat(child->hostPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            child->dir = opendir(child->hostPath.c_str());
+        }
+        else
+        {
+            child->file = fopen(child->hostPath.c_str(), "rb");
+        }
+        return File(child);
+    }
+    return File();
+}
+
+std::string FS::hostPath(const char *path)
+{
+    return root + (path[0] == '/' ? "" : "/") + path;
+}
+
+File FS::open(const char *path, const char *mode)
+{
+    auto impl = std::make_shared<FileImpl>();
+    impl->path = path;
+    impl->hostPath = hostPath(path);
+    const char *slash = strrchr(path, '/');
+    impl->name = slash ? slash + 1 : path;
+
+    struct stat st;
+    if (strcmp(mode, FILE_READ) == 0 && stat(impl->hostPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        impl->dir = opendir(impl->hostPath.c_str());
+    }
+    else
+    {
+        const char *hostMode = (strcmp(mode, FILE_WRITE) == 0) ? "w+b" : (strcmp(mode, FILE_APPEND) == 0) ? "a+b" : "rb";
+        impl->file = fopen(impl->hostPath.c_str(), hostMode);
+    }
+    return File(impl);
+}
+
+bool FS::exists(const char *path)
+{
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+    return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char *path)
+{
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+} // namespace fs
+
+/* FreeRTOS queues, a locked ring that never blocks */
+
+struct HostQueue
+{
+    std::mutex lock;
+    std::vector<uint8_t> items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    HostQueue *queue = new HostQueue();
+    queue->items.resize(uxQueueLength * uxItemSize);
+    queue->length = uxQueueLength;
+    queue->itemSize = uxItemSize;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    std::lock_guard<std::mutex> guard(xQueue->lock);
+    if (xQueue->count == xQueue->length)
+    {
+        return pdFALSE;
+    }
+    UBaseType_t slot = (xQueue->head + xQueue->count) % xQueue->length;
+    memcpy(&xQueue->items[slot * xQueue->itemSize], pvItemToQueue, xQueue->itemSize);
+    xQueue->count++;
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    (void)xTicksToWait;
+    std::lock_guard<std::mutex> guard(xQueue->lock);
+    if (xQueue->count == 0)
+    {
+        return pdFALSE;
+    }
+    memcpy(pvBuffer, &xQueue->items[xQueue->head * xQueue->itemSize], xQueue->itemSize);
+    xQueue->head = (xQueue->head + 1) % xQueue->length;
+    xQueue->count--;
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    std::lock_guard<std::mutex> guard(xQueue->lock);
+    return xQueue->count;
+}
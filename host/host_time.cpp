@@ -0,0 +1,74 @@
+/*
+ * Wall clock time for the host tools that run as fast as they can.
+ * They have a single thread, task notifications go nowhere.
+ */
+#include <Arduino.h>
+
+#include <chrono>
+
+static const auto hostStart = std::chrono::steady_clock::now();
+
+uint32_t micros()
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+uint32_t millis()
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+void delay(uint32_t ms)
+{
+    (void)ms; /* the watchdog pauses in the storage code would only slow host runs down */
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask, BaseType_t xCoreID)
+{
+    (void)pvTaskCode;
+    (void)usStackDepth;
+    (void)pvParameters;
+    (void)uxPriority;
+    (void)xCoreID;
+    fprintf(stderr, "%s: no tasks on this host, use the soak build\n", pcName);
+    if (pvCreatedTask)
+    {
+        *pvCreatedTask = nullptr;
+    }
+    return pdFALSE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return nullptr;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    (void)xClearCountOnExit;
+    (void)xTicksToWait;
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    (void)xTaskToNotify;
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    (void)xTicksToDelay;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    (void)xTask;
+    return 0; /* no task stacks to measure */
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 1; /* the single thread stands in for the Arduino loop task */
+}
@@ -0,0 +1,69 @@
+/*
+ * Host implementation of the I2S driver stand-in
+ */
+#include <driver/i2s.h>
+
+static HostI2s_Sink hostI2sSink = nullptr;
+static i2s_config_t hostI2sConfig;
+static bool hostI2sInstalled = false;
+
+void HostI2s_SetSink(HostI2s_Sink sink)
+{
+    hostI2sSink = sink;
+}
+
+const i2s_config_t *HostI2s_Config()
+{
+    return hostI2sInstalled ? &hostI2sConfig : nullptr;
+}
+
+esp_err_t i2s_driver_install(i2s_port_t i2s_num, const i2s_config_t *i2s_config, int queue_size, void *i2s_queue)
+{
+    (void)i2s_num;
+    (void)queue_size;
+    (void)i2s_queue;
+    hostI2sConfig = *i2s_config;
+    hostI2sInstalled = true;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t i2s_num, const i2s_pin_config_t *pin)
+{
+    (void)i2s_num;
+    (void)pin;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_sample_rates(i2s_port_t i2s_num, uint32_t rate)
+{
+    (void)i2s_num;
+    (void)rate;
+    return ESP_OK;
+}
+
+esp_err_t i2s_start(i2s_port_t i2s_num)
+{
+    (void)i2s_num;
+    return ESP_OK;
+}
+
+esp_err_t i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, TickType_t ticks_to_wait)
+{
+    (void)i2s_num;
+    (void)ticks_to_wait;
+    if (hostI2sSink)
+    {
+        hostI2sSink(src, size);
+    }
+    *bytes_written = size;
+    return ESP_OK;
+}
+
+esp_err_t i2s_read(i2s_port_t i2s_num, void *dest, size_t size, size_t *bytes_read, TickType_t ticks_to_wait)
+{
+    (void)i2s_num;
+    (void)ticks_to_wait;
+    memset(dest, 0, size);
+    *bytes_read = size;
+    return ESP_OK;
+}
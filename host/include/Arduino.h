@@ -0,0 +1,125 @@
+/*
+ * Minimal Arduino-ESP32 core for building the engine on a Linux host.
+ * Only what the sources in src/ actually use is provided.
+ */
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <type_traits>
+
+#define HOST_BUILD
+#ifndef ESP32
+#define ESP32 /* the shims stand in for the arduino-esp32 core, take its code paths */
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+
+/* Serial console, goes to stderr so tool output on stdout stays clean */
+class HostSerial
+{
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const char *str) { return fputs(str, stderr) >= 0 ? strlen(str) : 0; }
+    size_t print(char c) { return fputc(c, stderr) != EOF ? 1 : 0; }
+    size_t print(double value, int digits = 2) { return fprintf(stderr, "%.*f", digits, value); }
+    template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    size_t print(T value, int base = DEC)
+    {
+        if (base == HEX)
+        {
+            return fprintf(stderr, "%llx", (unsigned long long)value);
+        }
+        return std::is_signed<T>::value ? fprintf(stderr, "%lld", (long long)value) : fprintf(stderr, "%llu", (unsigned long long)value);
+    }
+
+    size_t println() { return print('\n'); }
+    template<typename T>
+    size_t println(T value) { size_t n = print(value); return n + println(); }
+
+    int available() { return 0; }
+    int read() { return -1; }
+    int availableForWrite() { return 256; } /* stderr never backs up */
+};
+
+extern HostSerial Serial;
+
+/* UART, nothing is received on the host */
+#define SERIAL_8N1 0x800001c
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1)
+    {
+        (void)baud;
+        (void)config;
+        (void)rxPin;
+        (void)txPin;
+    }
+    int available() { return 0; }
+    int read() { return -1; }
+};
+
+extern HardwareSerial Serial1;
+
+/* PSRAM is plain heap on the host, sized like a 4MB WROVER module */
+#define HOST_PSRAM_SIZE (4 * 1024 * 1024)
+#define HOST_INTERNAL_HEAP_SIZE (320 * 1024)
+
+class HostEsp
+{
+public:
+    uint32_t getPsramSize() { return HOST_PSRAM_SIZE; }
+    uint32_t getFreePsram() { return HOST_PSRAM_SIZE; }
+    uint32_t getFreeHeap() { return HOST_INTERNAL_HEAP_SIZE; }
+};
+
+extern HostEsp ESP;
+
+inline bool psramInit() { return true; }
+inline void *ps_malloc(size_t size) { return malloc(size); }
+
+/* esp_heap_caps.h, one heap on the host */
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+inline void *heap_caps_malloc(size_t size, uint32_t caps) { (void)caps; return malloc(size); }
+inline void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) { (void)caps; return realloc(ptr, size); }
+inline void heap_caps_free(void *ptr) { free(ptr); }
+/* nothing is tracked, every heap reports itself empty and in one piece */
+inline size_t heap_caps_get_total_size(uint32_t caps) { return (caps & MALLOC_CAP_SPIRAM) ? HOST_PSRAM_SIZE : HOST_INTERNAL_HEAP_SIZE; }
+inline size_t heap_caps_get_free_size(uint32_t caps) { return heap_caps_get_total_size(caps); }
+inline size_t heap_caps_get_minimum_free_size(uint32_t caps) { return heap_caps_get_total_size(caps); }
+inline size_t heap_caps_get_largest_free_block(uint32_t caps) { return heap_caps_get_total_size(caps); }
+
+/* wall clock in host/host_time.cpp, simulated clock in host/soak */
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+inline void yield() {}
+inline void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+inline void digitalWrite(uint8_t pin, uint8_t val) { (void)pin; (void)val; }
+inline uint32_t esp_random() { return (uint32_t)rand() * 2654435761u; }
+
+#endif // HOST_ARDUINO_H
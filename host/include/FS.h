@@ -0,0 +1,81 @@
+/*
+ * Host stand-in for the Arduino-ESP32 FS layer.
+ * A FS is a directory on the host, File wraps stdio / dirent.
+ */
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <Arduino.h>
+#include <memory>
+#include <string>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+namespace fs
+{
+
+class FileImpl;
+
+class File
+{
+public:
+    File() {}
+    explicit File(std::shared_ptr<FileImpl> impl) : impl(impl) {}
+
+    operator bool() const;
+    size_t write(const uint8_t *buf, size_t size);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t read(uint8_t *buf, size_t size);
+    int read();
+    int available();
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position();
+    size_t size();
+    void flush();
+    void close();
+    const char *name();
+    const char *path();
+    bool isDirectory();
+    File openNextFile();
+
+private:
+    std::shared_ptr<FileImpl> impl;
+};
+
+class FS
+{
+public:
+    explicit FS(const char *root = ".") : root(root) {}
+
+    /* directory on the host that stands in for the card / flash */
+    void setRoot(const char *dir) { root = dir; }
+    const char *getRoot() { return root.c_str(); }
+
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+    bool rmdir(const char *path);
+
+protected:
+    std::string root;
+    bool mounted = false;
+
+    std::string hostPath(const char *path);
+};
+
+} // namespace fs
+
+using fs::File;
+
+#endif // HOST_FS_H
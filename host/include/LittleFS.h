@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for the LittleFS flash partition, backed by a directory
+ */
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+#include <FS.h>
+
+class LittleFSFS : public fs::FS
+{
+public:
+    LittleFSFS() : fs::FS(".") {}
+
+    bool begin(bool formatOnFail = false)
+    {
+        (void)formatOnFail;
+        mounted = true;
+        return true;
+    }
+    void end() { mounted = false; }
+};
+
+extern LittleFSFS LittleFS;
+
+#endif // HOST_LITTLEFS_H
@@ -0,0 +1,36 @@
+/*
+ * Host stand-in for the SD_MMC card, backed by a directory
+ */
+#ifndef HOST_SD_MMC_H
+#define HOST_SD_MMC_H
+
+#include <FS.h>
+
+typedef enum
+{
+    CARD_NONE,
+    CARD_MMC,
+    CARD_SD,
+    CARD_SDHC,
+    CARD_UNKNOWN
+} sdcard_type_t;
+
+class SDMMCFS : public fs::FS
+{
+public:
+    SDMMCFS() : fs::FS(".") {}
+
+    bool begin(const char *mountpoint = "/sdcard", bool mode1bit = false)
+    {
+        (void)mountpoint;
+        (void)mode1bit;
+        mounted = true;
+        return true;
+    }
+    void end() { mounted = false; }
+    sdcard_type_t cardType() { return mounted ? CARD_SDHC : CARD_NONE; }
+};
+
+extern SDMMCFS SD_MMC;
+
+#endif // HOST_SD_MMC_H
@@ -0,0 +1,27 @@
+/*
+ * Host stand-in for the Arduino I2C bus, nothing is attached.
+ */
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include <Arduino.h>
+
+class TwoWire
+{
+public:
+    TwoWire(uint8_t busNum) : busNum(busNum) {}
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0)
+    {
+        (void)sda;
+        (void)scl;
+        (void)frequency;
+        return true;
+    }
+
+private:
+    uint8_t busNum;
+};
+
+extern TwoWire Wire;
+
+#endif // HOST_WIRE_H
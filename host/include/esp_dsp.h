@@ -0,0 +1,33 @@
+/*
+ * Host stand-in for the ESP-DSP routines src/ uses, plain loops with
+ * the library's argument order and step semantics.
+ */
+#ifndef HOST_ESP_DSP_H
+#define HOST_ESP_DSP_H
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+#ifndef ESP_OK
+#define ESP_OK 0
+#endif
+
+inline esp_err_t dsps_mulc_f32(const float *input, float *output, int len, float C, int step_in, int step_out)
+{
+    for (int i = 0; i < len; i++)
+    {
+        output[i * step_out] = input[i * step_in] * C;
+    }
+    return ESP_OK;
+}
+
+inline esp_err_t dsps_add_f32(const float *input1, const float *input2, float *output, int len, int step1, int step2, int step_out)
+{
+    for (int i = 0; i < len; i++)
+    {
+        output[i * step_out] = input1[i * step1] + input2[i * step2];
+    }
+    return ESP_OK;
+}
+
+#endif // HOST_ESP_DSP_H
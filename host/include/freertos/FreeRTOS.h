@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for the FreeRTOS types the sketch uses.
+ * host/soak schedules the tasks in simulated time, the other host
+ * tools are single threaded, see host/host_time.cpp.
+ */
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS  1
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY      0x7FFFFFFF
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,218 @@
+/*
+ * Offline renderer: plays a Standard MIDI File through SamplePlayer on the host
+ * and writes the mix as a 16 bit stereo WAV, as fast as the CPU allows.
+ *
+ * usage: render <song.mid> <sdcard dir> <out.wav> [tail seconds] [sample rate]
+ *
+ * <sdcard dir> is laid out like the card: /samples/kit.txt or /samples/0.wav ...
+ * The same input always produces the same file, so renders can be diffed
+ * between engine changes.
+ */
+#include <Arduino.h>
+#include <SD_MMC.h>
+
+#include <chrono>
+#include <vector>
+
+#include "config.hpp"
+#include "player.hpp"
+#include "mix_kernels.hpp"
+#include "limiter.hpp"
+#include "send_effects.hpp"
+#include "midi_note_handler.hpp"
+#include "smf.hpp"
+
+#define RENDER_MAX_TAIL 30.0f
+
+static SamplePlayer *player;
+static MidiNoteHandler *midi_handler;
+
+/* same kit setup as setup() in main.cpp */
+static void Render_LoadKit()
+{
+    static KitEntry kit[MAX_KIT_ENTRIES];
+    uint16_t kitEntries = player->loadKit(KIT_FILE, kit, sizeof(kit) / sizeof(kit[0]));
+    for (int i = 0; i < kitEntries; i++)
+    {
+        midi_handler->addZone(kit[i].midiChannel, kit[i].sampleNum, kit[i].loKey, kit[i].hiKey, kit[i].rootKey, kit[i].loVel, kit[i].hiVel);
+    }
+
+    char samplePath[120];
+    for (int i = 0; kitEntries == 0 && i < DEFAULT_KIT_SIZE; i++)
+    {
+        snprintf(samplePath, sizeof(samplePath), "/samples/%d.wav", i);
+        if (player->loadWav(i, samplePath))
+        {
+            midi_handler->setNoteToListen(NOTE_BEGIN + i, i);
+        }
+    }
+}
+
+static void Render_Dispatch(const SmfEvent &ev, uint32_t frame)
+{
+    uint8_t channel = (ev.status & 0x0F) + 1;
+    switch (ev.status & 0xF0)
+    {
+    case 0x90:
+        if (ev.data2 > 0)
+        {
+            midi_handler->playNote(channel, ev.data1, ev.data2, frame);
+        }
+        break;
+    case 0xB0:
+        player->controlChange(channel, ev.data1, ev.data2);
+        break;
+    case 0xE0:
+        player->pitchBend(channel, (int16_t)(((ev.data2 << 7) | ev.data1) - 8192));
+        break;
+    default:
+        break;
+    }
+}
+
+/* same scaling as i2s_write_stereo_samples_buff() so renders match the DAC data */
+static bool Render_WriteWav(const char *filename, const std::vector<int16_t> &pcm, uint32_t sampleRate)
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Could not create %s\n", filename);
+        return false;
+    }
+
+    uint32_t dataSize = pcm.size() * sizeof(int16_t);
+    uint8_t header[44];
+    auto put16 = [&](int pos, uint16_t v) { header[pos] = v & 0xFF; header[pos + 1] = v >> 8; };
+    auto put32 = [&](int pos, uint32_t v) { put16(pos, v & 0xFFFF); put16(pos + 2, v >> 16); };
+
+    memcpy(&header[0], "RIFF", 4);
+    put32(4, 36 + dataSize);
+    memcpy(&header[8], "WAVE", 4);
+    memcpy(&header[12], "fmt ", 4);
+    put32(16, 16);
+    put16(20, 1); /* PCM */
+    put16(22, 2);
+    put32(24, sampleRate);
+    put32(28, sampleRate * 4);
+    put16(32, 4);
+    put16(34, 16);
+    memcpy(&header[36], "data", 4);
+    put32(40, dataSize);
+
+    bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header) &&
+              fwrite(pcm.data(), 1, dataSize, f) == dataSize;
+    fclose(f);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: %s <song.mid> <sdcard dir> <out.wav> [tail seconds] [sample rate]\n", argv[0]);
+        return 1;
+    }
+    float maxTail = (argc > 4) ? atof(argv[4]) : RENDER_MAX_TAIL;
+    uint32_t sampleRate = (argc > 5) ? strtoul(argv[5], NULL, 10) : SAMPLE_RATE;
+    if (sampleRate == 0)
+    {
+        fprintf(stderr, "bad sample rate %s\n", argv[5]);
+        return 1;
+    }
+
+    std::vector<SmfEvent> events;
+    if (!Smf_Load(argv[1], events))
+    {
+        return 1;
+    }
+
+    SD_MMC.setRoot(argv[2]);
+    player = new SamplePlayer(sampleRate);
+    Limiter limiter(sampleRate); /* same master stage as audio_task() */
+#ifdef SEND_EFFECTS
+    SendEffects effects;
+    effects.begin(sampleRate);
+#endif
+    midi_handler = new MidiNoteHandler(player);
+    Render_LoadKit();
+
+    float fl_sample[SAMPLE_BUFFER_SIZE];
+    float fr_sample[SAMPLE_BUFFER_SIZE];
+    float delay_send[SAMPLE_BUFFER_SIZE];
+    float reverb_send[SAMPLE_BUFFER_SIZE];
+    std::vector<int16_t> pcm;
+#ifdef OUTPUT_DITHER
+    uint32_t ditherState = 1; /* fixed seed, renders stay reproducible */
+#endif
+
+    const uint32_t tailFrames = (uint32_t)(maxTail * sampleRate);
+    uint32_t frame = 0;
+    uint32_t lastEventFrame = 0;
+    uint8_t peakVoices = 0;
+    size_t next = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (true)
+    {
+        const uint32_t blockEnd = frame + SAMPLE_BUFFER_SIZE;
+        while (next < events.size())
+        {
+            uint32_t eventFrame = (uint32_t)(events[next].seconds * sampleRate + 0.5);
+            if (eventFrame >= blockEnd)
+            {
+                break;
+            }
+            Render_Dispatch(events[next++], eventFrame);
+            lastEventFrame = eventFrame;
+        }
+
+        memset(fl_sample, 0, sizeof(fl_sample));
+        memset(fr_sample, 0, sizeof(fr_sample));
+        memset(delay_send, 0, sizeof(delay_send));
+        memset(reverb_send, 0, sizeof(reverb_send));
+#ifdef SEND_EFFECTS
+        player->process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE, delay_send, reverb_send);
+        effects.process(delay_send, reverb_send, fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
+#else
+        player->process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
+#endif
+#ifdef MASTER_LIMITER
+        limiter.process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
+#endif
+
+        /* the conversion i2s_write_stereo_samples_buff() does for 16 bit slots */
+        pcm.resize(pcm.size() + 2 * SAMPLE_BUFFER_SIZE);
+#ifdef OUTPUT_DITHER
+        Mix_InterleaveDither16(&pcm[pcm.size() - 2 * SAMPLE_BUFFER_SIZE], fl_sample, fr_sample, OUTPUT_SCALE_16, &ditherState, SAMPLE_BUFFER_SIZE);
+#else
+        Mix_InterleaveSat16(&pcm[pcm.size() - 2 * SAMPLE_BUFFER_SIZE], fl_sample, fr_sample, OUTPUT_SCALE_16, SAMPLE_BUFFER_SIZE);
+#endif
+        frame = blockEnd;
+
+        uint8_t voices = player->activeVoices();
+        if (voices > peakVoices)
+        {
+            peakVoices = voices;
+        }
+        if (next >= events.size() && (voices == 0 || frame - lastEventFrame >= tailFrames))
+        {
+            break;
+        }
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double audio = (double)frame / sampleRate;
+
+    if (!Render_WriteWav(argv[3], pcm, sampleRate))
+    {
+        return 1;
+    }
+
+    printf("rendered %.3f s of audio in %.3f s: %.1fx real time\n", audio, wall, wall > 0 ? audio / wall : 0.0);
+    printf("%zu events, peak %d voices, %d late notes\n", events.size(), peakVoices, player->lateEvents());
+#ifdef MASTER_LIMITER
+    printf("limiter: %u sub-blocks limited, deepest %.1f dB\n", limiter.limitedBlocks(), 20.0f * log10f(limiter.deepestGain()));
+#endif
+    return 0;
+}
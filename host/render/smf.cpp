@@ -0,0 +1,209 @@
+#include "smf.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+struct SmfRawEvent
+{
+    uint32_t tick;
+    uint32_t order; /* file order, keeps simultaneous events stable */
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint32_t tempo; /* for tempo meta events, status 0xFF */
+};
+
+static uint32_t Smf_Read32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t Smf_Read16(const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static bool Smf_ReadVarLen(const uint8_t *&p, const uint8_t *end, uint32_t &value)
+{
+    value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (p >= end)
+        {
+            return false;
+        }
+        uint8_t c = *p++;
+        value = (value << 7) | (c & 0x7F);
+        if (!(c & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool Smf_ParseTrack(const uint8_t *p, const uint8_t *end, std::vector<SmfRawEvent> &raw)
+{
+    uint32_t tick = 0;
+    uint8_t runningStatus = 0;
+
+    while (p < end)
+    {
+        uint32_t delta;
+        if (!Smf_ReadVarLen(p, end, delta) || p >= end)
+        {
+            return false;
+        }
+        tick += delta;
+
+        uint8_t status = *p;
+        if (status & 0x80)
+        {
+            p++;
+        }
+        else if (runningStatus)
+        {
+            status = runningStatus;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (status == 0xFF)
+        {
+            /* meta event, only tempo matters */
+            if (p >= end)
+            {
+                return false;
+            }
+            uint8_t type = *p++;
+            uint32_t len;
+            if (!Smf_ReadVarLen(p, end, len) || p + len > end)
+            {
+                return false;
+            }
+            if (type == 0x51 && len == 3)
+            {
+                SmfRawEvent ev = {tick, (uint32_t)raw.size(), 0xFF, 0, 0, ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]};
+                raw.push_back(ev);
+            }
+            else if (type == 0x2F)
+            {
+                return true; /* end of track */
+            }
+            p += len;
+        }
+        else if (status == 0xF0 || status == 0xF7)
+        {
+            uint32_t len;
+            if (!Smf_ReadVarLen(p, end, len) || p + len > end)
+            {
+                return false;
+            }
+            p += len;
+        }
+        else
+        {
+            runningStatus = status;
+            uint8_t type = status & 0xF0;
+            int dataBytes = (type == 0xC0 || type == 0xD0) ? 1 : 2;
+            if (p + dataBytes > end)
+            {
+                return false;
+            }
+            SmfRawEvent ev = {tick, (uint32_t)raw.size(), status, p[0], (uint8_t)(dataBytes == 2 ? p[1] : 0), 0};
+            raw.push_back(ev);
+            p += dataBytes;
+        }
+    }
+    return true;
+}
+
+bool Smf_Load(const char *filename, std::vector<SmfEvent> &events)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+
+    if (data.size() < 14 || memcmp(&data[0], "MThd", 4) != 0)
+    {
+        fprintf(stderr, "%s is not a midi file\n", filename);
+        return false;
+    }
+
+    uint32_t headerLen = Smf_Read32(&data[4]);
+    uint16_t numTracks = Smf_Read16(&data[10]);
+    uint16_t division = Smf_Read16(&data[12]);
+
+    std::vector<SmfRawEvent> raw;
+    size_t pos = 8 + headerLen;
+    for (int t = 0; t < numTracks && pos + 8 <= data.size(); t++)
+    {
+        uint32_t len = Smf_Read32(&data[pos + 4]);
+        if (pos + 8 + len > data.size())
+        {
+            fprintf(stderr, "%s: track %d is truncated\n", filename, t);
+            return false;
+        }
+        if (memcmp(&data[pos], "MTrk", 4) == 0)
+        {
+            if (!Smf_ParseTrack(&data[pos + 8], &data[pos + 8 + len], raw))
+            {
+                fprintf(stderr, "%s: track %d is malformed\n", filename, t);
+                return false;
+            }
+        }
+        pos += 8 + len;
+    }
+
+    std::sort(raw.begin(), raw.end(), [](const SmfRawEvent &a, const SmfRawEvent &b)
+    {
+        return (a.tick != b.tick) ? a.tick < b.tick : a.order < b.order;
+    });
+
+    /* walk the tempo map, SMPTE division has a fixed tick length */
+    double secondsPerTick;
+    bool smpte = (division & 0x8000) != 0;
+    if (smpte)
+    {
+        int fps = -(int8_t)(division >> 8);
+        secondsPerTick = 1.0 / (fps * (division & 0xFF));
+    }
+    else
+    {
+        secondsPerTick = 0.5 / division; /* 120 bpm until told otherwise */
+    }
+
+    double seconds = 0.0;
+    uint32_t lastTick = 0;
+    events.clear();
+    for (const SmfRawEvent &ev : raw)
+    {
+        seconds += (ev.tick - lastTick) * secondsPerTick;
+        lastTick = ev.tick;
+        if (ev.status == 0xFF)
+        {
+            if (!smpte)
+            {
+                secondsPerTick = ev.tempo / 1000000.0 / division;
+            }
+            continue;
+        }
+        SmfEvent out = {seconds, ev.status, ev.data1, ev.data2};
+        events.push_back(out);
+    }
+    return true;
+}
@@ -0,0 +1,22 @@
+/*
+ * Standard MIDI File reader for the host tools.
+ * Format 0 and 1, all tracks merged into one list of channel events
+ * with their time in seconds from the tempo map.
+ */
+#ifndef SMF_HPP
+#define SMF_HPP
+
+#include <stdint.h>
+#include <vector>
+
+struct SmfEvent
+{
+    double seconds;
+    uint8_t status; /* channel voice status byte, 0x80 - 0xEF */
+    uint8_t data1;
+    uint8_t data2;
+};
+
+bool Smf_Load(const char *filename, std::vector<SmfEvent> &events);
+
+#endif // SMF_HPP
@@ -0,0 +1,201 @@
+/*
+ * Baton passing scheduler behind the FreeRTOS and Arduino time shims, see sim.hpp
+ */
+#include "sim.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct HostTask
+{
+    const char *name;
+    UBaseType_t priority;
+    BaseType_t core;
+    uint32_t stackDepth;   // bytes, threads have their own stacks, reported untouched
+    uint64_t wakeAt;       // SIM_FOREVER while waiting for a notify without timeout
+    bool waitingNotify;
+    uint32_t notifyValue;
+    std::condition_variable cv;
+};
+
+static std::mutex simLock;
+static std::vector<HostTask *> simTasks;
+static HostTask *simCurrent = nullptr;
+static uint64_t simNow = 0;
+static thread_local HostTask *simSelf = nullptr;
+
+static HostTask *Sim_NewTask(const char *name, UBaseType_t priority, BaseType_t core)
+{
+    HostTask *task = new HostTask();
+    task->name = name;
+    task->priority = priority;
+    task->core = core;
+    task->stackDepth = 0;
+    task->wakeAt = simNow;
+    task->waitingNotify = false;
+    task->notifyValue = 0;
+    simTasks.push_back(task);
+    return task;
+}
+
+// hands the baton to the next task and returns once the caller is picked again
+static void Sim_Switch(std::unique_lock<std::mutex> &lock)
+{
+    HostTask *next = nullptr;
+    for (HostTask *task : simTasks)
+    {
+        if (task->wakeAt == SIM_FOREVER)
+        {
+            continue;
+        }
+        if (!next || task->wakeAt < next->wakeAt || (task->wakeAt == next->wakeAt && task->priority > next->priority))
+        {
+            next = task;
+        }
+    }
+    if (!next)
+    {
+        fprintf(stderr, "sim: every task is blocked forever at %llu us\n", (unsigned long long)simNow);
+        fflush(stdout);
+        _Exit(2);
+    }
+    if (next->wakeAt > simNow)
+    {
+        simNow = next->wakeAt;
+    }
+    simCurrent = next;
+    if (next != simSelf)
+    {
+        next->cv.notify_one();
+        HostTask *self = simSelf;
+        self->cv.wait(lock, [self] { return simCurrent == self; });
+    }
+}
+
+void Sim_Init()
+{
+    std::unique_lock<std::mutex> lock(simLock);
+    simSelf = Sim_NewTask("loopTask", 1, 1);
+    simCurrent = simSelf;
+}
+
+uint64_t Sim_Now()
+{
+    return simNow;
+}
+
+void Sim_SleepUntil(uint64_t time)
+{
+    std::unique_lock<std::mutex> lock(simLock);
+    simSelf->wakeAt = time > simNow ? time : simNow;
+    Sim_Switch(lock);
+}
+
+void Sim_Busy(uint64_t us)
+{
+    Sim_SleepUntil(simNow + us);
+}
+
+void Sim_Spawn(void (*fn)(void *), void *param, const char *name, UBaseType_t priority, BaseType_t core)
+{
+    std::unique_lock<std::mutex> lock(simLock);
+    HostTask *task = Sim_NewTask(name, priority, core);
+    std::thread([task, fn, param]
+    {
+        {
+            std::unique_lock<std::mutex> lock(simLock);
+            simSelf = task;
+            task->cv.wait(lock, [task] { return simCurrent == task; });
+        }
+        fn(param);
+
+        // FreeRTOS tasks must not return, park it for good
+        std::unique_lock<std::mutex> lock(simLock);
+        task->wakeAt = SIM_FOREVER;
+        Sim_Switch(lock);
+    }).detach();
+}
+
+/* FreeRTOS */
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask, BaseType_t xCoreID)
+{
+    Sim_Spawn(pvTaskCode, pvParameters, pcName, uxPriority, xCoreID);
+    std::unique_lock<std::mutex> lock(simLock);
+    simTasks.back()->stackDepth = usStackDepth;
+    if (pvCreatedTask)
+    {
+        *pvCreatedTask = simTasks.back();
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return simSelf;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    HostTask *task = xTask != nullptr ? xTask : simSelf;
+    return task != nullptr ? task->stackDepth : 0;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return simSelf != nullptr ? simSelf->core : 1;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    std::unique_lock<std::mutex> lock(simLock);
+    if (simSelf->notifyValue == 0 && xTicksToWait > 0)
+    {
+        simSelf->waitingNotify = true;
+        simSelf->wakeAt = (xTicksToWait == portMAX_DELAY) ? SIM_FOREVER : simNow + (uint64_t)xTicksToWait * portTICK_PERIOD_MS * 1000;
+        Sim_Switch(lock);
+        simSelf->waitingNotify = false;
+    }
+    uint32_t value = simSelf->notifyValue;
+    if (value > 0)
+    {
+        simSelf->notifyValue = xClearCountOnExit ? 0 : value - 1;
+    }
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    std::unique_lock<std::mutex> lock(simLock);
+    xTaskToNotify->notifyValue++;
+    if (xTaskToNotify->waitingNotify)
+    {
+        xTaskToNotify->wakeAt = simNow;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    Sim_SleepUntil(simNow + (uint64_t)xTicksToDelay * portTICK_PERIOD_MS * 1000);
+}
+
+/* Arduino time, simulated */
+
+uint32_t micros()
+{
+    return (uint32_t)simNow;
+}
+
+uint32_t millis()
+{
+    return (uint32_t)(simNow / 1000);
+}
+
+void delay(uint32_t ms)
+{
+    Sim_SleepUntil(simNow + (uint64_t)ms * 1000);
+}
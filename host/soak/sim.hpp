@@ -0,0 +1,24 @@
+/*
+ * Simulated time and task scheduling for the soak harness.
+ *
+ * Every FreeRTOS task of the sketch is a host thread, but only one of them
+ * runs at a time. A task keeps running until it blocks (delay, task notify,
+ * a full I2S queue), then the task with the earliest wake up time goes next
+ * and the simulated clock jumps to that time. Code costs no simulated time
+ * unless the harness charges it with Sim_Busy(), so runs are deterministic
+ * and much faster than real time.
+ */
+#ifndef SOAK_SIM_HPP
+#define SOAK_SIM_HPP
+
+#include <Arduino.h>
+
+#define SIM_FOREVER UINT64_MAX
+
+void Sim_Init(); // the calling thread becomes "loopTask"
+uint64_t Sim_Now(); // microseconds since Sim_Init()
+void Sim_SleepUntil(uint64_t time); // blocks the calling task
+void Sim_Busy(uint64_t us); // the calling task's core is busy for us
+void Sim_Spawn(void (*fn)(void *), void *param, const char *name, UBaseType_t priority, BaseType_t core = 0);
+
+#endif // SOAK_SIM_HPP
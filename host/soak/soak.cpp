@@ -0,0 +1,676 @@
+/*
+ * Soak test bench: runs setup() and loop() from main.cpp for hours of
+ * simulated time against an I2S sink that plays exactly the output rate
+ * (SAMPLE_RATE, or whatever <sdcard dir>/rate.txt selects) and a MIDI
+ * source that fires dense bursts down the UART.
+ *
+ * usage: soak <sdcard dir> [options]
+ *   --hours h, --minutes m   simulated run time (default 1 hour)
+ *   --pattern p              mixed, chord, roll, flam or random (default mixed)
+ *   --notes lo-hi            notes to play (default the DEFAULT_KIT_SIZE notes from NOTE_BEGIN)
+ *   --channel c              midi channel 1-16 (default 1)
+ *   --rate n                 notes per second in the random pattern (default 40)
+ *   --clock bpm              also send midi clock
+ *   --block-us us            render cost model, fixed part per block
+ *   --voice-us us            render cost model, per voice on the busier core
+ *   --jitter-us us           random extra cost per block, up to us
+ *   --report s               seconds of simulated time per report line (default 60)
+ *   --csv file               also write the report lines as csv
+ *   --record                 record the master bus to <sdcard dir>/recordings for the whole run
+ *   --seed n
+ *
+ * The simulated clock only moves while tasks wait, rendering is charged with
+ * the cost model, take the numbers from the RENDER_BENCHMARK output on the
+ * target. Every note in --notes has to map to a sample, latency is matched
+ * to the notes the player starts in order and measured to the first frame
+ * of the block a note starts in.
+ * Exit code is 1 when there were underruns, dropped notes or UART overruns.
+ */
+#include <Arduino.h>
+#include <SD_MMC.h>
+#include <driver/i2s.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include "config.hpp"
+#include "player.hpp"
+#include "trace.hpp"
+#include "midi_receiver.hpp"
+#include "recorder.hpp"
+#include "limiter.hpp"
+#include "sim.hpp"
+
+#define SOAK_BLOCK_US      40.0  // beginBlock, bus clear and I2S conversion
+#define SOAK_VOICE_US      30.0  // one voice, one block
+#define SOAK_UART_BYTE_US  320   // 10 bits at 31250 baud
+#define SOAK_LATENCY_BINS  1000  // 0.1 ms each
+#define SOAK_DEFAULT_RATE  40.0
+
+/* from main.cpp */
+extern SamplePlayer *player;
+extern Recorder *recorder;
+extern Limiter *limiter;
+void setup();
+void loop();
+
+enum SoakPattern
+{
+    PATTERN_MIXED,
+    PATTERN_CHORD,
+    PATTERN_ROLL,
+    PATTERN_FLAM,
+    PATTERN_RANDOM,
+    PATTERN_COUNT
+};
+
+static const char *patternNames[PATTERN_COUNT] = {"mixed", "chord", "roll", "flam", "random"};
+
+struct SoakOptions
+{
+    double seconds = 3600.0;
+    SoakPattern pattern = PATTERN_MIXED;
+    uint8_t loNote = NOTE_BEGIN;
+    uint8_t hiNote = NOTE_BEGIN + DEFAULT_KIT_SIZE - 1;
+    uint8_t channel = 1;
+    double rate = SOAK_DEFAULT_RATE;
+    double clockBpm = 0.0;
+    double blockUs = SOAK_BLOCK_US;
+    double voiceUs = SOAK_VOICE_US;
+    double jitterUs = 0.0;
+    double reportSeconds = 60.0;
+    const char *csvFile = nullptr;
+    bool record = false;
+    uint32_t seed = 1;
+};
+
+struct SoakMessage
+{
+    uint64_t time;
+    uint8_t bytes[3];
+    uint8_t len;
+};
+
+struct LatencyStats
+{
+    uint32_t bins[SOAK_LATENCY_BINS + 1];
+    uint32_t count;
+    double sum;
+    double min;
+    double max;
+
+    void clear()
+    {
+        memset(bins, 0, sizeof(bins));
+        count = 0;
+        sum = 0.0;
+        min = 1e30;
+        max = 0.0;
+    }
+
+    void add(double us)
+    {
+        int bin = (int)(us / 100.0);
+        bins[std::min(std::max(bin, 0), SOAK_LATENCY_BINS)]++;
+        count++;
+        sum += us;
+        min = std::min(min, us);
+        max = std::max(max, us);
+    }
+
+    double percentile(double p) const
+    {
+        uint32_t target = (uint32_t)(count * p);
+        uint32_t seen = 0;
+        for (int i = 0; i <= SOAK_LATENCY_BINS; i++)
+        {
+            seen += bins[i];
+            if (seen > target)
+            {
+                return (i + 1) * 100.0;
+            }
+        }
+        return max;
+    }
+};
+
+struct SoakCounters
+{
+    uint64_t blocks;
+    uint32_t underruns;
+    double underrunUs;
+    uint32_t notesSent;
+    uint8_t peakVoices;
+    uint64_t voiceSum;
+    double maxLoad;
+    VoiceStats voices;
+    uint32_t lateNotes;
+    uint32_t uartOverflows;
+    LatencyStats latency;
+};
+
+static SoakOptions opt;
+static SoakCounters total;
+static SoakCounters interval;
+static uint64_t endTime;
+static uint64_t nextReport;
+static FILE *csv = nullptr;
+static std::chrono::steady_clock::time_point wallStart;
+
+static uint32_t rngState;
+
+static uint32_t Soak_Random()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static uint32_t Soak_RandomRange(uint32_t lo, uint32_t hi)
+{
+    return lo + Soak_Random() % (hi - lo + 1);
+}
+
+/* MIDI source */
+
+static std::vector<SoakMessage> phrase;
+static size_t phraseNext = 0;
+static uint64_t phraseStart = 0;
+static int phraseCount = 0;
+static std::deque<uint64_t> pendingNotes; // arrival times of notes the player has not started yet
+
+static void Soak_AddNote(uint64_t time, uint8_t note, uint8_t velocity, uint32_t lengthUs)
+{
+    uint8_t status = 0x90 | (opt.channel - 1);
+    phrase.push_back({time, {status, note, velocity}, 3});
+    phrase.push_back({time + lengthUs, {status, note, 0}, 3});
+}
+
+static uint8_t Soak_RandomNote()
+{
+    return (uint8_t)Soak_RandomRange(opt.loNote, opt.hiNote);
+}
+
+// one phrase of the pattern, times relative to its start, returns its length
+static uint64_t Soak_BuildPhrase(SoakPattern pattern)
+{
+    uint64_t length = 0;
+    switch (pattern)
+    {
+    case PATTERN_CHORD:
+        // every note at once
+        for (int note = opt.loNote; note <= opt.hiNote; note++)
+        {
+            Soak_AddNote(0, note, (uint8_t)Soak_RandomRange(64, 127), 150000);
+        }
+        length = 500000;
+        break;
+    case PATTERN_ROLL:
+    {
+        // 32 strokes per second on one note, crescendo
+        uint8_t note = Soak_RandomNote();
+        for (int i = 0; i < 32; i++)
+        {
+            Soak_AddNote(i * 31250, note, (uint8_t)(40 + i * 87 / 31), 10000);
+        }
+        length = 1200000;
+        break;
+    }
+    case PATTERN_FLAM:
+        // grace note 12 ms before the main stroke
+        for (int i = 0; i < 8; i++)
+        {
+            Soak_AddNote(i * 250000, Soak_RandomNote(), 50, 10000);
+            Soak_AddNote(i * 250000 + 12000, Soak_RandomNote(), 120, 50000);
+        }
+        length = 2000000;
+        break;
+    case PATTERN_RANDOM:
+    default:
+    {
+        // poisson arrivals
+        double t = 0.0;
+        while (true)
+        {
+            t += -log(((Soak_Random() & 0xFFFFFF) + 1) / 16777217.0) / opt.rate * 1000000.0;
+            if (t >= 5000000.0)
+            {
+                break;
+            }
+            Soak_AddNote((uint64_t)t, Soak_RandomNote(), (uint8_t)Soak_RandomRange(1, 127), 50000);
+        }
+        length = 5000000;
+        break;
+    }
+    }
+    std::stable_sort(phrase.begin(), phrase.end(), [](const SoakMessage &a, const SoakMessage &b) { return a.time < b.time; });
+    return length;
+}
+
+static const SoakMessage *Soak_NextPhraseMessage()
+{
+    while (phraseNext >= phrase.size())
+    {
+        uint64_t lastStart = phraseStart;
+        phrase.clear();
+        phraseNext = 0;
+        SoakPattern pattern = opt.pattern;
+        if (pattern == PATTERN_MIXED)
+        {
+            pattern = (SoakPattern)(PATTERN_CHORD + phraseCount % (PATTERN_COUNT - 1));
+        }
+        uint64_t length = Soak_BuildPhrase(pattern);
+        phraseStart = lastStart + (phraseCount > 0 ? 0 : 1000000); // a second to settle after boot
+        for (SoakMessage &msg : phrase)
+        {
+            msg.time += phraseStart;
+        }
+        phraseStart += length;
+        phraseCount++;
+    }
+    return &phrase[phraseNext];
+}
+
+static void Soak_MidiSource(void *parameter)
+{
+    (void)parameter;
+    uint64_t uartFree = Sim_Now();
+    uint64_t nextClock = opt.clockBpm > 0.0 ? Sim_Now() : SIM_FOREVER;
+    const double clockPeriod = opt.clockBpm > 0.0 ? 60000000.0 / (opt.clockBpm * 24.0) : 0.0;
+    double clockTime = (double)nextClock;
+    uint8_t runningStatus = 0;
+
+    while (true)
+    {
+        SoakMessage msg;
+        const SoakMessage *note = Soak_NextPhraseMessage();
+        if (nextClock <= note->time)
+        {
+            msg = {nextClock, {0xF8, 0, 0}, 1};
+            clockTime += clockPeriod;
+            nextClock = (uint64_t)clockTime;
+        }
+        else
+        {
+            msg = *note;
+            phraseNext++;
+        }
+
+        // running status like most keyboards send it, realtime bytes leave it alone
+        int first = 0;
+        if (msg.bytes[0] < 0xF0)
+        {
+            if (msg.bytes[0] == runningStatus)
+            {
+                first = 1;
+            }
+            runningStatus = msg.bytes[0];
+        }
+
+        uint64_t t = std::max(msg.time, uartFree);
+        for (int i = first; i < msg.len; i++)
+        {
+            t += SOAK_UART_BYTE_US;
+            Sim_SleepUntil(t);
+            midiIn.receive(&msg.bytes[i], 1, micros()); // stands in for the UART event task
+        }
+        uartFree = t;
+
+        if ((msg.bytes[0] & 0xF0) == 0x90 && msg.bytes[2] > 0)
+        {
+            pendingNotes.push_back(t);
+            total.notesSent++;
+            interval.notesSent++;
+        }
+    }
+}
+
+/* Reporting */
+
+static void Soak_PrintHeader()
+{
+    printf("%10s %8s %7s %8s %8s %8s %8s %6s %5s %5s %6s %6s %5s %5s %5s %6s\n",
+           "sim s", "blocks", "undrrn", "lat min", "lat avg", "lat p99", "lat max",
+           "notes", "peak", "avg", "stolen", "retrig", "drop", "late", "uart", "load%");
+    if (csv)
+    {
+        fprintf(csv, "sim_s,blocks,underruns,underrun_ms,lat_min_ms,lat_avg_ms,lat_p99_ms,lat_max_ms,"
+                     "notes,peak_voices,avg_voices,stolen,retriggered,dropped,late,uart_overflows,max_load_pct\n");
+    }
+}
+
+static void Soak_PrintCounters(const SoakCounters &c, double simSeconds)
+{
+    const LatencyStats &l = c.latency;
+    double latMin = l.count ? l.min / 1000.0 : 0.0;
+    double latAvg = l.count ? l.sum / l.count / 1000.0 : 0.0;
+    double latP99 = l.count ? l.percentile(0.99) / 1000.0 : 0.0;
+    double latMax = l.count ? l.max / 1000.0 : 0.0;
+    double avgVoices = c.blocks ? (double)c.voiceSum / c.blocks : 0.0;
+
+    printf("%10.0f %8llu %7u %8.2f %8.2f %8.2f %8.2f %6u %5u %5.1f %6u %6u %5u %5u %5u %6.1f\n",
+           simSeconds, (unsigned long long)c.blocks, c.underruns, latMin, latAvg, latP99, latMax,
+           c.notesSent, c.peakVoices, avgVoices, c.voices.stolen, c.voices.retriggered, c.voices.dropped,
+           c.lateNotes, c.uartOverflows, c.maxLoad * 100.0);
+    if (csv)
+    {
+        fprintf(csv, "%.3f,%llu,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%u,%u,%.2f,%u,%u,%u,%u,%u,%.1f\n",
+                simSeconds, (unsigned long long)c.blocks, c.underruns, c.underrunUs / 1000.0, latMin, latAvg, latP99, latMax,
+                c.notesSent, c.peakVoices, avgVoices, c.voices.stolen, c.voices.retriggered, c.voices.dropped,
+                c.lateNotes, c.uartOverflows, c.maxLoad * 100.0);
+    }
+    fflush(stdout);
+}
+
+static void Soak_Finish()
+{
+    double simSeconds = Sim_Now() / 1000000.0;
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    printf("\ntotal:\n");
+    Soak_PrintCounters(total, simSeconds);
+    printf("\n%.0f s simulated in %.1f s, %.0fx real time\n", simSeconds, wall, wall > 0 ? simSeconds / wall : 0.0);
+    printf("underruns: %u (%.2f ms of silence)\n", total.underruns, total.underrunUs / 1000.0);
+    printf("voices: %u started, %u retriggered, %u stolen, %u dropped, %u retired early, %u shed, peak %u\n",
+           total.voices.started, total.voices.retriggered, total.voices.stolen, total.voices.dropped,
+           total.voices.retired, total.voices.shed, total.peakVoices);
+    VoiceStats governor = player->voiceStats();
+    printf("governor: cap %u voices (lowest %u), %s\n", governor.voiceCap, governor.lowestCap,
+           governor.fastInterpolation ? "nearest frame" : "interpolating");
+#ifdef MASTER_LIMITER
+    printf("limiter: %u sub-blocks limited, deepest %.1f dB\n", limiter->limitedBlocks(), 20.0f * log10f(limiter->deepestGain()));
+#endif
+
+    uint32_t recordDropped = 0;
+    if (opt.record)
+    {
+        // let the writer task close the take before exiting
+        recorder->stop();
+        Sim_SleepUntil(Sim_Now() + 10 * STORAGE_POLL_MS * 1000);
+        recordDropped = recorder->droppedBlocks();
+        printf("recorder: %u blocks dropped\n", recordDropped);
+    }
+
+    uint32_t unmatched = pendingNotes.size();
+    if (unmatched > 1)
+    {
+        printf("warning: %u notes sent were never started, latency figures are off. "
+               "Do all of --notes map to a sample?\n", unmatched);
+    }
+    if (csv)
+    {
+        fclose(csv);
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    bool failed = total.underruns > 0 || total.voices.dropped > 0 || total.uartOverflows > 0 || recordDropped > 0;
+    _Exit(failed ? 1 : 0);
+}
+
+/* I2S sink, the DMA queue drains at exactly the rate setup() installed */
+
+static bool sinkStarted = false;
+static double queueEnd;         // simulated time the queued audio runs out
+static double queueCapacityUs;  // dma_buf_count * dma_buf_len frames
+static uint32_t bytesPerFrame;
+static uint32_t sinkRate;
+static uint32_t lastStarted = 0;
+
+static void Soak_AccumulateVoices(SoakCounters &c, const VoiceStats &now, const VoiceStats &last)
+{
+    c.voices.started += now.started - last.started;
+    c.voices.retriggered += now.retriggered - last.retriggered;
+    c.voices.retired += now.retired - last.retired;
+    c.voices.shed += now.shed - last.shed;
+    c.voices.stolen += now.stolen - last.stolen;
+    c.voices.dropped += now.dropped - last.dropped;
+}
+
+static void Soak_I2sSink(const void *data, size_t size)
+{
+    (void)data;
+    static VoiceStats lastVoices = {};
+    static uint32_t lastLate = 0;
+    static uint32_t lastOverflows = 0;
+
+    // the block was rendered at no simulated cost, read what it did before charging for it
+    VoiceStats voices = player->voiceStats();
+    uint32_t started = voices.started + voices.dropped;
+    uint32_t blockVoices = voices.blockVoices;
+#ifdef DUAL_CORE_RENDER
+    uint32_t busiestCore = blockVoices > 1 ? (blockVoices + 1) / 2 : blockVoices;
+#else
+    uint32_t busiestCore = blockVoices;
+#endif
+    double cost = opt.blockUs + opt.voiceUs * busiestCore;
+    if (opt.jitterUs > 0.0)
+    {
+        cost += opt.jitterUs * (Soak_Random() & 0xFFFF) / 65536.0;
+    }
+
+    const uint32_t frames = size / bytesPerFrame;
+    const double blockUs = frames * 1000000.0 / sinkRate;
+    Sim_Busy((uint64_t)cost);
+
+    double now = (double)Sim_Now();
+    if (!sinkStarted)
+    {
+        sinkStarted = true;
+        queueEnd = now;
+    }
+    else if (now > queueEnd)
+    {
+        for (SoakCounters *c : {&total, &interval})
+        {
+            c->underruns++;
+            c->underrunUs += now - queueEnd;
+        }
+#ifdef EVENT_TRACE
+        // the render is charged in here, main.cpp only sees one long write, tell the trace what really ran dry
+        tracer.record(TRACE_XRUN, 0, 0, (uint32_t)queueEnd, (uint32_t)(now - queueEnd));
+        tracer.trigger();
+#endif
+        queueEnd = now;
+    }
+
+    // notes started by this block play when its first frame leaves the DAC
+    for (uint32_t n = lastStarted; n != started && !pendingNotes.empty(); n++)
+    {
+        double latency = queueEnd - (double)pendingNotes.front();
+        pendingNotes.pop_front();
+        total.latency.add(latency);
+        interval.latency.add(latency);
+    }
+    lastStarted = started;
+
+    uint32_t late = player->lateEvents();
+    uint32_t overflows = midiIn.overruns();
+    for (SoakCounters *c : {&total, &interval})
+    {
+        c->blocks++;
+        c->voiceSum += blockVoices;
+        c->peakVoices = std::max(c->peakVoices, voices.blockVoices);
+        c->maxLoad = std::max(c->maxLoad, cost / blockUs);
+        c->lateNotes += late - lastLate;
+        c->uartOverflows += overflows - lastOverflows;
+        Soak_AccumulateVoices(*c, voices, lastVoices);
+    }
+    lastVoices = voices;
+    lastLate = late;
+    lastOverflows = overflows;
+
+    queueEnd += blockUs;
+
+    if (Sim_Now() >= nextReport)
+    {
+        Soak_PrintCounters(interval, Sim_Now() / 1000000.0);
+        memset(&interval, 0, sizeof(interval));
+        interval.latency.clear();
+        nextReport += (uint64_t)(opt.reportSeconds * 1000000.0);
+    }
+    if (Sim_Now() >= endTime)
+    {
+        Soak_Finish();
+    }
+
+    // i2s_write() returns once the block fits into the DMA buffers
+    double fits = queueEnd - queueCapacityUs;
+    if (fits > now)
+    {
+        Sim_SleepUntil((uint64_t)ceil(fits));
+    }
+}
+
+static bool Soak_ParseArgs(int argc, char **argv)
+{
+    for (int i = 2; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "--record"))
+        {
+            opt.record = true;
+            continue;
+        }
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            fprintf(stderr, "%s needs a value\n", arg);
+            return false;
+        }
+        i++;
+        if (!strcmp(arg, "--hours"))
+        {
+            opt.seconds = atof(value) * 3600.0;
+        }
+        else if (!strcmp(arg, "--minutes"))
+        {
+            opt.seconds = atof(value) * 60.0;
+        }
+        else if (!strcmp(arg, "--pattern"))
+        {
+            int p = 0;
+            while (p < PATTERN_COUNT && strcmp(value, patternNames[p]))
+            {
+                p++;
+            }
+            if (p == PATTERN_COUNT)
+            {
+                fprintf(stderr, "unknown pattern %s\n", value);
+                return false;
+            }
+            opt.pattern = (SoakPattern)p;
+        }
+        else if (!strcmp(arg, "--notes"))
+        {
+            int lo, hi;
+            if (sscanf(value, "%d-%d", &lo, &hi) != 2 || lo < 0 || hi > 127 || lo > hi)
+            {
+                fprintf(stderr, "--notes wants lo-hi\n");
+                return false;
+            }
+            opt.loNote = lo;
+            opt.hiNote = hi;
+        }
+        else if (!strcmp(arg, "--channel"))
+        {
+            opt.channel = (uint8_t)std::min(std::max(atoi(value), 1), 16);
+        }
+        else if (!strcmp(arg, "--rate"))
+        {
+            opt.rate = std::max(atof(value), 0.1);
+        }
+        else if (!strcmp(arg, "--clock"))
+        {
+            opt.clockBpm = atof(value);
+        }
+        else if (!strcmp(arg, "--block-us"))
+        {
+            opt.blockUs = atof(value);
+        }
+        else if (!strcmp(arg, "--voice-us"))
+        {
+            opt.voiceUs = atof(value);
+        }
+        else if (!strcmp(arg, "--jitter-us"))
+        {
+            opt.jitterUs = atof(value);
+        }
+        else if (!strcmp(arg, "--report"))
+        {
+            opt.reportSeconds = std::max(atof(value), 0.1);
+        }
+        else if (!strcmp(arg, "--csv"))
+        {
+            opt.csvFile = value;
+        }
+        else if (!strcmp(arg, "--seed"))
+        {
+            opt.seed = (uint32_t)strtoul(value, nullptr, 0);
+        }
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || !Soak_ParseArgs(argc, argv))
+    {
+        fprintf(stderr, "usage: %s <sdcard dir> [--hours h] [--minutes m] [--pattern mixed|chord|roll|flam|random]\n"
+                        "  [--notes lo-hi] [--channel c] [--rate n] [--clock bpm] [--block-us us] [--voice-us us]\n"
+                        "  [--jitter-us us] [--report s] [--csv file] [--record] [--seed n]\n", argv[0]);
+        return 1;
+    }
+    if (opt.csvFile && !(csv = fopen(opt.csvFile, "w")))
+    {
+        fprintf(stderr, "Could not create %s\n", opt.csvFile);
+        return 1;
+    }
+
+    rngState = opt.seed ? opt.seed : 1;
+    memset(&total, 0, sizeof(total));
+    memset(&interval, 0, sizeof(interval));
+    total.latency.clear();
+    interval.latency.clear();
+
+    SD_MMC.setRoot(argv[1]);
+    Sim_Init();
+    setup();
+
+    const i2s_config_t *config = HostI2s_Config();
+    if (!config)
+    {
+        fprintf(stderr, "setup() did not install the I2S driver\n");
+        return 1;
+    }
+    bytesPerFrame = config->bits_per_sample / 8 * 2;
+    sinkRate = config->sample_rate;
+    queueCapacityUs = (double)config->dma_buf_count * config->dma_buf_len * 1000000.0 / sinkRate;
+    HostI2s_SetSink(Soak_I2sSink);
+
+    fprintf(stderr, "soak: %s pattern, notes %d-%d on channel %d, %.0f s, %u Hz, DMA queue %.2f ms\n",
+            patternNames[opt.pattern], opt.loNote, opt.hiNote, opt.channel, opt.seconds, sinkRate, queueCapacityUs / 1000.0);
+    wallStart = std::chrono::steady_clock::now();
+    endTime = Sim_Now() + (uint64_t)(opt.seconds * 1000000.0);
+    nextReport = Sim_Now() + (uint64_t)(opt.reportSeconds * 1000000.0);
+    Soak_PrintHeader();
+
+    Sim_Spawn(Soak_MidiSource, nullptr, "MidiSource", configMAX_PRIORITIES);
+    if (opt.record)
+    {
+        recorder->start();
+    }
+
+    while (true)
+    {
+        loop();
+    }
+}
@@ -0,0 +1,192 @@
+/*
+ * Turns a trace dump from the serial console into Chrome trace event JSON,
+ * for chrome://tracing or ui.perfetto.dev.
+ *
+ * usage: trace_json <serial log> [out.json] [dump number]
+ *
+ * The log can hold anything else the sketch printed, only the lines between
+ * "TRACE BEGIN" and "TRACE END" are read (see src/trace.hpp). Without a dump
+ * number the last complete dump in the log is converted, 1 is the first.
+ * Each core is a thread of the trace, spans become complete events and
+ * instants thread scoped instant events. Times are relative to the earliest
+ * event of the dump.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+struct TraceLine
+{
+    uint32_t start;
+    uint32_t duration;
+    unsigned core;
+    std::string name;
+    unsigned arg0;
+    unsigned arg1;
+};
+
+/* what the two arguments of each event mean, see TraceType */
+static void Trace_ArgNames(const std::string &name, const char *&arg0, const char *&arg1)
+{
+    arg0 = NULL;
+    arg1 = NULL;
+    if (name == "note")
+    {
+        arg0 = "note";
+        arg1 = "velocity";
+    }
+    else if (name == "voice" || name == "steal")
+    {
+        arg0 = "slot";
+        arg1 = "voice";
+    }
+    else if (name == "render")
+    {
+        arg0 = "voices";
+    }
+    else if (name == "loaded")
+    {
+        arg0 = "slot";
+    }
+}
+
+static bool Trace_ReadDump(FILE *in, int wanted, std::vector<TraceLine> &events)
+{
+    char line[256];
+    std::vector<TraceLine> current;
+    bool inDump = false;
+    int complete = 0;
+
+    while (fgets(line, sizeof(line), in))
+    {
+        /* a console may prefix its own timestamps, look for the markers anywhere in the line */
+        const char *begin = strstr(line, "TRACE BEGIN");
+        if (begin != NULL)
+        {
+            current.clear();
+            inDump = true;
+            continue;
+        }
+        if (!inDump)
+        {
+            continue;
+        }
+        if (strstr(line, "TRACE END") != NULL)
+        {
+            inDump = false;
+            complete++;
+            events = current;
+            if (complete == wanted)
+            {
+                return true;
+            }
+            continue;
+        }
+
+        const char *fields = strstr(line, "T ");
+        TraceLine event;
+        char name[32];
+        unsigned start, duration;
+        if (fields == NULL ||
+            sscanf(fields, "T %u %u %u %31s %u %u", &start, &duration, &event.core, name, &event.arg0, &event.arg1) != 6)
+        {
+            continue; /* something else printed in the middle of the dump */
+        }
+        event.start = start;
+        event.duration = duration;
+        event.name = name;
+        current.push_back(event);
+    }
+    return complete > 0 && wanted == 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <serial log> [out.json] [dump number]\n", argv[0]);
+        return 1;
+    }
+    const int wanted = (argc > 3) ? atoi(argv[3]) : 0;
+
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL)
+    {
+        fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<TraceLine> events;
+    bool found = Trace_ReadDump(in, wanted, events);
+    fclose(in);
+    if (!found)
+    {
+        fprintf(stderr, "%s: no complete trace dump%s\n", argv[1], wanted ? " with that number" : "");
+        return 1;
+    }
+
+    FILE *out = (argc > 2) ? fopen(argv[2], "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "could not create %s\n", argv[2]);
+        return 1;
+    }
+
+    /* the ring is in claim order, a span is claimed at its end, so the earliest start can be anywhere */
+    uint32_t origin = events.empty() ? 0 : events[0].start;
+    for (const TraceLine &event : events)
+    {
+        if ((int32_t)(event.start - origin) < 0)
+        {
+            origin = event.start;
+        }
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"sampler\"}},\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"core 0\"}},\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"core 1\"}}");
+    int xruns = 0;
+    for (const TraceLine &event : events)
+    {
+        const char *arg0;
+        const char *arg1;
+        Trace_ArgNames(event.name, arg0, arg1);
+        /* micros() wraps after 71 minutes, the difference stays right across it */
+        const uint32_t ts = event.start - origin;
+
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%u",
+                event.name.c_str(), event.name == "xrun" ? "xrun" : "sampler", event.core, ts);
+        const bool instant = event.name == "note" || event.name == "voice" || event.name == "steal" || event.name == "loaded";
+        if (!instant)
+        {
+            fprintf(out, ",\"ph\":\"X\",\"dur\":%u", event.duration);
+        }
+        else
+        {
+            fprintf(out, ",\"ph\":\"i\",\"s\":\"t\"");
+        }
+        fprintf(out, ",\"args\":{");
+        if (arg0 != NULL)
+        {
+            fprintf(out, "\"%s\":%u", arg0, event.arg0);
+        }
+        if (arg1 != NULL)
+        {
+            fprintf(out, ",\"%s\":%u", arg1, event.arg1);
+        }
+        fprintf(out, "}}");
+        xruns += (event.name == "xrun");
+    }
+    fprintf(out, "\n]}\n");
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%zu events, %d xruns\n", events.size(), xruns);
+    return 0;
+}
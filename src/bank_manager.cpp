@@ -0,0 +1,120 @@
+#include "bank_manager.hpp"
+#include "midi_note_handler.hpp"
+
+BankManager::BankManager(SamplePlayer* player, MidiNoteHandler* handler) : player(player), handler(handler), active(0),
+    pending(BANK_NONE), queued(BANK_NONE) {
+    for (int half = 0; half < 2; half++) {
+        banks[half].program = BANK_NONE;
+        banks[half].loading = false;
+        banks[half].path[0] = '\0';
+    }
+}
+
+bool BankManager::begin() {
+    if (!startLoad(0, 0)) {
+        return false;
+    }
+    while (!banks[0].load.done.load(std::memory_order_acquire)) {
+        delay(1);
+    }
+    banks[0].loading = false;
+    if (banks[0].load.numEntries == 0) {
+        banks[0].program = BANK_NONE;
+        return false;
+    }
+    activate(0);
+    return true;
+}
+
+void BankManager::select(uint8_t program) {
+    if (program == banks[active].program) {
+        pending = BANK_NONE;
+        return;
+    }
+    pending = program;
+    prefetch(program);
+    update();
+}
+
+void BankManager::prefetch(uint8_t program) {
+    const uint8_t shadow = 1 - active;
+    if (program == banks[shadow].program) {
+        return; // there or on its way
+    }
+    if (banks[shadow].loading) {
+        // the half is being written, the newest request goes next
+        queued = program;
+        return;
+    }
+    startLoad(shadow, program);
+}
+
+void BankManager::update() {
+    const uint8_t shadow = 1 - active;
+    Bank &bank = banks[shadow];
+    if (bank.loading) {
+        if (!bank.load.done.load(std::memory_order_acquire)) {
+            return;
+        }
+        bank.loading = false;
+        if (bank.load.numEntries == 0) {
+            Serial.printf("Bank %d: nothing to load from %s\n", bank.program, bank.path);
+            if (pending == bank.program) {
+                pending = BANK_NONE; // stay on the bank that plays
+            }
+            bank.program = BANK_NONE;
+        }
+        if (queued != BANK_NONE) {
+            uint8_t next = queued;
+            queued = BANK_NONE;
+            prefetch(next);
+            return;
+        }
+    }
+
+    if (pending != BANK_NONE && pending == bank.program && !bank.loading) {
+        pending = BANK_NONE;
+        activate(shadow);
+    }
+}
+
+int16_t BankManager::activeBank() {
+    return banks[active].program;
+}
+
+int16_t BankManager::shadowBank() {
+    return banks[1 - active].program;
+}
+
+bool BankManager::shadowReady() {
+    const Bank &bank = banks[1 - active];
+    return bank.program != BANK_NONE && !bank.loading;
+}
+
+bool BankManager::startLoad(uint8_t half, uint8_t program) {
+    Bank &bank = banks[half];
+    snprintf(bank.path, sizeof(bank.path), "%s/%d.txt", BANK_FOLDER, program);
+    bank.load.kitFile = bank.path;
+    bank.load.entries = bank.entries;
+    bank.load.maxEntries = MAX_KIT_ENTRIES;
+    bank.load.firstSlot = half * BANK_SLOTS;
+    bank.load.numSlots = BANK_SLOTS;
+    if (!player->loadKitAsync(&bank.load)) {
+        Serial.printf("Bank %d: could not queue the load\n", program);
+        return false;
+    }
+    bank.program = program;
+    bank.loading = true;
+    return true;
+}
+
+// Only the zone tables change, new notes go to the other half from the next one on
+void BankManager::activate(uint8_t half) {
+    active = half;
+    handler->setZones(banks[half].entries, banks[half].load.numEntries);
+    Serial.printf("Bank %d: %d zones in slots %d-%d\n", banks[half].program, banks[half].load.numEntries,
+                  half * BANK_SLOTS, half * BANK_SLOTS + BANK_SLOTS - 1);
+
+    // the next program is the likeliest next request
+    prefetch((banks[half].program + 1) & 0x7F);
+}
@@ -0,0 +1,51 @@
+#ifndef BankManager_hpp
+#define BankManager_hpp
+
+#include <Arduino.h>
+#include "config.hpp"
+#include "player.hpp"
+
+#define BANK_NONE -1
+
+class MidiNoteHandler;
+
+// Kits addressed by MIDI program change, BANK_FOLDER/<program>.txt in the kit file format.
+// The sample slots are split in two halves of BANK_SLOTS: the active bank plays from one
+// while the storage I/O task prefetches the next one into the other. A switch only swaps
+// the zone tables on core 0, the notes already sounding ring on from the old half.
+// A bank that is not prefetched yet is loaded first, the old one keeps playing until then.
+class BankManager {
+public:
+    BankManager(SamplePlayer* player, MidiNoteHandler* handler);
+    bool begin(); // setup, loads bank 0 and prefetches bank 1. false without a bank 0
+
+    // Core 0 only
+    void select(uint8_t program);   // switches as soon as the bank is in the shadow half
+    void prefetch(uint8_t program); // loads the shadow half unless it holds the program already
+    void update();                  // from the core 0 loop, finishes loads and pending switches
+
+    int16_t activeBank();  // program playing, BANK_NONE before begin()
+    int16_t shadowBank();  // program in or loading into the other half
+    bool shadowReady();
+
+private:
+    struct Bank {
+        int16_t program;
+        bool loading;
+        char path[STORAGE_PATH_LEN];
+        KitEntry entries[MAX_KIT_ENTRIES];
+        KitLoad load;
+    };
+
+    SamplePlayer* player;
+    MidiNoteHandler* handler;
+    Bank banks[2]; // index is the slot half
+    uint8_t active;
+    int16_t pending; // program selected while it was not ready
+    int16_t queued;  // prefetch waiting for the shadow half to finish loading
+
+    bool startLoad(uint8_t half, uint8_t program);
+    void activate(uint8_t half);
+};
+
+#endif /* BankManager_hpp */
@@ -4,10 +4,16 @@
 
 // MIDI
 #define MIDI_RX_PIN 19
+#define MIDI_UART_NUM 1          // UART1, the one Serial1 used to own
+#define MIDI_RX_RING_SIZE 256    // received bytes waiting for the parser, power of 2
+#define MIDI_LATENCY_FRAMES (2 * SAMPLE_BUFFER_SIZE) // arrival to playback, constant so input jitter never reaches the output
 #define NOTE_BEGIN 48
 
 // SD
 #define SD_CS 13
+#define STORAGE_QUEUE_SIZE  16 // requests waiting for the I/O task
+#define STORAGE_PATH_LEN    64
+#define STORAGE_POLL_MS     20 // I/O task period while a stream (the recorder) is active
 
 // I2C
 #define I2C1_SDA 21
@@ -21,14 +27,112 @@
 #define I2S_DIN_PIN -1
 
 #define CHANNEL_COUNT   2
-#define WORD_SIZE   16
-#define I2S1CLK (512*SAMPLE_RATE)
-#define BCLK    (SAMPLE_RATE*CHANNEL_COUNT*WORD_SIZE)
-#define LRCK    (SAMPLE_RATE*CHANNEL_COUNT)
+#define WORD_SIZE   16 // I2S slot bits, 32 for DACs that take 24 or 32 bit words
+#define I2S1CLK(rate) (512*(rate)) // MCLK out on GPIO0 for the DAC
+#define BCLK(rate)    ((rate)*CHANNEL_COUNT*WORD_SIZE)
+#define LRCK(rate)    ((rate)*CHANNEL_COUNT)
 
 // Audio general
-#define SAMPLE_RATE 44100
+#define SAMPLE_RATE 44100 // default output rate, RATE_FILE on the card overrides it at boot
+#define SAMPLE_RATES {22050, 32000, 44100, 48000} // rates RATE_FILE may select
+#define RATE_FILE   "/rate.txt"
 #define SAMPLE_SIZE_16BIT
 #define SAMPLE_BUFFER_SIZE 64
-#define AUDIBLE_LIMIT   (0.25f/32768.0f)
-#define NUM_PLAYERS 8
\ No newline at end of file
+#define AUDIBLE_LIMIT   (0.25f/32768.0f) // float bus level where a fading retrigger tail is dropped, a quarter of an output LSB
+// A voice stops reading its sample once the loudest frame left, at its velocity and envelope,
+// stays under 4 LSB of the 16 bit output: +12 dB over one LSB, -78.3 dBFS. With full scale
+// playing at a loud 90 dB SPL that is 12 dB SPL, at the threshold of hearing and masked by
+// anything else that plays. The cut is a step of at most 4 LSB, no audible click.
+#define RETIRE_LEVEL    (4.0f/32768.0f)
+// Head and tail frames at or under this int16 magnitude are cut at load: 1 LSB, the rounding
+// noise of the source. Not AUDIBLE_LIMIT, that is a level on the float bus and scaled to the
+// int16 source it rounds down to 0, which only ever trimmed exact digital zeros.
+#define TRIM_SILENCE    1
+#define NUM_PLAYERS 32
+#define SAMPLE_STORE_SIZE (2 * NUM_PLAYERS) // distinct sample buffers, slots share identical files
+#define MAX_SLICES  64 // cue/smpl markers kept per file, see "slices" in the kit file
+#define SLOT_SWAP_TIMEOUT_MS 20 // longest wait for the render loop before a slot changes buffers
+#define RETIRED_BUFFERS (2 * NUM_PLAYERS) // buffers held back after a swap timed out, until the render loop moves on
+#define NUM_VOICES  32
+
+// Rendering
+#define DUAL_CORE_RENDER   // split the active voices between both cores
+#define RENDER_PARTITIONS 2
+#define MIX_ESP_DSP       // mix kernels through ESP-DSP where it has a routine, see mix_kernels.hpp
+#define NOTE_QUEUE_SIZE   64 // scheduled notes waiting for their block, power of 2
+//#define RENDER_BENCHMARK // print max voice count in single and dual core mode at boot
+#define GOVERNOR_HIGH_LOAD   0.85f // render time over block deadline that makes the governor step in
+#define GOVERNOR_LOW_LOAD    0.60f // below this for GOVERNOR_HOLD_BLOCKS it backs off one step
+#define GOVERNOR_HOLD_BLOCKS 64    // about 90 ms at 44.1 kHz
+#define GOVERNOR_MIN_VOICES  4     // the voice cap never goes below this
+
+// Output stage
+#define OUTPUT_SCALE_16 32767.0f      // 1.0 on the bus is full scale, past it clips
+#define OUTPUT_SCALE_32 2147483647.0f
+//#define OUTPUT_DITHER // TPDF dither on every 16 bit conversion, I2S and recordings
+#define MASTER_LIMITER     // hold the master bus under LIMITER_CEILING before the conversion
+#define LIMITER_CEILING    0.98f // about -0.2 dBFS
+#define LIMITER_SUBBLOCK   16    // frames per gain step, divides SAMPLE_BUFFER_SIZE
+#define LIMITER_LOOKAHEAD  1     // sub-blocks of delay, the gain is down before a peak goes out
+#define LIMITER_RELEASE_MS 80    // time constant of the gain coming back up
+
+// Send effects, fed per voice by MIDI_CC_DELAY and MIDI_CC_REVERB, set by MIDI_CC_DELAY_TIME and the ones after it
+#define SEND_EFFECTS         // shared delay and reverb buses, processed once per block
+#define EFFECTS_INTERNAL_RAM // delay lines in internal RAM, comment out to put them in PSRAM
+#define DELAY_MAX_MS   300   // sizes the delay lines, with the reverb 71 KB at 48 kHz, 65 KB at 44.1 kHz
+#define DELAY_TIME_MS  250
+#define DELAY_FEEDBACK 0.45f
+#define DELAY_DAMPING  0.3f  // high cut in the feedback path, 0.0 -> 1.0
+#define DELAY_WET      0.5f
+#define REVERB_SIZE    0.6f  // 0.0 -> 1.0, comb feedback 0.7 -> 0.98
+#define REVERB_DAMPING 0.4f  // 0.0 -> 1.0
+#define REVERB_WET     0.5f
+
+// Recording the master bus
+#define RECORD_FOLDER       "/recordings"
+#define RECORD_RING_BLOCKS  2048  // PSRAM ring in audio blocks, 2048 * 512 bytes = 3 s of slack for slow SD writes, allocated per take
+#define RECORD_CHUNK_SIZE   16384 // bytes per SD write, a multiple of the 512 byte sector
+
+// Event trace, see trace.hpp
+#define EVENT_TRACE            // event ring on both cores, dumped over serial after an xrun
+#define TRACE_EVENTS      1024 // a power of two, 16 bytes each in internal RAM
+#define TRACE_POST_EVENTS 256  // kept after an xrun, the rest of the ring is what led up to it
+#define TRACE_DUMP_LINES  4    // per core 0 loop pass, a dump never holds MIDI up for long
+
+// Serial console, see console.hpp
+#define CONSOLE_LINE_LEN 32 // longer command lines are dropped whole
+#define CONSOLE_TASKS    6  // tasks with their stack high-water mark in the "k" report
+#define CONSOLE_REGIONS  6  // fixed allocations listed in the "m" report
+
+// Key mapping
+#define MIDI_CHANNELS 16
+#define MIDI_NOTES    128
+#define NUM_ZONES     64
+#define MAX_LAYERS        8 // velocity layers per zone
+#define MAX_ROUND_ROBIN   4 // alternates per velocity layer
+#define KIT_FILE          "/samples/kit.txt"
+#define MAX_KIT_ENTRIES   256
+#define DEFAULT_KIT_SIZE  8 // /samples/0.wav ... when there is no kit file
+#define BANK_FOLDER       "/banks" // <program>.txt kit files, program change switches between them
+#define BANK_SLOTS        (NUM_PLAYERS / 2) // per bank, the other half holds the prefetched one
+#define BANK_RELEASE_MS   1000 // longest the old bank's slots may ring, all together, before the prefetch reuses them
+#define BANK_FADE_MS      100  // then its voices fade like shed ones, the tail is gone in 55 ms even at 22.05 kHz
+
+// Control
+#define PITCH_BEND_RANGE  2     // semitones
+#define MAX_ATTACK_TIME   2.0f  // seconds at attack CC 127
+#define MAX_DECAY_TIME    10.0f // seconds to -60dB at decay CC 126
+#define FILTER_VELOCITY_DEPTH 36.0f  // semitones the cutoff drops from velocity 127 down to 0
+#define FILTER_MAX_RESONANCE  0.975f // resonance CC 127, Q 20
+#define FILTER_MAX_CUTOFF     0.45f  // of the output rate, the cutoff table stops short of Nyquist
+
+// Sequencer
+#define SEQ_TRACKS            8
+#define SEQ_MAX_STEPS         64
+#define SEQ_STEPS_PER_BEAT    4
+#define SEQ_TICKS_PER_STEP    (24 / SEQ_STEPS_PER_BEAT) // midi clock is 24 ppqn
+#define SEQ_DEFAULT_BPM       120.0f
+#define SEQ_LOOKAHEAD_MS      6    // covers the core 0 loop period plus one block
+#define SEQ_CLOCK_TIMEOUT_MS  500  // fall back to the internal tempo after this
+#define SEQ_REPORT_MS         5000
+//#define SEQ_DEMO_PATTERN         // start a basic beat on the default kit at boot
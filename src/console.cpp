@@ -0,0 +1,191 @@
+#include "console.hpp"
+#include <ctype.h>
+#include "sample_store.hpp"
+#include "trace.hpp"
+
+Console::Console(SamplePlayer* player) : player(player), numTasks(0), numRegions(0), lineLen(0), overlong(false) {
+    line[0] = '\0';
+}
+
+void Console::watchTask(const char *name, TaskHandle_t task) {
+    if (numTasks >= CONSOLE_TASKS) {
+        Serial.printf("Console: no room to watch %s\n", name);
+        return;
+    }
+    tasks[numTasks].name = name;
+    tasks[numTasks].handle = task != NULL ? task : xTaskGetCurrentTaskHandle();
+    numTasks++;
+}
+
+void Console::addRegion(const char *name, uint32_t bytes) {
+    if (numRegions >= CONSOLE_REGIONS) {
+        Serial.printf("Console: no room to list %s\n", name);
+        return;
+    }
+    regions[numRegions].name = name;
+    regions[numRegions].bytes = bytes;
+    numRegions++;
+}
+
+void Console::update() {
+    while (Serial.available() > 0) {
+        input((char)Serial.read());
+    }
+}
+
+bool Console::input(char c) {
+    if (c != '\r' && c != '\n') {
+        if (lineLen >= CONSOLE_LINE_LEN - 1) {
+            overlong = true;
+        } else {
+            line[lineLen++] = c;
+        }
+        return false;
+    }
+
+    // a CR LF ending shows up as an empty second line, nothing to run
+    const bool complete = lineLen > 0 && !overlong;
+    line[lineLen] = '\0';
+    lineLen = 0;
+    overlong = false;
+    if (!complete) {
+        return false;
+    }
+    if (!run(line)) {
+        Serial.printf("Console: unknown command '%s', h lists them\n", line);
+        return false;
+    }
+    return true;
+}
+
+bool Console::run(const char *line) {
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+    const char command = *line;
+    if (command == '\0') {
+        return false;
+    }
+    const char *arg = line + 1;
+    if (*arg != '\0' && !isspace((unsigned char)*arg)) {
+        return false; // "mx" is not "m"
+    }
+    while (isspace((unsigned char)*arg)) {
+        arg++;
+    }
+    char *end;
+    const long number = strtol(arg, &end, 10);
+    const bool hasNumber = end != arg;
+    if (*end != '\0' && !isspace((unsigned char)*end)) {
+        return false;
+    }
+
+    switch (command) {
+    case 'm':
+        printMemory();
+        return true;
+    case 's':
+        if (!hasNumber) {
+            printSlots();
+            return true;
+        }
+        if (number < 0 || number >= NUM_PLAYERS) {
+            Serial.printf("slot %ld: out of range 0-%d\n", number, NUM_PLAYERS - 1);
+            return true;
+        }
+        printSlot((uint8_t)number);
+        return true;
+    case 'k':
+        printStacks();
+        return true;
+#ifdef EVENT_TRACE
+    case 't':
+        tracer.trigger();
+        Serial.printf("trace: dump after %d more events\n", TRACE_POST_EVENTS);
+        return true;
+#endif
+    case 'h':
+    case '?':
+        printHelp();
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Console::heapStats(uint32_t caps, HeapStats &stats) {
+    stats.total = heap_caps_get_total_size(caps);
+    stats.free = heap_caps_get_free_size(caps);
+    stats.lowestFree = heap_caps_get_minimum_free_size(caps);
+    stats.largestBlock = heap_caps_get_largest_free_block(caps);
+    if (stats.largestBlock > stats.free) {
+        stats.largestBlock = stats.free; // the two reads are not atomic
+    }
+    stats.fragmentation = stats.free > 0 ? (uint8_t)(100 - (uint64_t)stats.largestBlock * 100 / stats.free) : 0;
+}
+
+void Console::printHeap(const char *name, uint32_t caps) {
+    HeapStats stats;
+    heapStats(caps, stats);
+    Serial.printf("%s: %u total, %u free (lowest %u), largest block %u, %d%% fragmented\n", name,
+                  (unsigned)stats.total, (unsigned)stats.free, (unsigned)stats.lowestFree, (unsigned)stats.largestBlock,
+                  stats.fragmentation);
+}
+
+void Console::printMemory() {
+    printHeap("psram", MALLOC_CAP_SPIRAM);
+    printHeap("internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+    // the player's budget is the PSRAM left after the fixed allocations, the samples live in it
+    const uint32_t budget = SamplePlayer::sampleBudget();
+    const uint32_t used = sampleStore.bytes();
+    Serial.printf("samples: %u bytes in %d buffers, %d%% of the %u byte budget\n", (unsigned)used,
+                  sampleStore.buffers(), budget > 0 ? (int)((uint64_t)used * 100 / budget) : 0, (unsigned)budget);
+    for (int i = 0; i < numRegions; i++) {
+        Serial.printf("%s: %u bytes\n", regions[i].name, (unsigned)regions[i].bytes);
+    }
+}
+
+// false when the slot is empty, said so only when asked for the one slot
+bool Console::printSlot(uint8_t sampleNum, bool reportEmpty) {
+    SampleInfo info;
+    bool changing;
+    if (!player->sampleInfo(sampleNum, info, &changing)) {
+        if (changing) {
+            Serial.printf("slot %d: changing, try again\n", sampleNum);
+        } else if (reportEmpty) {
+            Serial.printf("slot %d: empty\n", sampleNum);
+        }
+        return false;
+    }
+    Serial.printf("slot %d: %s, %u frames %s, %u bytes", sampleNum, info.path[0] != '\0' ? info.path : "(buffer)",
+                  (unsigned)info.frames, info.stereo ? "stereo" : "mono", (unsigned)info.bytes);
+    if (info.sharedBy > 1) {
+        Serial.printf(" shared by %d slots", info.sharedBy);
+    }
+    Serial.println();
+    return true;
+}
+
+void Console::printSlots() {
+    int loaded = 0;
+    for (int i = 0; i < NUM_PLAYERS; i++) {
+        loaded += printSlot(i, false) ? 1 : 0;
+    }
+    // shared buffers show up on every slot, the store counts them once
+    Serial.printf("slots: %d of %d loaded, %u bytes in %d buffers\n", loaded, NUM_PLAYERS,
+                  (unsigned)sampleStore.bytes(), sampleStore.buffers());
+}
+
+void Console::printStacks() {
+    for (int i = 0; i < numTasks; i++) {
+        Serial.printf("stack %s: %u bytes never used\n", tasks[i].name, (unsigned)uxTaskGetStackHighWaterMark(tasks[i].handle));
+    }
+}
+
+void Console::printHelp() {
+    Serial.println("m: memory, s [slot]: slot footprint, k: task stacks");
+#ifdef EVENT_TRACE
+    Serial.println("t: dump the event trace");
+#endif
+}
@@ -0,0 +1,67 @@
+#ifndef Console_hpp
+#define Console_hpp
+
+#include <Arduino.h>
+#include "config.hpp"
+#include "player.hpp"
+
+// One heap as esp_heap_caps sees it, see Console::heapStats()
+struct HeapStats {
+    uint32_t total;
+    uint32_t free;
+    uint32_t lowestFree;    // since boot, the headroom that was left at the worst moment
+    uint32_t largestBlock;  // biggest single allocation that would succeed now
+    uint8_t fragmentation;  // percent of the free bytes outside the largest block
+};
+
+// Commands on the serial console, one letter per line plus an optional number:
+//   m      heaps, the sample store against its budget and the fixed allocations
+//   s [n]  footprint of every loaded slot, or of slot n
+//   k      stack high-water marks of the watched tasks
+//   t      trigger the event trace, the dump follows (EVENT_TRACE)
+//   h      this list
+// Everything it reads is a snapshot, a load running at the same time can move the numbers.
+class Console {
+public:
+    Console(SamplePlayer* player);
+
+    // Setup, before update() runs
+    void watchTask(const char *name, TaskHandle_t task); // NULL is the calling task
+    void addRegion(const char *name, uint32_t bytes);    // allocations made once at setup
+
+    // Core 0 only
+    void update();            // from the core 0 loop, runs the lines that came in on Serial
+    bool input(char c);       // true when c ended a line that ran as a command
+    bool run(const char *line);
+
+    static void heapStats(uint32_t caps, HeapStats &stats);
+
+private:
+    struct Task {
+        const char *name;
+        TaskHandle_t handle;
+    };
+
+    struct Region {
+        const char *name;
+        uint32_t bytes;
+    };
+
+    SamplePlayer* player;
+    Task tasks[CONSOLE_TASKS];
+    uint8_t numTasks;
+    Region regions[CONSOLE_REGIONS];
+    uint8_t numRegions;
+    char line[CONSOLE_LINE_LEN];
+    uint8_t lineLen;
+    bool overlong; // the line ran past CONSOLE_LINE_LEN, dropped at its end
+
+    void printHeap(const char *name, uint32_t caps);
+    void printMemory();
+    bool printSlot(uint8_t sampleNum, bool reportEmpty = true);
+    void printSlots();
+    void printStacks();
+    void printHelp();
+};
+
+#endif /* Console_hpp */
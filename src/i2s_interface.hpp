@@ -10,6 +10,7 @@
 #endif
 
 #include <driver/i2s.h>
+#include "mix_kernels.hpp"
 
 /*
  * no dac not tested within this code
@@ -20,6 +21,13 @@
 
 const i2s_port_t i2s_port_number = I2S_NUM_0;
 
+/*
+ * DMA buffering, I2S_DMA_FRAMES is how much output the driver holds once a write had to wait
+ */
+#define I2S_DMA_BUF_COUNT 2
+#define I2S_DMA_BUF_LEN 128
+#define I2S_DMA_FRAMES (I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN)
+
 bool i2s_write_stereo_samples(float *fl_sample, float *fr_sample)
 {
     static union sampleTUNT
@@ -73,26 +81,28 @@ bool i2s_write_mono_samples_buff(float *fsample, const int buffLen)
     }
 }
 
+/*
+ * one conversion pass per block into a local buffer that i2s_write copies to DMA,
+ * full scale with clipping, slot width from WORD_SIZE
+ */
 bool i2s_write_stereo_samples_buff(float *fl_sample, float *fr_sample, const int buffLen)
 {
-    static union sampleTUNT
-    {
-        uint32_t sample;
-        int16_t ch[2];
-    } sampleDataU[SAMPLE_BUFFER_SIZE];
-
-    for (int n = 0; n < buffLen; n++)
-    {
-        /*
-         * using RIGHT_LEFT format
-         */
-        sampleDataU[n].ch[0] = int16_t(fl_sample[n] * 16383.0f); /* some bits missing here */
-        sampleDataU[n].ch[1] = int16_t(fr_sample[n] * 16383.0f);
-    }
+#if WORD_SIZE == 32
+    int32_t frames[2 * SAMPLE_BUFFER_SIZE];
+    Mix_InterleaveSat32(frames, fl_sample, fr_sample, OUTPUT_SCALE_32, buffLen);
+#else
+    int16_t frames[2 * SAMPLE_BUFFER_SIZE];
+#ifdef OUTPUT_DITHER
+    static uint32_t ditherState = 1;
+    Mix_InterleaveDither16(frames, fl_sample, fr_sample, OUTPUT_SCALE_16, &ditherState, buffLen);
+#else
+    Mix_InterleaveSat16(frames, fl_sample, fr_sample, OUTPUT_SCALE_16, buffLen);
+#endif
+#endif
 
-    static size_t bytes_written = 0;
+    size_t bytes_written = 0;
 
-    if(i2s_write(i2s_port_number, (const char *)&sampleDataU[0].sample, 4 * buffLen, &bytes_written, portMAX_DELAY) != ESP_OK)
+    if(i2s_write(i2s_port_number, (const char *)frames, 2 * sizeof(frames[0]) * buffLen, &bytes_written, portMAX_DELAY) != ESP_OK)
         Serial.println("i2s write error!");
 
     if (bytes_written > 0)
@@ -158,13 +168,15 @@ i2s_config_t i2s_configuration =
 {
     .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX), // | I2S_MODE_DAC_BUILT_IN
     .sample_rate = SAMPLE_RATE,
-    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT, /* the DAC module will only take the 8bits from MSB */
+    .bits_per_sample = (i2s_bits_per_sample_t)WORD_SIZE, /* the DAC module will only take the 8bits from MSB */
     .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
     .communication_format = (i2s_comm_format_t)(I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB),
     .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1, // default interrupt priority
-    .dma_buf_count = 2,
-    .dma_buf_len = 128,
-    // .use_apll = true,
+    .dma_buf_count = I2S_DMA_BUF_COUNT,
+    .dma_buf_len = I2S_DMA_BUF_LEN,
+    .use_apll = true, /* see setup_i2s */
+    .tx_desc_auto_clear = false,
+    .fixed_mclk = 0,
 };
 
 i2s_pin_config_t pins =
@@ -175,11 +187,35 @@ i2s_pin_config_t pins =
     .data_in_num = I2S_DIN_PIN
 };
 
-void setup_i2s()
+bool i2s_rate_supported(uint32_t sampleRate)
 {
+    static const uint32_t rates[] = SAMPLE_RATES;
+    for (uint32_t n = 0; n < sizeof(rates) / sizeof(rates[0]); n++)
+    {
+        if (rates[n] == sampleRate)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void setup_i2s(uint32_t sampleRate = SAMPLE_RATE)
+{
+    i2s_configuration.sample_rate = sampleRate;
+    /*
+     * MCLK is 512 * fs, which never divides the 160MHz PLL_D2 clock evenly
+     * (8k gives 39.0625, 44.1k 7.09), so the divider would jitter around the rate.
+     * The APLL is tuned to MCLK itself for every rate
+     */
+    i2s_configuration.use_apll = true;
+    i2s_configuration.fixed_mclk = I2S1CLK(sampleRate);
+    Serial.printf("I2S: %u Hz, APLL, MCLK %u, BCLK %u\n", (unsigned)sampleRate,
+        (unsigned)I2S1CLK(sampleRate), (unsigned)BCLK(sampleRate));
+
     Serial.print("Driver install: ");Serial.println(i2s_driver_install(i2s_port_number, &i2s_configuration, 0, NULL));
     Serial.print("Pin set: ");Serial.println(i2s_set_pin(I2S_NUM_0, &pins));
-    Serial.print("Rate set: ");Serial.println(i2s_set_sample_rates(i2s_port_number, SAMPLE_RATE));
+    Serial.print("Rate set: ");Serial.println(i2s_set_sample_rates(i2s_port_number, sampleRate));
     Serial.print("I2S start: ");Serial.println(i2s_start(i2s_port_number));
     REG_WRITE(PIN_CTRL, 0xFFFFFFF0);
     PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, FUNC_GPIO0_CLK_OUT1);
@@ -0,0 +1,68 @@
+#include "limiter.hpp"
+
+Limiter::Limiter(uint32_t sampleRate) : oldest(0), currentGain(1.0f), limited(0), deepest(1.0f) {
+    memset(delay_l, 0, sizeof(delay_l));
+    memset(delay_r, 0, sizeof(delay_r));
+    for (int k = 0; k < LIMITER_LOOKAHEAD; k++) {
+        needed[k] = 1.0f;
+    }
+    release = 1.0f - expf(-(float)LIMITER_SUBBLOCK * 1000.0f / (LIMITER_RELEASE_MS * (float)sampleRate));
+}
+
+void Limiter::process(float *signal_l, float *signal_r, const int len) {
+    for (int n = 0; n < len; n += LIMITER_SUBBLOCK) {
+        processSubBlock(&signal_l[n], &signal_r[n]);
+    }
+}
+
+void Limiter::processSubBlock(float *signal_l, float *signal_r) {
+    float peak = 0.0f;
+    for (int n = 0; n < LIMITER_SUBBLOCK; n++) {
+        peak = fmaxf(peak, fmaxf(fabsf(signal_l[n]), fabsf(signal_r[n])));
+    }
+    const float need = (peak > LIMITER_CEILING) ? LIMITER_CEILING / peak : 1.0f;
+
+    // the oldest delayed sub-block goes out now, the rest of the delay and the new one are ahead of it
+    float target = need;
+    for (int k = 0; k < LIMITER_LOOKAHEAD; k++) {
+        target = fminf(target, needed[k]);
+    }
+    target = fminf(target, currentGain + (1.0f - currentGain) * release);
+
+    // the previous gain is already at or under what this sub-block needs, so the ramp is too
+    float *out_l = delay_l[oldest];
+    float *out_r = delay_r[oldest];
+    float gain = currentGain;
+    const float inc = (target - currentGain) / LIMITER_SUBBLOCK;
+    for (int n = 0; n < LIMITER_SUBBLOCK; n++) {
+        const float in_l = signal_l[n];
+        const float in_r = signal_r[n];
+        gain += inc;
+        signal_l[n] = out_l[n] * gain;
+        signal_r[n] = out_r[n] * gain;
+        out_l[n] = in_l;
+        out_r[n] = in_r;
+    }
+
+    if (target < 1.0f || currentGain < 1.0f) {
+        limited.fetch_add(1, std::memory_order_relaxed);
+        if (target < deepest.load(std::memory_order_relaxed)) {
+            deepest.store(target, std::memory_order_relaxed);
+        }
+    }
+    currentGain = target;
+    needed[oldest] = need;
+    oldest = (oldest + 1) % LIMITER_LOOKAHEAD;
+}
+
+float Limiter::gain() {
+    return currentGain;
+}
+
+uint32_t Limiter::limitedBlocks() {
+    return limited.load(std::memory_order_relaxed);
+}
+
+float Limiter::deepestGain() {
+    return deepest.exchange(1.0f, std::memory_order_relaxed);
+}
@@ -0,0 +1,43 @@
+#ifndef Limiter_hpp
+#define Limiter_hpp
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.hpp"
+
+#if SAMPLE_BUFFER_SIZE % LIMITER_SUBBLOCK != 0
+#error "LIMITER_SUBBLOCK has to divide SAMPLE_BUFFER_SIZE"
+#endif
+
+#define LIMITER_DELAY_FRAMES (LIMITER_LOOKAHEAD * LIMITER_SUBBLOCK)
+
+// Peak limiter for the master bus, between the render and the output conversion.
+// The bus goes out LIMITER_DELAY_FRAMES late. Each sub-block's gain is the lowest any
+// sub-block up to the newest one needs, ramped linearly from the previous sub-block's,
+// so the gain is already down when a peak goes out and the ramp never overshoots.
+// The cost is one peak scan and one multiply per frame, whatever the mix.
+class Limiter {
+public:
+    Limiter(uint32_t sampleRate = SAMPLE_RATE);
+
+    // Audio thread, in place, len a multiple of LIMITER_SUBBLOCK
+    void process(float *signal_l, float *signal_r, const int len);
+
+    float gain();             // applied at the end of the last block, 1.0 = untouched
+    uint32_t limitedBlocks(); // sub-blocks that went out below unity gain
+    float deepestGain();      // lowest gain since the last call, resets it
+
+private:
+    float delay_l[LIMITER_LOOKAHEAD][LIMITER_SUBBLOCK];
+    float delay_r[LIMITER_LOOKAHEAD][LIMITER_SUBBLOCK];
+    float needed[LIMITER_LOOKAHEAD]; // gain each delayed sub-block needs
+    uint8_t oldest;  // delayed sub-block that goes out next
+    float currentGain;
+    float release;   // share of the distance to unity recovered per sub-block
+    std::atomic<uint32_t> limited;
+    std::atomic<float> deepest;
+
+    void processSubBlock(float *signal_l, float *signal_r);
+};
+
+#endif /* Limiter_hpp */
@@ -1,11 +1,19 @@
 #include <Arduino.h>
-#include <MIDI.h>
 #include <Wire.h>
 
 #include "player.hpp"
 #include "config.hpp"
 #include "i2s_interface.hpp"
 #include "midi_note_handler.hpp"
+#include "sequencer.hpp"
+#include "recorder.hpp"
+#include "storage.hpp"
+#include "mix_kernels.hpp"
+#include "limiter.hpp"
+#include "send_effects.hpp"
+#include "bank_manager.hpp"
+#include "trace.hpp"
+#include "console.hpp"
 
 TwoWire I2C1 = TwoWire(0); //I2C1 bus
 // TwoWire I2C2 = TwoWire(1); //I2C2 bus might not need this?
@@ -14,36 +22,424 @@ TaskHandle_t Core0TaskHnd;
 
 SamplePlayer* player; // sample player
 MidiNoteHandler* midi_handler; // midi note dispatch
+Sequencer* sequencer; // pattern playback on core 0
+Recorder* recorder; // master bus to SD
+Limiter* limiter; // master bus peak limiter
+SendEffects* effects; // delay and reverb on the send buses
+BankManager* banks; // program change kits
+Console* console; // memory and trace commands on the serial console
 
+static uint32_t sampleRate = SAMPLE_RATE; // picked at boot from RATE_FILE
 static float fl_sample[SAMPLE_BUFFER_SIZE]; // raw (mixed) sound data to be sent out the DAC
 static float fr_sample[SAMPLE_BUFFER_SIZE]; // these should probably go somewhere else tbh
+#ifdef SEND_EFFECTS
+static float delay_send[SAMPLE_BUFFER_SIZE]; // mono send buses, every voice adds its send level
+static float reverb_send[SAMPLE_BUFFER_SIZE];
+#define SEND_BUSES delay_send, reverb_send
+#define SEND_BUSES_CORE0 delay_send_core0, reverb_send_core0
+#else
+#define SEND_BUSES NULL, NULL
+#define SEND_BUSES_CORE0 NULL, NULL
+#endif
+
+#ifdef DUAL_CORE_RENDER
+TaskHandle_t RenderTask0Hnd;
+TaskHandle_t AudioTaskHnd;
+
+static float fl_sample_core0[SAMPLE_BUFFER_SIZE]; // partial bus rendered on core 0
+static float fr_sample_core0[SAMPLE_BUFFER_SIZE];
+#ifdef SEND_EFFECTS
+static float delay_send_core0[SAMPLE_BUFFER_SIZE];
+static float reverb_send_core0[SAMPLE_BUFFER_SIZE];
+#endif
+static bool dualCoreRender = true;
+
+// core 0 half of the fork/join, wakes once per block
+void RenderTask0(void *parameter)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t start = micros();
+
+    Mix_Clear(fl_sample_core0, SAMPLE_BUFFER_SIZE);
+    Mix_Clear(fr_sample_core0, SAMPLE_BUFFER_SIZE);
+#ifdef SEND_EFFECTS
+    Mix_Clear(delay_send_core0, SAMPLE_BUFFER_SIZE);
+    Mix_Clear(reverb_send_core0, SAMPLE_BUFFER_SIZE);
+#endif
+    player->processPartition(1, RENDER_PARTITIONS, fl_sample_core0, fr_sample_core0, SAMPLE_BUFFER_SIZE, SEND_BUSES_CORE0);
+
+    TRACE_SPAN(TRACE_PARTITION, 0, 0, start);
+    xTaskNotifyGive(AudioTaskHnd);
+  }
+}
+#endif
+
+// prints the governor's decisions as it makes them, the audio thread never prints
+static void report_governor()
+{
+  static uint8_t lastCap = NUM_VOICES;
+  static bool lastFast = false;
+
+  VoiceStats stats = player->voiceStats();
+  if (stats.voiceCap == lastCap && stats.fastInterpolation == lastFast)
+  {
+    return;
+  }
+  Serial.printf("Governor: %s, cap %d voices (lowest %d), load %d%% (peak %d%%), %d voices shed\n",
+    stats.fastInterpolation ? "nearest frame" : "interpolating", stats.voiceCap, stats.lowestCap,
+    stats.load, stats.peakLoad, (int)stats.shed);
+  lastCap = stats.voiceCap;
+  lastFast = stats.fastInterpolation;
+}
+
+#ifdef EVENT_TRACE
+#define TRACE_LINE_LEN 64
+
+// a frozen trace goes out a few lines per pass, only as fast as the UART takes them,
+// host/trace turns the captured log into a Chrome trace
+static void dump_trace()
+{
+  char line[TRACE_LINE_LEN];
+  for (int i = 0; i < TRACE_DUMP_LINES && Serial.availableForWrite() >= TRACE_LINE_LEN; i++)
+  {
+    if (!tracer.nextLine(line, sizeof(line)))
+    {
+      return;
+    }
+    Serial.print(line);
+  }
+}
+
+// The DMA buffers are full once a write had to wait for room, a write that went straight
+// in only added its block to what was left. A write that starts after they ran dry
+// comes too late, the trace keeps what both cores did around it.
+static void trace_output(uint32_t writeStart, uint32_t writeEnd)
+{
+  static uint32_t drainsAt = 0; // estimated end of the queued output, 0 before the first write
+  const uint32_t blockUs = (uint32_t)((uint64_t)SAMPLE_BUFFER_SIZE * 1000000 / sampleRate);
+  // after a wait one DMA buffer has just come free and the other is still playing
+  const uint32_t fullUs = (uint32_t)((uint64_t)(I2S_DMA_FRAMES - I2S_DMA_BUF_LEN + SAMPLE_BUFFER_SIZE) * 1000000 / sampleRate);
+
+  TRACE_SPAN(TRACE_I2S_WAIT, 0, 0, writeStart);
+  const bool dry = (int32_t)(writeStart - drainsAt) > 0;
+  if (dry && drainsAt != 0)
+  {
+    tracer.record(TRACE_XRUN, 0, 0, drainsAt, writeStart - drainsAt);
+    tracer.trigger();
+  }
+  if (writeEnd - writeStart > blockUs / 4)
+  {
+    drainsAt = writeEnd + fullUs;
+  }
+  else
+  {
+    drainsAt = (dry ? writeStart : drainsAt) + blockUs;
+  }
+}
+#endif
 
 // other core stuff
 inline void Core0TaskLoop()
 {
-  // TODO: handle inputs etc
-  delay(1);
+  // TODO: handle other inputs etc
+  midi_handler->update();
+  banks->update();
+  sequencer->update();
+  console->update();
+  report_governor();
+#ifdef EVENT_TRACE
+  dump_trace();
+#endif
 }
 
 inline void Core0TaskSetup()
 {
-  // TODO: idk maybe this will be useful later
+  console->watchTask("CoreTask0", NULL);
+}
+
+// returns the voices in the block
+inline uint8_t render_block()
+{
+  Mix_Clear(fl_sample, SAMPLE_BUFFER_SIZE);
+  Mix_Clear(fr_sample, SAMPLE_BUFFER_SIZE);
+#ifdef SEND_EFFECTS
+  Mix_Clear(delay_send, SAMPLE_BUFFER_SIZE);
+  Mix_Clear(reverb_send, SAMPLE_BUFFER_SIZE);
+#endif
+
+  uint8_t activeVoices = player->beginBlock();
+
+#ifdef DUAL_CORE_RENDER
+  if (dualCoreRender && activeVoices > 1)
+  {
+    // fork: core 0 renders the odd half of the voices while we do the even half
+    xTaskNotifyGive(RenderTask0Hnd);
+    player->processPartition(0, RENDER_PARTITIONS, fl_sample, fr_sample, SAMPLE_BUFFER_SIZE, SEND_BUSES);
+
+    // join: wait for core 0 and sum its partial buses
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+    {
+      fl_sample[n] += fl_sample_core0[n];
+      fr_sample[n] += fr_sample_core0[n];
+#ifdef SEND_EFFECTS
+      delay_send[n] += delay_send_core0[n];
+      reverb_send[n] += reverb_send_core0[n];
+#endif
+    }
+    return activeVoices;
+  }
+#endif
+
+  player->processPartition(0, 1, fl_sample, fr_sample, SAMPLE_BUFFER_SIZE, SEND_BUSES);
+  return activeVoices;
+}
+
+#ifdef RENDER_BENCHMARK
+#define BENCHMARK_SAMPLE_LEN  16384
+#define BENCHMARK_BLOCKS      64
+
+// Finds how many voices fit in the block deadline at each output rate, single core vs both cores,
+// then with every voice through a resonant low pass to price the filter against plain voices.
+// A block costs the same at any rate, only the deadline moves with it.
+void render_benchmark()
+{
+  int16_t *noise = (int16_t*)ps_malloc(BENCHMARK_SAMPLE_LEN * sizeof(int16_t));
+  if (noise == NULL)
+  {
+    Serial.println("Could not allocate benchmark sample!");
+    return;
+  }
+  for (int i = 0; i < BENCHMARK_SAMPLE_LEN; i++)
+  {
+    noise[i] = (int16_t)(esp_random() & 0xFFFF);
+  }
+  player->loadBuffer(0, noise, BENCHMARK_SAMPLE_LEN, false);
+
+  static const uint32_t rates[] = SAMPLE_RATES;
+  const int numRates = sizeof(rates) / sizeof(rates[0]);
+  float deadline_us[numRates];
+  float longest_us = 0.0f;
+  for (int r = 0; r < numRates; r++)
+  {
+    deadline_us[r] = 1000000.0f * SAMPLE_BUFFER_SIZE / rates[r];
+    longest_us = deadline_us[r] > longest_us ? deadline_us[r] : longest_us;
+  }
+  Serial.printf("Benchmark: running at %d Hz, block deadline %0.1f us\n", (int)sampleRate, 1000000.0f * SAMPLE_BUFFER_SIZE / sampleRate);
+
+  // channel 2 plays filtered, swept to the middle so the filter has work to do
+  player->controlChange(2, MIDI_CC_FILTER, 1);
+  player->controlChange(2, MIDI_CC_CUTOFF, 72);
+  player->controlChange(2, MIDI_CC_RESONANCE, 100);
+
+  static const char *modeNames[] = {"single core", "dual core", "filtered"};
+  int plainVoices = 0;
+  for (int mode = 0; mode < 3; mode++)
+  {
+#ifdef DUAL_CORE_RENDER
+    dualCoreRender = (mode != 0);
+#else
+    if (mode == 1)
+    {
+      continue; // the filtered pass compares against the single core one
+    }
+#endif
+    int maxVoices[numRates] = {};
+    for (int numVoices = 1; numVoices <= NUM_VOICES; numVoices++)
+    {
+      player->allVoicesOff();
+      for (int v = 0; v < numVoices; v++)
+      {
+        player->voiceOn(0, 127, 0, mode == 2 ? 2 : 1);
+      }
+
+      uint32_t start = micros();
+      for (int b = 0; b < BENCHMARK_BLOCKS; b++)
+      {
+        render_block();
+      }
+      float block_us = (float)(micros() - start) / BENCHMARK_BLOCKS;
+
+      Serial.printf("  %s, %2d voices: %0.1f us/block (%0.0f%% at %d Hz)\n", modeNames[mode], numVoices, block_us,
+        100.0f * block_us * sampleRate / (1000000.0f * SAMPLE_BUFFER_SIZE), (int)sampleRate);
+      for (int r = 0; r < numRates; r++)
+      {
+        if (block_us <= deadline_us[r] && maxVoices[r] == numVoices - 1)
+        {
+          maxVoices[r] = numVoices;
+        }
+      }
+      // past the slowest rate's deadline nothing else fits either
+      if (block_us > longest_us)
+      {
+        break;
+      }
+    }
+    for (int r = 0; r < numRates; r++)
+    {
+      Serial.printf("Benchmark: %s at %5d Hz (%0.1f us) max voices: %d%s\n", modeNames[mode], (int)rates[r], deadline_us[r],
+        maxVoices[r], maxVoices[r] == NUM_VOICES ? " (NUM_VOICES limit)" : "");
+      if (rates[r] == sampleRate && mode < 2)
+      {
+        plainVoices = maxVoices[r];
+      }
+      if (rates[r] == sampleRate && mode == 2 && maxVoices[r] > 0)
+      {
+        Serial.printf("Benchmark: at %d Hz a filtered voice costs %0.2f plain ones\n", (int)sampleRate, (float)plainVoices / maxVoices[r]);
+      }
+    }
+  }
+
+  player->controlChange(2, MIDI_CC_FILTER, 0);
+  player->allVoicesOff();
+#ifdef DUAL_CORE_RENDER
+  dualCoreRender = true;
+#endif
+}
+
+#define KERNEL_BENCHMARK_RUNS 1024
+
+// Times the mix kernels on one block, scalar against ESP-DSP
+void kernel_benchmark()
+{
+  static float src[SAMPLE_BUFFER_SIZE];
+  static float dst[SAMPLE_BUFFER_SIZE];
+  static int16_t pcm[2 * SAMPLE_BUFFER_SIZE];
+  for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+  {
+    src[n] = (float)(int16_t)(esp_random() & 0xFFFF) / 0x8000;
+  }
+
+  uint32_t start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    MixScalar_MacGain(dst, src, 0.5f, 0.0f, SAMPLE_BUFFER_SIZE);
+  }
+  float macScalar = (float)(micros() - start) / KERNEL_BENCHMARK_RUNS;
+  start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    MixDsp_MacGain(dst, src, 0.5f, 0.0f, SAMPLE_BUFFER_SIZE);
+  }
+  float macDsp = (float)(micros() - start) / KERNEL_BENCHMARK_RUNS;
+  start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    MixScalar_MacGain(dst, src, 0.5f, 1e-6f, SAMPLE_BUFFER_SIZE);
+  }
+  float macRamp = (float)(micros() - start) / KERNEL_BENCHMARK_RUNS;
+
+  start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    MixScalar_InterleaveSat16(pcm, src, dst, OUTPUT_SCALE_16, SAMPLE_BUFFER_SIZE);
+  }
+  float interleaveScalar = (float)(micros() - start) / KERNEL_BENCHMARK_RUNS;
+  start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    MixDsp_InterleaveSat16(pcm, src, dst, OUTPUT_SCALE_16, SAMPLE_BUFFER_SIZE);
+  }
+  float interleaveDsp = (float)(micros() - start) / KERNEL_BENCHMARK_RUNS;
+
+  start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    MixScalar_Int16ToFloat(dst, pcm, 2, 1.0f / 0x8000, SAMPLE_BUFFER_SIZE);
+  }
+  float convert = (float)(micros() - start) / KERNEL_BENCHMARK_RUNS;
+  start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    MixScalar_Clear(dst, SAMPLE_BUFFER_SIZE);
+  }
+  float clear = (float)(micros() - start) / KERNEL_BENCHMARK_RUNS;
+
+  Serial.printf("Kernels, us per %d frame block (scalar / esp-dsp):\n", SAMPLE_BUFFER_SIZE);
+  Serial.printf("  mac gain   %0.2f / %0.2f, ramped %0.2f\n", macScalar, macDsp, macRamp);
+  Serial.printf("  interleave %0.2f / %0.2f\n", interleaveScalar, interleaveDsp);
+  Serial.printf("  int16 in   %0.2f, clear %0.2f\n", convert, clear);
+
+#ifdef SEND_EFFECTS
+  // the send effects cost the same whatever plays, a scratch instance keeps the noise out of the real lines
+  SendEffects bench;
+  bench.begin(sampleRate);
+  start = micros();
+  for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++)
+  {
+    bench.process(src, src, dst, dst, SAMPLE_BUFFER_SIZE);
+  }
+  Serial.printf("  send effects %0.2f\n", (float)(micros() - start) / KERNEL_BENCHMARK_RUNS);
+#endif
+}
+#endif
+
+// RATE_FILE holds the output rate in Hz, anything missing or unsupported keeps SAMPLE_RATE
+static bool rateJob(fs::FS &fs, StorageRequest &request)
+{
+  File f = fs.open(request.path, FILE_READ);
+  if (!f)
+  {
+    return false;
+  }
+  char line[16];
+  int len = 0;
+  while (f.available() && len < (int)sizeof(line) - 1)
+  {
+    char c = f.read();
+    if (c == '\n' || c == '\r')
+    {
+      break;
+    }
+    line[len++] = c;
+  }
+  line[len] = '\0';
+  f.close();
+
+  uint32_t rate = strtoul(line, NULL, 10);
+  if (!i2s_rate_supported(rate))
+  {
+    Serial.printf("%s: unsupported rate %s, keeping %d Hz\n", request.path, line, SAMPLE_RATE);
+    return false;
+  }
+  *(uint32_t*)request.context = rate;
+  return true;
 }
 
 inline void audio_task()
 {
-  memset(fl_sample, 0, sizeof(fl_sample));
-  memset(fr_sample, 0, sizeof(fr_sample));
+  // load latest buffer from mixer, the governor sheds load when rendering runs close to the deadline
+  uint32_t start = micros();
+  uint8_t voices = render_block();
+#ifdef SEND_EFFECTS
+  // once on the summed sends, a flat cost the governor sees as part of the block
+  effects->process(delay_send, reverb_send, fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
+#endif
+  player->endBlock(micros() - start);
+  TRACE_SPAN(TRACE_RENDER, voices, 0, start);
+
+#ifdef MASTER_LIMITER
+  // hold the sum under full scale, the recorder gets what the DAC gets
+  limiter->process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
+#endif
 
-  // load latest buffer from mixer
-  player->process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
+  // copy for the recorder, the SD writes happen on core 0
+  recorder->capture(fl_sample, fr_sample);
 
   // Send to DAC
   // function blocks and returns when sample is put into buffer
+#ifdef EVENT_TRACE
+  uint32_t writeStart = micros();
+#endif
   if (i2s_write_stereo_samples_buff(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE))
   {
     ;
   }
+#ifdef EVENT_TRACE
+  trace_output(writeStart, micros());
+#endif
 }
 
 void CoreTask0(void *parameter)
@@ -53,9 +449,8 @@ void CoreTask0(void *parameter)
   while (true)
   {
     Core0TaskLoop();
-    /* this seems necessary to trigger the watchdog */
-    delay(1);
-    yield();
+    /* blocks like delay(1) so the idle task feeds the watchdog, but midiIn wakes us up early */
+    ulTaskNotifyTake(pdTRUE, 1);
   }
 }
 
@@ -70,20 +465,60 @@ void setup() {
   // sdcard
   pinMode(SD_CS, OUTPUT);
    digitalWrite(SD_CS, HIGH);
+  storage.begin(); // mounts the card once, all file access goes through its I/O task from here on
+
+  // output rate, everything below is clocked from it
+  storage.run(rateJob, NULL, &sampleRate, RATE_FILE);
+  storage.wait();
 
   // I2S
-  setup_i2s();
+  setup_i2s(sampleRate);
+
+  // the effect lines come first, the player budgets with whatever PSRAM is left (the recording ring included)
+  recorder = new Recorder();
+  recorder->begin(sampleRate);
+  effects = new SendEffects();
+#ifdef SEND_EFFECTS
+  effects->begin(sampleRate);
+#endif
 
   // Initialize player
-  player = new SamplePlayer();
+  player = new SamplePlayer(sampleRate);
+  limiter = new Limiter(sampleRate);
 
    // MIDI
   midi_handler = new MidiNoteHandler(player);
   midi_handler->begin(MIDI_CHANNEL_OMNI);
+  midi_handler->setRecorder(recorder);
+  midi_handler->setEffects(effects);
 
-  // Programmatically load NUM_PLAYERS samples
+#ifdef DUAL_CORE_RENDER
+  AudioTaskHnd = xTaskGetCurrentTaskHandle();
+  xTaskCreatePinnedToCore(RenderTask0, "RenderTask0", 4096, NULL, configMAX_PRIORITIES - 1, &RenderTask0Hnd, 0);
+#endif
+
+#ifdef RENDER_BENCHMARK
+  kernel_benchmark();
+  render_benchmark();
+#endif
+
+  // Banks: program change picks BANK_FOLDER/<n>.txt, without a bank 0 the single kit below loads
+  banks = new BankManager(player, midi_handler);
+  const bool banked = banks->begin();
+  if (banked) {
+    midi_handler->setBanks(banks);
+  }
+
+  // Load the kit: every sample it references goes into PSRAM in one pass
+  static KitEntry kit[MAX_KIT_ENTRIES];
+  uint16_t kitEntries = banked ? 0 : player->loadKit(KIT_FILE, kit, sizeof(kit) / sizeof(kit[0]));
+  for (int i = 0; i < kitEntries; i++) {
+    midi_handler->addZone(kit[i].midiChannel, kit[i].sampleNum, kit[i].loKey, kit[i].hiKey, kit[i].rootKey, kit[i].loVel, kit[i].hiVel);
+  }
+
+  // No kit file, programmatically load DEFAULT_KIT_SIZE samples
   char samplePath[120];
-  for (int i = 0; i < NUM_PLAYERS; i++) {
+  for (int i = 0; !banked && kitEntries == 0 && i < DEFAULT_KIT_SIZE; i++) {
     snprintf(samplePath, sizeof(samplePath), "/samples/%d.wav", i); // We're gonna want to be able to list and select files but lets just load 1-8 for now
     player->loadWav(i, samplePath);
 
@@ -91,7 +526,33 @@ void setup() {
     midi_handler->setNoteToListen(NOTE_BEGIN + i, i);
   }
 
-  xTaskCreatePinnedToCore(CoreTask0, "CoreTask0", 8192, NULL, 999, &Core0TaskHnd, 0);
+  sequencer = new Sequencer(player, midi_handler);
+  midi_handler->setSequencer(sequencer);
+
+  // what the serial console reports, setup runs on the audio task
+  console = new Console(player);
+  console->watchTask("audio", NULL);
+#ifdef DUAL_CORE_RENDER
+  console->watchTask("RenderTask0", RenderTask0Hnd);
+#endif
+  console->watchTask("Storage", storage.taskHandle());
+  console->addRegion(effects->internalRam() ? "effects (internal)" : "effects (psram)", effects->memoryBytes());
+  console->addRegion("recorder", recorder->memoryBytes());
+#ifdef EVENT_TRACE
+  console->addRegion("trace", sizeof(tracer));
+#endif
+#ifdef SEQ_DEMO_PATTERN
+  for (int s = 0; s < 16; s++) {
+    sequencer->setStep(0, s, (s % 4 == 0) ? 127 : 0);  // kick on the beat
+    sequencer->setStep(1, s, (s % 8 == 4) ? 110 : 0);  // snare on 2 and 4
+    sequencer->setStep(2, s, (s % 2 == 0) ? 80 : 0);   // eighth hats
+  }
+  sequencer->start();
+#endif
+
+  // stays below RenderTask0 so housekeeping never delays the core 0 render partition
+  xTaskCreatePinnedToCore(CoreTask0, "CoreTask0", 8192, NULL, configMAX_PRIORITIES - 2, &Core0TaskHnd, 0);
+  midiIn.setConsumer(Core0TaskHnd);
 }
 
 void loop()
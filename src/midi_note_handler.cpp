@@ -1,38 +1,213 @@
 #include <Arduino.h>
 
 #include "midi_note_handler.hpp"
+#include "sequencer.hpp"
+#include "recorder.hpp"
+#include "bank_manager.hpp"
+#include "send_effects.hpp"
+#include "trace.hpp"
 #include "config.hpp"
 
-MIDI_CREATE_INSTANCE(HardwareSerial, Serial1, serialMidi);
-MidiNoteHandler* MidiNoteHandler::instance = nullptr;
+MidiNoteHandler::MidiNoteHandler(SamplePlayer* player) : player(player), sequencer(nullptr), recorder(nullptr), banks(nullptr), effects(nullptr), announce(true), listenChannel(MIDI_CHANNEL_OMNI) {
+    for (int i = 0; i < NUM_ZONES; ++i) {
+        zones[i].used = false;
+    }
+    memset(keyTable, ZONE_NONE, sizeof(keyTable));
+}
+
+void MidiNoteHandler::begin(int midiChannel) {
+    listenChannel = midiChannel;
+    midiIn.begin(MIDI_UART_NUM, MIDI_RX_PIN);
+}
+
+void MidiNoteHandler::setSequencer(Sequencer* seq) {
+    sequencer = seq;
+}
 
-MidiNoteHandler::MidiNoteHandler(SamplePlayer* player) : player(player) {
-    instance = this;
-    for (int i = 0; i < NUM_PLAYERS; ++i) {
-        noteCallbacks[i].note = 0;
-        noteCallbacks[i].listen = false;
+void MidiNoteHandler::setRecorder(Recorder* rec) {
+    recorder = rec;
+}
+
+void MidiNoteHandler::setEffects(SendEffects* fx) {
+    effects = fx;
+    // where the effects start out, so moving one controller leaves its partner alone
+    effectValues[0] = (uint8_t)(DELAY_TIME_MS * 127 / DELAY_MAX_MS);
+    effectValues[1] = (uint8_t)(DELAY_FEEDBACK / 0.95f * 127.0f + 0.5f);
+    effectValues[2] = (uint8_t)(REVERB_SIZE * 127.0f + 0.5f);
+    effectValues[3] = (uint8_t)(REVERB_DAMPING * 127.0f + 0.5f);
+}
+
+// false for controllers that aren't the effects', they go on to the player
+bool MidiNoteHandler::effectControl(uint8_t controller, uint8_t value) {
+    if (effects == nullptr || controller < MIDI_CC_DELAY_TIME || controller > MIDI_CC_REVERB_DAMPING) {
+        return false;
+    }
+    effectValues[controller - MIDI_CC_DELAY_TIME] = value;
+    if (controller <= MIDI_CC_DELAY_FEEDBACK) {
+        effects->setDelay((uint16_t)(effectValues[0] * DELAY_MAX_MS / 127), effectValues[1] * 0.95f / 127.0f);
+    } else {
+        effects->setReverb(effectValues[2] / 127.0f, effectValues[3] / 127.0f);
     }
+    return true;
+}
 
-    serialMidi.setHandleNoteOn(MidiNoteHandler::handleNoteOnStatic);
-    serialMidi.setHandleNoteOff(MidiNoteHandler::handleNoteOffStatic);
+void MidiNoteHandler::setBanks(BankManager* bankManager) {
+    banks = bankManager;
 }
 
-void MidiNoteHandler::begin(int midiChannel) {
-    // Midi stuff
-    Serial1.begin(31250, SERIAL_8N1, MIDI_RX_PIN);
-    serialMidi.begin(midiChannel);
+void MidiNoteHandler::update() {
+    MidiEvent event;
+    while (midiIn.read(event)) {
+        handleEvent(event);
+    }
 }
 
-void MidiNoteHandler::setNoteToListen(uint8_t note, uint8_t channel) {
-    // Ensure the channel is within the valid range
-    if (channel >= NUM_PLAYERS) {
-        Serial.print("Warning: Channel ");
-        Serial.print(channel);
-        Serial.print(" is invalid. Select a channel between 0 and ");
+uint8_t MidiNoteHandler::addZone(uint8_t midiChannel, uint8_t sampleNum, uint8_t loKey, uint8_t hiKey, uint8_t rootKey, uint8_t loVel, uint8_t hiVel) {
+    if (midiChannel > MIDI_CHANNELS) {
+        Serial.print("Warning: Midi channel ");
+        Serial.print(midiChannel);
+        Serial.println(" is invalid. Select a channel between 1-16 or 0 for omni.");
+        return ZONE_NONE;
+    }
+
+    if (sampleNum >= NUM_PLAYERS) {
+        Serial.print("Warning: Sample ");
+        Serial.print(sampleNum);
+        Serial.print(" is invalid. Select a sample between 0 and ");
         Serial.println(NUM_PLAYERS - 1);
+        return ZONE_NONE;
+    }
+
+    if (loKey > hiKey || hiKey > 127 || rootKey > 127 || loVel > hiVel || hiVel > 127) {
+        Serial.println("Warning: Zone key or velocity range is invalid.");
+        return ZONE_NONE;
+    }
+
+    for (int i = 0; i < NUM_ZONES; ++i) {
+        if (zones[i].used && zones[i].midiChannel == midiChannel && zones[i].loKey == loKey && zones[i].hiKey == hiKey) {
+            if (addLayer(i, sampleNum, rootKey, loVel, hiVel) == LAYER_NONE) {
+                return ZONE_NONE;
+            }
+            return i;
+        }
+    }
+
+    for (int i = 0; i < NUM_ZONES; ++i) {
+        if (!zones[i].used) {
+            zones[i].midiChannel = midiChannel;
+            zones[i].loKey = loKey;
+            zones[i].hiKey = hiKey;
+            zones[i].numLayers = 0;
+            addLayer(i, sampleNum, rootKey, loVel, hiVel);
+            zones[i].used = true;
+            mapZone(i);
+
+            if (announce) {
+                Serial.printf("Zone %d: sample %d on keys %d-%d (root %d), channel %d\n", i, sampleNum, loKey, hiKey, rootKey, midiChannel);
+            }
+            return i;
+        }
+    }
+
+    Serial.println("Warning: No free zones left.");
+    return ZONE_NONE;
+}
+
+uint8_t MidiNoteHandler::addLayer(uint8_t zone, uint8_t sampleNum, uint8_t rootKey, uint8_t loVel, uint8_t hiVel) {
+    Zone &z = zones[zone];
+
+    for (int l = 0; l < z.numLayers; ++l) {
+        Layer &layer = z.layers[l];
+        if (layer.loVel == loVel && layer.hiVel == hiVel) {
+            if (layer.numRobins >= MAX_ROUND_ROBIN) {
+                Serial.printf("Warning: Zone %d layer %d has no room for another round-robin sample.\n", zone, l);
+                return LAYER_NONE;
+            }
+            layer.samples[layer.numRobins] = sampleNum;
+            layer.rootKeys[layer.numRobins++] = rootKey;
+            if (announce) {
+                Serial.printf("Zone %d layer %d: sample %d (root %d) added as round-robin %d\n", zone, l, sampleNum, rootKey, layer.numRobins);
+            }
+            return l;
+        }
+    }
+
+    if (z.numLayers >= MAX_LAYERS) {
+        Serial.printf("Warning: Zone %d has no room for another velocity layer.\n", zone);
+        return LAYER_NONE;
+    }
+
+    uint8_t l = z.numLayers++;
+    z.layers[l].loVel = loVel;
+    z.layers[l].hiVel = hiVel;
+    z.layers[l].numRobins = 1;
+    z.layers[l].nextRobin = 0;
+    z.layers[l].samples[0] = sampleNum;
+    z.layers[l].rootKeys[0] = rootKey;
+    buildVelocityTable(zone);
+    if (l > 0 && announce) {
+        Serial.printf("Zone %d layer %d: sample %d (root %d) on velocity %d-%d\n", zone, l, sampleNum, rootKey, loVel, hiVel);
+    }
+    return l;
+}
+
+void MidiNoteHandler::buildVelocityTable(uint8_t zone) {
+    Zone &z = zones[zone];
+
+    // later layers win where velocity ranges overlap
+    memset(z.velocityTable, LAYER_NONE, sizeof(z.velocityTable));
+    for (int l = 0; l < z.numLayers; ++l) {
+        for (int vel = z.layers[l].loVel; vel <= z.layers[l].hiVel; ++vel) {
+            z.velocityTable[vel] = l;
+        }
+    }
+}
+
+void MidiNoteHandler::removeZone(uint8_t zone) {
+    if (zone >= NUM_ZONES || !zones[zone].used) {
         return;
     }
+    zones[zone].used = false;
+    rebuildKeyTable();
+}
+
+void MidiNoteHandler::setZones(const KitEntry *entries, uint16_t numEntries) {
+    for (int i = 0; i < NUM_ZONES; ++i) {
+        zones[i].used = false;
+    }
+    memset(keyTable, ZONE_NONE, sizeof(keyTable));
 
+    announce = false;
+    for (int i = 0; i < numEntries; ++i) {
+        const KitEntry &e = entries[i];
+        addZone(e.midiChannel, e.sampleNum, e.loKey, e.hiKey, e.rootKey, e.loVel, e.hiVel);
+    }
+    announce = true;
+}
+
+void MidiNoteHandler::mapZone(uint8_t zone) {
+    const Zone &z = zones[zone];
+    uint8_t firstChannel = (z.midiChannel == ZONE_OMNI) ? 0 : z.midiChannel - 1;
+    uint8_t lastChannel = (z.midiChannel == ZONE_OMNI) ? MIDI_CHANNELS - 1 : z.midiChannel - 1;
+
+    // later zones win where key ranges overlap
+    for (int ch = firstChannel; ch <= lastChannel; ++ch) {
+        for (int note = z.loKey; note <= z.hiKey; ++note) {
+            keyTable[ch][note] = zone;
+        }
+    }
+}
+
+void MidiNoteHandler::rebuildKeyTable() {
+    memset(keyTable, ZONE_NONE, sizeof(keyTable));
+    for (int i = 0; i < NUM_ZONES; ++i) {
+        if (zones[i].used) {
+            mapZone(i);
+        }
+    }
+}
+
+void MidiNoteHandler::setNoteToListen(uint8_t note, uint8_t sampleNum) {
     // Ensure the note is within the valid MIDI range
     if (note > 127) {
         Serial.print("Warning: Note ");
@@ -41,59 +216,128 @@ void MidiNoteHandler::setNoteToListen(uint8_t note, uint8_t channel) {
         return;
     }
 
-    if (noteCallbacks[channel].listen && noteCallbacks[channel].note != note) {
-        Serial.print("Warning: Attempting to overwrite an existing listening note on channel ");
-        Serial.print(channel);
-        Serial.println(". Operation aborted.");
-        return; // Exit to avoid unintentional overwrites
-    }
-
-    // Set the note and mark it for listening
-    noteCallbacks[channel].note = note;
-    noteCallbacks[channel].listen = true;
-    Serial.print("Listening set for note ");
-    Serial.print(note);
-    Serial.print(" on channel ");
-    Serial.println(channel); // Confirm operation success
+    addZone(ZONE_OMNI, sampleNum, note, note, note);
 }
 
 void MidiNoteHandler::removeNoteToListen(uint8_t note) {
-    for (int i = 0; i < NUM_PLAYERS; ++i) {
-        if (noteCallbacks[i].note == note) {
-            noteCallbacks[i].listen = false;
-            break;
+    // drops every single-key zone on this note, key ranges are left alone
+    bool changed = false;
+    for (int i = 0; i < NUM_ZONES; ++i) {
+        if (zones[i].used && zones[i].loKey == note && zones[i].hiKey == note) {
+            zones[i].used = false;
+            changed = true;
         }
     }
-}
-
-void MidiNoteHandler::handleNoteOnStatic(byte channel, byte note, byte velocity) {
-    if (instance) {
-        instance->handleNoteOn(channel, note, velocity);
+    if (changed) {
+        rebuildKeyTable();
     }
 }
 
-void MidiNoteHandler::handleNoteOffStatic(byte channel, byte note, byte velocity) {
-    if (instance) {
-        instance->handleNoteOff(channel, note, velocity);
+void MidiNoteHandler::handleEvent(const MidiEvent &event) {
+    if (event.status >= 0xF8) {
+        if (sequencer == nullptr) {
+            return;
+        }
+        switch (event.status) {
+        case 0xF8:
+            // arrival time, the sequencer dejitters against the render frame clock
+            sequencer->clockTick(player->frameAt(event.micros));
+            break;
+        case 0xFA:
+            sequencer->start();
+            break;
+        case 0xFB:
+            sequencer->resume();
+            break;
+        case 0xFC:
+            sequencer->stop();
+            break;
+        }
+        return;
     }
-}
 
-void MidiNoteHandler::handleNoteOff(byte channel, byte note, byte velocity) {
-    // TODO
-}
+    uint8_t channel = (event.status & 0x0F) + 1;
+    if (listenChannel != MIDI_CHANNEL_OMNI && listenChannel != channel) {
+        return;
+    }
 
-void MidiNoteHandler::handleNoteOn(byte channel, byte note, byte velocity) {
-    char buffer[150];
-    for (int i = 0; i < NUM_PLAYERS; ++i) {
-        if (noteCallbacks[i].note == note && noteCallbacks[i].listen) {
-            // Attempt to play the sample, check if it fails
-            if (!player->sampleOn(i)) {
-                // If sampleOn returns false, print a message to the console
-                Serial.print("Note ");
-                Serial.print(note);
-                Serial.println("couldn't be played.");
+    switch (event.status & 0xF0) {
+    case 0x90:
+        handleNoteOn(event);
+        break;
+    case 0x80:
+        handleNoteOff(event);
+        break;
+    case 0xB0:
+        if (event.data1 == MIDI_CC_RECORD && recorder != nullptr) {
+            if (event.data2 >= 64) {
+                recorder->start();
+            } else {
+                recorder->stop();
             }
             break;
         }
+        if (effectControl(event.data1, event.data2)) {
+            break;
+        }
+        // goes straight to the player's control mailbox, nothing here touches the render loop
+        player->controlChange(channel, event.data1, event.data2);
+        break;
+    case 0xC0:
+        if (banks != nullptr) {
+            banks->select(event.data1);
+        }
+        break;
+    case 0xE0:
+        player->pitchBend(channel, (int16_t)(((event.data2 << 7) | event.data1) - 8192));
+        break;
+    }
+}
+
+// Playback is one-shot: a note runs through its attack and decay (MIDI_CC_ATTACK,
+// MIDI_CC_DECAY) to the end of the sample whatever the key does, the way a drum
+// machine treats its pads. The envelope has no release stage for a note-off to start.
+void MidiNoteHandler::handleNoteOff(const MidiEvent &event) {
+    (void)event;
+}
+
+bool MidiNoteHandler::selectSample(uint8_t channel, uint8_t note, uint8_t velocity, uint8_t &sampleNum, int8_t &transpose) {
+    if (channel < 1 || channel > MIDI_CHANNELS || note >= MIDI_NOTES) {
+        return false;
+    }
+
+    uint8_t zoneIdx = keyTable[channel - 1][note];
+    if (zoneIdx == ZONE_NONE) {
+        return false;
+    }
+
+    Zone &zone = zones[zoneIdx];
+    uint8_t layerIdx = zone.velocityTable[velocity & 0x7F];
+    if (layerIdx == LAYER_NONE) {
+        return false;
+    }
+
+    Layer &layer = zone.layers[layerIdx];
+    sampleNum = layer.samples[layer.nextRobin];
+    transpose = (int8_t)(note - layer.rootKeys[layer.nextRobin]);
+    if (++layer.nextRobin >= layer.numRobins) {
+        layer.nextRobin = 0;
+    }
+    return true;
+}
+
+bool MidiNoteHandler::playNote(uint8_t channel, uint8_t note, uint8_t velocity, uint32_t frame) {
+    uint8_t sampleNum;
+    int8_t transpose;
+    if (!selectSample(channel, note, velocity, sampleNum, transpose)) {
+        return false;
     }
+    return player->sampleOnAt(frame, sampleNum, velocity, transpose, channel);
+}
+
+void MidiNoteHandler::handleNoteOn(const MidiEvent &event) {
+    TRACE_INSTANT_AT(TRACE_NOTE, event.data1, event.data2, event.micros);
+    // a fixed delay after arrival keeps the spacing the notes were played with
+    uint32_t frame = player->frameAt(event.micros) + MIDI_LATENCY_FRAMES;
+    playNote((event.status & 0x0F) + 1, event.data1, event.data2, frame);
 }
@@ -1,31 +1,89 @@
 #ifndef MidiNoteHandler_hpp
 #define MidiNoteHandler_hpp
 
-#include <MIDI.h>
 #include "player.hpp"
+#include "midi_receiver.hpp"
+
+#define ZONE_NONE 0xFF
+#define ZONE_OMNI 0 // zone answers on every midi channel
+#define LAYER_NONE 0xFF
+
+#define MIDI_CC_RECORD 119 // undefined controller, >= 64 starts recording the master bus, < 64 stops
+// undefined controllers for the shared send effects, full range each
+#define MIDI_CC_DELAY_TIME      102 // 0 -> DELAY_MAX_MS
+#define MIDI_CC_DELAY_FEEDBACK  103 // 0.0 -> 0.95
+#define MIDI_CC_REVERB_SIZE     104
+#define MIDI_CC_REVERB_DAMPING  105
+
+class Sequencer;
+class Recorder;
+class BankManager;
+class SendEffects;
 
 class MidiNoteHandler {
 public:
     MidiNoteHandler(SamplePlayer* player);
-    void begin(int midiChannel = 1);
-    void update();
-    void setNoteToListen(uint8_t note, uint8_t channel);
+    void begin(int midiChannel = 1); // 1-16 or MIDI_CHANNEL_OMNI
+    void update(); // handles everything midiIn received since the last call
+    // midiChannel 1-16 or ZONE_OMNI, returns the zone index or ZONE_NONE.
+    // Adding to an existing channel/key range adds a velocity layer, adding to an
+    // existing velocity range too adds a round-robin alternate to that layer. Each keeps its own rootKey.
+    uint8_t addZone(uint8_t midiChannel, uint8_t sampleNum, uint8_t loKey, uint8_t hiKey, uint8_t rootKey, uint8_t loVel = 1, uint8_t hiVel = 127);
+    void removeZone(uint8_t zone);
+    // Replaces every zone with a kit's, without the per-zone log lines, for bank switches on core 0
+    void setZones(const KitEntry *entries, uint16_t numEntries);
+    void setNoteToListen(uint8_t note, uint8_t sampleNum);
     void removeNoteToListen(uint8_t note);
+    // Zone lookup plus a scheduled sampleOnAt(), for sources that know their timing ahead
+    bool playNote(uint8_t channel, uint8_t note, uint8_t velocity, uint32_t frame);
+    void setSequencer(Sequencer* seq); // receives midi clock, start, stop and continue
+    void setRecorder(Recorder* rec); // MIDI_CC_RECORD on any listened channel
+    void setEffects(SendEffects* fx); // MIDI_CC_DELAY_TIME to MIDI_CC_REVERB_DAMPING on any listened channel
+    void setBanks(BankManager* bankManager); // program change on any listened channel selects a bank
 
 private:
-    struct NoteCallback {
-        uint8_t note;
-        bool listen;
-    } noteCallbacks[NUM_PLAYERS];
+    struct Layer {
+        uint8_t loVel;
+        uint8_t hiVel;
+        uint8_t numRobins;
+        uint8_t nextRobin;
+        uint8_t samples[MAX_ROUND_ROBIN];
+        uint8_t rootKeys[MAX_ROUND_ROBIN]; // each alternate keeps the root its kit line gave it
+    };
+
+    struct Zone {
+        bool used;
+        uint8_t midiChannel;
+        uint8_t loKey;
+        uint8_t hiKey;
+        uint8_t numLayers;
+        Layer layers[MAX_LAYERS];
+        uint8_t velocityTable[128]; // velocity -> layer index, rebuilt when layers change
+    } zones[NUM_ZONES];
+
+    // channel/note -> zone index, rebuilt whenever a zone changes so note-on is a single lookup
+    uint8_t keyTable[MIDI_CHANNELS][MIDI_NOTES];
 
     SamplePlayer* player; // Pointer to a SamplePlayer instance
+    Sequencer* sequencer;
+    Recorder* recorder;
+    BankManager* banks;
+    SendEffects* effects;
+    uint8_t effectValues[4]; // last CC value of each effect controller, the setters take them in pairs
+    bool announce; // log zones and layers as they are added
+
+    uint8_t addLayer(uint8_t zone, uint8_t sampleNum, uint8_t rootKey, uint8_t loVel, uint8_t hiVel);
+    void buildVelocityTable(uint8_t zone);
+    void mapZone(uint8_t zone);
+    void rebuildKeyTable();
+    bool effectControl(uint8_t controller, uint8_t value);
+    bool selectSample(uint8_t channel, uint8_t note, uint8_t velocity, uint8_t &sampleNum, int8_t &transpose);
 
-    static void handleNoteOnStatic(byte channel, byte note, byte velocity);
-    static void handleNoteOffStatic(byte channel, byte note, byte velocity);
+    int listenChannel;
 
-    void handleNoteOn(byte channel, byte note, byte velocity);
-    void handleNoteOff(byte channel, byte note, byte velocity);
-    static MidiNoteHandler* instance;
+    void handleEvent(const MidiEvent &event);
+    void handleNoteOn(const MidiEvent &event);
+    void handleNoteOff(const MidiEvent &event); // ignored, samples play one-shot
 };
 
-#endif /* MidiNoteHandler_hpp */
\ No newline at end of file
+#endif /* MidiNoteHandler_hpp */
@@ -0,0 +1,176 @@
+#include "midi_receiver.hpp"
+
+#define MIDI_UART_BUFFER 256 // driver side buffer, has to be larger than the 128 byte hardware FIFO
+#define MIDI_UART_EVENTS 16
+
+MidiReceiver midiIn;
+
+MidiReceiver::MidiReceiver() : ringHead(0), ringTail(0), overrunCount(0), consumer(NULL),
+    runningStatus(0), dataCount(0) {
+}
+
+bool MidiReceiver::begin(uint8_t uartNum, int8_t rxPin) {
+#ifndef HOST_BUILD
+    port = (uart_port_t)uartNum;
+
+    uart_config_t config = {};
+    config.baud_rate = 31250;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_APB;
+
+    if (uart_driver_install(port, MIDI_UART_BUFFER, 0, MIDI_UART_EVENTS, &uartQueue, 0) != ESP_OK ||
+        uart_param_config(port, &config) != ESP_OK ||
+        uart_set_pin(port, UART_PIN_NO_CHANGE, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) {
+        Serial.println("Could not set up the MIDI UART!");
+        return false;
+    }
+    // an interrupt per byte instead of waiting for 120 bytes or an idle line,
+    // so every byte is timestamped when it arrives
+    uart_set_rx_full_threshold(port, 1);
+    uart_set_rx_timeout(port, 1);
+
+    // core 1 above the audio loop: it preempts rendering for a few microseconds per byte
+    // instead of waiting behind the render partition on core 0
+    xTaskCreatePinnedToCore(uartTask, "MidiUart", 2048, this, configMAX_PRIORITIES - 1, NULL, 1);
+#else
+    (void)uartNum;
+    (void)rxPin;
+#endif
+    return true;
+}
+
+void MidiReceiver::setConsumer(TaskHandle_t task) {
+    consumer = task;
+}
+
+#ifndef HOST_BUILD
+void MidiReceiver::uartTask(void *parameter) {
+    MidiReceiver *receiver = (MidiReceiver*)parameter;
+    uart_event_t event;
+    uint8_t buffer[64];
+
+    while (true) {
+        if (xQueueReceive(receiver->uartQueue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        uint32_t now = micros();
+
+        switch (event.type) {
+        case UART_DATA: {
+            size_t remaining = event.size;
+            while (remaining > 0) {
+                int len = uart_read_bytes(receiver->port, buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer), 0);
+                if (len <= 0) {
+                    break;
+                }
+                remaining -= len;
+                // the last byte of the event arrived just now, the ones before it a byte time apart
+                receiver->receive(buffer, len, now - remaining * MIDI_BYTE_MICROS);
+            }
+            break;
+        }
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL: {
+            // the flush throws away what is still buffered, the bytes the FIFO itself
+            // dropped can't be counted, so an overflow adds at least one
+            size_t buffered = 0;
+            uart_get_buffered_data_len(receiver->port, &buffered);
+            receiver->overrunCount.fetch_add(buffered > 0 ? buffered : 1, std::memory_order_relaxed);
+            uart_flush_input(receiver->port);
+            xQueueReset(receiver->uartQueue);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+#endif
+
+void MidiReceiver::receive(const uint8_t *data, size_t len, uint32_t lastByteMicros) {
+    uint16_t head = ringHead.load(std::memory_order_relaxed);
+    const uint16_t tail = ringTail.load(std::memory_order_acquire);
+
+    for (size_t i = 0; i < len; i++) {
+        uint16_t next = (head + 1) & (MIDI_RX_RING_SIZE - 1);
+        if (next == tail) {
+            overrunCount.fetch_add(len - i, std::memory_order_relaxed);
+            break;
+        }
+        ringBytes[head] = data[i];
+        ringTimes[head] = lastByteMicros - (uint32_t)(len - 1 - i) * MIDI_BYTE_MICROS;
+        head = next;
+    }
+    ringHead.store(head, std::memory_order_release);
+
+    if (consumer != NULL) {
+        xTaskNotifyGive(consumer);
+    }
+}
+
+uint8_t MidiReceiver::dataLength(uint8_t status) {
+    switch (status & 0xF0) {
+    case 0xC0:
+    case 0xD0:
+        return 1;
+    case 0xF0:
+        // song position takes two, MTC quarter frame and song select one, the rest none
+        return (status == 0xF2) ? 2 : (status == 0xF1 || status == 0xF3) ? 1 : 0;
+    default:
+        return 2;
+    }
+}
+
+bool MidiReceiver::read(MidiEvent &event) {
+    uint16_t tail = ringTail.load(std::memory_order_relaxed);
+    const uint16_t head = ringHead.load(std::memory_order_acquire);
+    bool found = false;
+
+    while (!found && tail != head) {
+        const uint8_t c = ringBytes[tail];
+        const uint32_t time = ringTimes[tail];
+        tail = (tail + 1) & (MIDI_RX_RING_SIZE - 1);
+
+        if (c >= 0xF8) {
+            // realtime, may sit in the middle of another message and leaves running status alone
+            event.micros = time;
+            event.status = c;
+            event.data1 = 0;
+            event.data2 = 0;
+            found = true;
+        }
+        else if (c & 0x80) {
+            // system common and sysex cancel running status, sysex data is skipped
+            runningStatus = (c < 0xF0 || dataLength(c) > 0) ? c : 0;
+            dataCount = 0;
+        }
+        else if (runningStatus != 0) {
+            data[dataCount++] = c;
+            if (dataCount == dataLength(runningStatus)) {
+                dataCount = 0;
+                if (runningStatus >= 0xF0) {
+                    runningStatus = 0; // system common, nothing here uses it
+                    continue;
+                }
+                event.micros = time;
+                event.status = runningStatus;
+                event.data1 = data[0];
+                event.data2 = (dataLength(runningStatus) == 2) ? data[1] : 0;
+                if ((event.status & 0xF0) == 0x90 && event.data2 == 0) {
+                    event.status = 0x80 | (event.status & 0x0F);
+                }
+                found = true;
+            }
+        }
+    }
+
+    ringTail.store(tail, std::memory_order_release);
+    return found;
+}
+
+uint32_t MidiReceiver::overruns() {
+    return overrunCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+#ifndef MidiReceiver_hpp
+#define MidiReceiver_hpp
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.hpp"
+
+#ifndef HOST_BUILD
+#include <driver/uart.h>
+#endif
+
+#define MIDI_CHANNEL_OMNI 0
+#define MIDI_BYTE_MICROS  320 // 10 bits at 31250 baud
+
+// One complete message. Channel messages keep the channel in the low nibble
+// of status, a note on with velocity 0 arrives as a note off.
+struct MidiEvent {
+    uint32_t micros; // arrival of the last byte
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+};
+
+// UART receive path: a UART event task timestamps the bytes into a ring,
+// read() parses them on the consumer side. One producer, one consumer.
+class MidiReceiver {
+public:
+    MidiReceiver();
+    bool begin(uint8_t uartNum, int8_t rxPin);
+    void setConsumer(TaskHandle_t task); // gets a task notification for every received chunk
+    // Producer side, the UART event task or a host tool feeding bytes in
+    void receive(const uint8_t *data, size_t len, uint32_t lastByteMicros);
+    // Consumer side, false once the ring has no complete message left
+    bool read(MidiEvent &event);
+    uint32_t overruns(); // bytes lost, in the UART driver or the ring (a FIFO overflow counts only what was flushed)
+
+private:
+    uint8_t ringBytes[MIDI_RX_RING_SIZE];
+    uint32_t ringTimes[MIDI_RX_RING_SIZE];
+    std::atomic<uint16_t> ringHead;
+    std::atomic<uint16_t> ringTail;
+    std::atomic<uint32_t> overrunCount;
+    TaskHandle_t consumer;
+
+    // parser state, consumer side only
+    uint8_t runningStatus;
+    uint8_t data[2];
+    uint8_t dataCount;
+
+    static uint8_t dataLength(uint8_t status);
+
+#ifndef HOST_BUILD
+    uart_port_t port;
+    QueueHandle_t uartQueue;
+    static void uartTask(void *parameter);
+#endif
+};
+
+extern MidiReceiver midiIn;
+
+#endif /* MidiReceiver_hpp */
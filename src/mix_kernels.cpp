@@ -0,0 +1,158 @@
+#include "mix_kernels.hpp"
+#include <esp_dsp.h>
+
+/* round half away from zero, symmetric so silence and small signals have no dead zone */
+static inline int16_t Mix_Saturate16(float x)
+{
+    if (x >= 32767.0f)
+    {
+        return 32767;
+    }
+    if (x <= -32768.0f)
+    {
+        return -32768;
+    }
+    return (int16_t)(x >= 0.0f ? x + 0.5f : x - 0.5f);
+}
+
+/* 2^31 is the first float past int32, there is no precision left to round */
+static inline int32_t Mix_Saturate32(float x)
+{
+    if (x >= 2147483648.0f)
+    {
+        return INT32_MAX;
+    }
+    if (x <= -2147483648.0f)
+    {
+        return INT32_MIN;
+    }
+    return (int32_t)x;
+}
+
+/* xorshift32, uniform 0.0 -> 1.0 */
+static inline float Mix_Uniform(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+void MixScalar_Clear(float *buf, int len)
+{
+    memset(buf, 0, len * sizeof(float));
+}
+
+void MixScalar_Int16ToFloat(float *dst, const int16_t *src, int srcStep, float scale, int len)
+{
+    for (int n = 0; n < len; n++)
+    {
+        dst[n] = (float)src[n * srcStep] * scale;
+    }
+}
+
+void MixScalar_MacGain(float *dst, const float *src, float gain, float inc, int len)
+{
+    if (inc == 0.0f)
+    {
+        for (int n = 0; n < len; n++)
+        {
+            dst[n] += src[n] * gain;
+        }
+        return;
+    }
+    for (int n = 0; n < len; n++)
+    {
+        gain += inc;
+        dst[n] += src[n] * gain;
+    }
+}
+
+void MixScalar_InterleaveSat16(int16_t *dst, const float *left, const float *right, float scale, int len)
+{
+    for (int n = 0; n < len; n++)
+    {
+        dst[2 * n] = Mix_Saturate16(left[n] * scale);
+        dst[2 * n + 1] = Mix_Saturate16(right[n] * scale);
+    }
+}
+
+void MixScalar_InterleaveDither16(int16_t *dst, const float *left, const float *right, float scale, uint32_t *state, int len)
+{
+    if (*state == 0)
+    {
+        *state = 1; /* xorshift sticks at 0 */
+    }
+    for (int n = 0; n < len; n++)
+    {
+        /* difference of two uniforms, triangular over +-1 LSB */
+        dst[2 * n] = Mix_Saturate16(left[n] * scale + Mix_Uniform(state) - Mix_Uniform(state));
+        dst[2 * n + 1] = Mix_Saturate16(right[n] * scale + Mix_Uniform(state) - Mix_Uniform(state));
+    }
+}
+
+void MixScalar_InterleaveSat32(int32_t *dst, const float *left, const float *right, float scale, int len)
+{
+    for (int n = 0; n < len; n++)
+    {
+        dst[2 * n] = Mix_Saturate32(left[n] * scale);
+        dst[2 * n + 1] = Mix_Saturate32(right[n] * scale);
+    }
+}
+
+/*
+ * ESP-DSP has no multiply accumulate by a constant, it takes a scale into
+ * a scratch block and an add. Ramps stay scalar, the library has no ramp.
+ */
+void MixDsp_MacGain(float *dst, const float *src, float gain, float inc, int len)
+{
+    if (inc != 0.0f)
+    {
+        MixScalar_MacGain(dst, src, gain, inc, len);
+        return;
+    }
+
+    float scaled[SAMPLE_BUFFER_SIZE];
+    for (int done = 0; done < len; done += SAMPLE_BUFFER_SIZE)
+    {
+        int count = (len - done < SAMPLE_BUFFER_SIZE) ? len - done : SAMPLE_BUFFER_SIZE;
+        dsps_mulc_f32(&src[done], scaled, count, gain, 1, 1);
+        dsps_add_f32(&dst[done], scaled, &dst[done], count, 1, 1, 1);
+    }
+}
+
+/*
+ * the scale writes straight into interleaved order through the output step,
+ * only the clip and the conversion are left for the loop
+ */
+void MixDsp_InterleaveSat16(int16_t *dst, const float *left, const float *right, float scale, int len)
+{
+    float scaled[2 * SAMPLE_BUFFER_SIZE];
+    for (int done = 0; done < len; done += SAMPLE_BUFFER_SIZE)
+    {
+        int count = (len - done < SAMPLE_BUFFER_SIZE) ? len - done : SAMPLE_BUFFER_SIZE;
+        dsps_mulc_f32(&left[done], &scaled[0], count, scale, 1, 2);
+        dsps_mulc_f32(&right[done], &scaled[1], count, scale, 1, 2);
+        for (int n = 0; n < 2 * count; n++)
+        {
+            dst[2 * done + n] = Mix_Saturate16(scaled[n]);
+        }
+    }
+}
+
+void MixDsp_InterleaveSat32(int32_t *dst, const float *left, const float *right, float scale, int len)
+{
+    float scaled[2 * SAMPLE_BUFFER_SIZE];
+    for (int done = 0; done < len; done += SAMPLE_BUFFER_SIZE)
+    {
+        int count = (len - done < SAMPLE_BUFFER_SIZE) ? len - done : SAMPLE_BUFFER_SIZE;
+        dsps_mulc_f32(&left[done], &scaled[0], count, scale, 1, 2);
+        dsps_mulc_f32(&right[done], &scaled[1], count, scale, 1, 2);
+        for (int n = 0; n < 2 * count; n++)
+        {
+            dst[2 * done + n] = Mix_Saturate32(scaled[n]);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * Block kernels for the mix and output paths
+ *
+ * Every kernel has a portable scalar version, MixScalar_*, which is the
+ * reference. With MIX_ESP_DSP the engine calls the ESP-DSP version,
+ * MixDsp_*, wherever the library has a routine for it. The host build
+ * compiles those against host/include/esp_dsp.h so the tests can hold
+ * both backends against each other, the engine itself stays scalar there.
+ */
+#ifndef MIX_KERNELS_HPP
+#define MIX_KERNELS_HPP
+
+#include <Arduino.h>
+#include "config.hpp"
+
+/*
+ * portable backend
+ */
+void MixScalar_Clear(float *buf, int len);
+/* dst[n] = src[n * srcStep] * scale, srcStep 2 picks one channel of interleaved stereo */
+void MixScalar_Int16ToFloat(float *dst, const int16_t *src, int srcStep, float scale, int len);
+/* dst[n] += src[n] * g, g steps by inc before each frame, inc 0 is a plain multiply accumulate */
+void MixScalar_MacGain(float *dst, const float *src, float gain, float inc, int len);
+/* dst[2n] = left[n] * scale, dst[2n + 1] = right[n] * scale, rounded to nearest and clipped to int16 */
+void MixScalar_InterleaveSat16(int16_t *dst, const float *left, const float *right, float scale, int len);
+/* the same with TPDF dither of +-1 LSB before rounding, state carries the noise generator between calls */
+void MixScalar_InterleaveDither16(int16_t *dst, const float *left, const float *right, float scale, uint32_t *state, int len);
+/* the same into 32 bit slots, clipped to int32 */
+void MixScalar_InterleaveSat32(int32_t *dst, const float *left, const float *right, float scale, int len);
+
+/*
+ * ESP-DSP backend, clear, the int16 conversion and the dither have no routine in the library
+ */
+void MixDsp_MacGain(float *dst, const float *src, float gain, float inc, int len);
+void MixDsp_InterleaveSat16(int16_t *dst, const float *left, const float *right, float scale, int len);
+void MixDsp_InterleaveSat32(int32_t *dst, const float *left, const float *right, float scale, int len);
+
+/*
+ * the kernels the engine calls
+ */
+inline void Mix_Clear(float *buf, int len)
+{
+    MixScalar_Clear(buf, len);
+}
+
+inline void Mix_Int16ToFloat(float *dst, const int16_t *src, int srcStep, float scale, int len)
+{
+    MixScalar_Int16ToFloat(dst, src, srcStep, scale, len);
+}
+
+inline void Mix_MacGain(float *dst, const float *src, float gain, float inc, int len)
+{
+#if defined(MIX_ESP_DSP) && !defined(HOST_BUILD)
+    MixDsp_MacGain(dst, src, gain, inc, len);
+#else
+    MixScalar_MacGain(dst, src, gain, inc, len);
+#endif
+}
+
+inline void Mix_InterleaveSat16(int16_t *dst, const float *left, const float *right, float scale, int len)
+{
+#if defined(MIX_ESP_DSP) && !defined(HOST_BUILD)
+    MixDsp_InterleaveSat16(dst, left, right, scale, len);
+#else
+    MixScalar_InterleaveSat16(dst, left, right, scale, len);
+#endif
+}
+
+inline void Mix_InterleaveDither16(int16_t *dst, const float *left, const float *right, float scale, uint32_t *state, int len)
+{
+    MixScalar_InterleaveDither16(dst, left, right, scale, state, len);
+}
+
+inline void Mix_InterleaveSat32(int32_t *dst, const float *left, const float *right, float scale, int len)
+{
+#if defined(MIX_ESP_DSP) && !defined(HOST_BUILD)
+    MixDsp_InterleaveSat32(dst, left, right, scale, len);
+#else
+    MixScalar_InterleaveSat32(dst, left, right, scale, len);
+#endif
+}
+
+#endif // MIX_KERNELS_HPP
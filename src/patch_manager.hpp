@@ -88,38 +88,100 @@ union wavHeader
     uint8_t wavHdr[44];
 };
 
-static bool PatchManager_PrepareSdCard(void);
-static bool PatchManager_PrepareLittleFs(void);
-static void PatchManager_SaveWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSize);
-static void PatchManager_FilenameFromIdx(FST &fs, const char *dirname, uint8_t index);
-static int PatchManager_GetFileList(FST &fs, const char *dirname, void(*fileInd)(char *filename, int offset), int offset);
-static uint32_t PatchManager_LoadWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSizebool, bool &stereo);
-static void PatchManager_CreateDir(FST &fs, const char *path);
-static void PatchManager_SavePatchParam(FST &fs, char *filename, struct patchParam_s *patchParam);
-static void PatchManager_LoadPatchParam(FST &fs, char *filename, struct patchParam_s *patchParam);
-static void PatchManager_CreateNewFileNames(FST &fs);
+/*
+ * the chunks PatchManager_LoadWavefileMarkers looks at, all fields little endian
+ */
+struct wavChunk_s
+{
+    char id[4];
+    uint32_t size; /*!< bytes following the chunk header, without the pad byte of odd sizes */
+};
+
+struct wavFormat_s
+{
+    uint16_t format_tag;
+    uint16_t numberOfChannels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t bytesPerSample;
+    uint16_t bitsPerSample;
+};
+
+struct wavFormatExtension_s /*!< follows wavFormat_s when format_tag is 0xFFFE: WAVE_FORMAT_EXTENSIBLE */
+{
+    uint16_t extensionSize; /*!< 22 */
+    uint16_t validBitsPerSample;
+    uint32_t channelMask;
+    uint16_t subFormat; /*!< first two bytes of the SubFormat GUID, the format_tag it stands for */
+};
+
+struct wavCuePoint_s /*!< 'cue ' holds a count followed by these */
+{
+    uint32_t id;
+    uint32_t position;
+    char dataChunkId[4];
+    uint32_t chunkStart;
+    uint32_t blockStart;
+    uint32_t sampleOffset; /*!< frame in the data chunk */
+};
+
+struct wavSampler_s /*!< 'smpl' header, followed by numSampleLoops loops */
+{
+    uint32_t manufacturer;
+    uint32_t product;
+    uint32_t samplePeriod;
+    uint32_t midiUnityNote;
+    uint32_t midiPitchFraction;
+    uint32_t smpteFormat;
+    uint32_t smpteOffset;
+    uint32_t numSampleLoops;
+    uint32_t samplerData;
+};
+
+struct wavSampleLoop_s
+{
+    uint32_t cuePointId;
+    uint32_t type;
+    uint32_t start; /*!< first frame of the loop */
+    uint32_t end;
+    uint32_t fraction;
+    uint32_t playCount;
+};
 
+static inline bool PatchManager_PrepareSdCard(void);
+static inline bool PatchManager_PrepareLittleFs(void);
+static inline bool PatchManager_SaveWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSize);
+static inline void PatchManager_FilenameFromIdx(FST &fs, const char *dirname, uint8_t index);
+static inline int PatchManager_GetFileList(FST &fs, const char *dirname, void(*fileInd)(char *filename, int offset), int offset);
+static inline uint32_t PatchManager_LoadWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSizebool, bool &stereo);
+static inline uint32_t PatchManager_LoadWavefileMarkers(FST &fs, const char *filename, int16_t *buffer, uint32_t bufferSize, bool &stereo,
+                                                 uint32_t *markers, uint16_t &numMarkers, uint16_t maxMarkers);
+static inline void PatchManager_CreateDir(FST &fs, const char *path);
+static inline void PatchManager_SavePatchParam(FST &fs, char *filename, struct patchParam_s *patchParam);
+static inline void PatchManager_LoadPatchParam(FST &fs, char *filename, struct patchParam_s *patchParam);
+static inline void PatchManager_CreateNewFileNames(FST &fs);
 
-uint32_t patch_selectedFileIndex = 0;
-char currentFileNameWav[64] = "/samples/testSample.wav\0";
-char currentFileNameBin[64] = "/samples/testSample.bin\0";
 
+static uint32_t patch_selectedFileIndex = 0;
+static char currentFileNameWav[64] = "/samples/testSample.wav\0";
+static char currentFileNameBin[64] = "/samples/testSample.bin\0";
 
-enum patchDst patchManagerDest = patch_dest_littlefs;
+
+static enum patchDst patchManagerDest = patch_dest_littlefs;
 
 /*
  * last written files
  */
-char wavNewFileName[64];
-char parNewFileName[64];
+static char wavNewFileName[64];
+static char parNewFileName[64];
 
 
-void PatchManager_Init(void)
+static inline void PatchManager_Init(void)
 {
     /* nothing to do */
 }
 
-static int PatchManager_GetFileList(FST &fs, const char *dirname, void(*fileInd)(char *filename, int offset), int offset)
+static inline int PatchManager_GetFileList(FST &fs, const char *dirname, void(*fileInd)(char *filename, int offset), int offset)
 {
 #ifdef PATCHMANAGER_DEBUG
     Serial.printf("Listing directory: %s\n", dirname);
@@ -185,7 +247,7 @@ static int PatchManager_GetFileList(FST &fs, const char *dirname, void(*fileInd)
     return foundFiles;
 }
 
-int PatchManager_GetFileListExt(void(*fileInd)(char *filename, int offset), int offset)
+static inline int PatchManager_GetFileListExt(void(*fileInd)(char *filename, int offset), int offset)
 {
     if (patchManagerDest == patch_dest_sd_mmc)
     {
@@ -206,7 +268,7 @@ int PatchManager_GetFileListExt(void(*fileInd)(char *filename, int offset), int
     return 0;
 }
 
-static void PatchManager_FilenameFromIdx(FST &fs, const char *dirname, uint8_t index)
+static inline void PatchManager_FilenameFromIdx(FST &fs, const char *dirname, uint8_t index)
 {
 #ifdef PATCHMANAGER_DEBUG
     Serial.printf("Listing directory: %s\n", dirname);
@@ -270,9 +332,9 @@ static void PatchManager_FilenameFromIdx(FST &fs, const char *dirname, uint8_t i
     patch_selectedFileIndex--;
 }
 
-char lastSelectedFile[128] = "";
+static char lastSelectedFile[128] = "";
 
-void PatchManager_UpdateFilename(void)
+static inline void PatchManager_UpdateFilename(void)
 {
     if (patchManagerDest == patch_dest_sd_mmc)
     {
@@ -310,7 +372,7 @@ void PatchManager_UpdateFilename(void)
 #endif
 }
 
-void PatchManager_FileIdxInc(uint8_t unused, float value)
+static inline void PatchManager_FileIdxInc(uint8_t unused, float value)
 {
     if (value > 0)
     {
@@ -319,7 +381,7 @@ void PatchManager_FileIdxInc(uint8_t unused, float value)
     }
 }
 
-void PatchManager_FileIdxDec(uint8_t unused, float value)
+static inline void PatchManager_FileIdxDec(uint8_t unused, float value)
 {
     if (value > 0)
     {
@@ -331,7 +393,7 @@ void PatchManager_FileIdxDec(uint8_t unused, float value)
     }
 }
 
-static uint32_t PatchManager_WaveSize(FST &fs, const char *filename)
+static inline uint32_t PatchManager_WaveSize(FST &fs, const char *filename)
 {
     File f = fs.open(filename, FILE_READ);
     if (!f)
@@ -346,13 +408,16 @@ static uint32_t PatchManager_WaveSize(FST &fs, const char *filename)
     return fileSize; // Return the size of the file
 }
 
-static void PatchManager_SaveWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSize)
+/*
+ * false when the file could not be created or not all of it was written
+ */
+static inline bool PatchManager_SaveWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSize)
 {
     File f = fs.open(filename, FILE_WRITE);
     if (!f)
     {
         Serial.println("Could not create new file\n");
-        return;
+        return false;
     }
 
     uint32_t dataSizeOfbuffer = sizeof(int16_t) * bufferSize;
@@ -378,57 +443,286 @@ static void PatchManager_SaveWavefile(FST &fs, char *filename, int16_t *buffer,
 #else
     f.seek(0);
 #endif
-    f.write(wavHeader.wavHdr, 44);
+    bool ok = f.write(wavHeader.wavHdr, 44) == 44;
 
     /* avoid watchdog */
     delay(1);
 
-    f.write((uint8_t *)buffer, dataSizeOfbuffer);
+    ok = ok && f.write((uint8_t *)buffer, dataSizeOfbuffer) == dataSizeOfbuffer;
     f.close();
 
     /* avoid watchdog */
     delay(1);
+
+    if (!ok)
+    {
+        Serial.printf("Could not write %s\n", filename);
+    }
+    return ok;
 }
 
-static uint32_t PatchManager_LoadWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSize, bool& stereo)
+/*
+ * writes a 16 bit PCM header to the start of a file that is still growing,
+ * call it again with the final data size once everything is written
+ */
+static inline bool PatchManager_WriteWavHeader(File &f, uint16_t channels, uint32_t sampleRate, uint32_t dataSize)
 {
-    File f = fs.open(filename, FILE_READ);
+    union wavHeader wavHeader;
+
+    memcpy(wavHeader.riff, "RIFF", 4);
+    wavHeader.fileSize = 36 + dataSize;
+    memcpy(wavHeader.waveType, "WAVE", 4);
+    memcpy(wavHeader.format, "fmt ", 4);
+    wavHeader.lengthOfData = 16; /* length of the fmt header */
+    wavHeader.format_tag = 0x0001; /* 0x0001: PCM */
+    wavHeader.numberOfChannels = channels;
+    wavHeader.sampleRate = sampleRate;
+    wavHeader.byteRate = sampleRate * channels * 2;
+    wavHeader.bytesPerSample = channels * 2;
+    wavHeader.bitsPerSample = 16;
+
+    memcpy(wavHeader.dataStr, "data", 4);
+    wavHeader.dataSize = dataSize;
+
+    f.seek(0, SeekSet);
+    return f.write(wavHeader.wavHdr, 44) == 44;
+}
+
+/*
+ * first unused <dirname>/<prefix>NNN.wav, the directory is created when missing
+ */
+static inline void PatchManager_NewWavFileName(FST &fs, const char *dirname, const char *prefix, char *filename, size_t len)
+{
+    if (!fs.exists(dirname))
+    {
+        PatchManager_CreateDir(fs, dirname);
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(filename, len, "%s/%s%03d.wav", dirname, prefix, i);
+        if (!fs.exists(filename))
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * keeps the marker list sorted and free of duplicates, markers past maxMarkers are dropped
+ */
+static inline void PatchManager_AddMarker(uint32_t *markers, uint16_t &numMarkers, uint16_t maxMarkers, uint32_t frame)
+{
+    uint16_t i = 0;
+    while (i < numMarkers && markers[i] < frame)
+    {
+        i++;
+    }
+    if ((i < numMarkers && markers[i] == frame) || numMarkers >= maxMarkers)
+    {
+        return;
+    }
+    memmove(&markers[i + 1], &markers[i], (numMarkers - i) * sizeof(uint32_t));
+    markers[i] = frame;
+    numMarkers++;
+}
+
+/*
+ * opens a file and checks the RIFF WAVE header, the chunks start at offset 12
+ */
+static inline bool PatchManager_OpenWavefile(FST &fs, const char *filename, File &f, uint32_t &fileSize)
+{
+    f = fs.open(filename, FILE_READ);
     if (!f)
     {
         Serial.println("Could not read file\n");
-        return 0;
+        return false;
     }
 
-    union wavHeader wavHeader;
+    fileSize = f.size();
+    struct wavChunk_s chunk;
+    char waveType[4];
 
-    memset(wavHeader.wavHdr, 0, sizeof(wavHeader));
+    if (f.read((uint8_t *)&chunk, sizeof(chunk)) != sizeof(chunk) || memcmp(chunk.id, "RIFF", 4) != 0
+        || f.read((uint8_t *)waveType, 4) != 4 || memcmp(waveType, "WAVE", 4) != 0)
+    {
+        Serial.printf("%s is not a RIFF WAVE file\n", filename);
+        f.close();
+        return false;
+    }
+    return true;
+}
 
+/*
+ * reads the chunk header at pos and leaves the file at the chunk's data,
+ * pos moves on to the next chunk. false past the last one
+ */
+static inline bool PatchManager_NextWavChunk(File &f, uint32_t fileSize, uint32_t &pos, struct wavChunk_s &chunk)
+{
+    if (pos + sizeof(chunk) > fileSize)
+    {
+        return false;
+    }
 #ifdef ESP32
-    f.seek(0, SeekSet);
+    f.seek(pos, SeekSet);
 #else
-    f.seek(0);
+    f.seek(pos);
 #endif
-    f.read(wavHeader.wavHdr, 44);
+    if (f.read((uint8_t *)&chunk, sizeof(chunk)) != sizeof(chunk))
+    {
+        return false;
+    }
+    pos += sizeof(chunk);
+    /* a recording that was cut off can claim more than the file holds */
+    if (chunk.size > fileSize - pos)
+    {
+        chunk.size = fileSize - pos;
+    }
+    /* chunks are padded to an even size */
+    pos += chunk.size + (chunk.size & 1);
+    return true;
+}
 
-    /* avoid watchdog */
-    delay(1);
+/*
+ * reads only the fmt  and data chunk headers, for listing files without loading them
+ */
+static inline bool PatchManager_WaveInfo(FST &fs, const char *filename, uint16_t &channels, uint32_t &sampleRate, uint32_t &dataSize)
+{
+    File f;
+    uint32_t fileSize;
+    if (!PatchManager_OpenWavefile(fs, filename, f, fileSize))
+    {
+        return false;
+    }
+
+    bool hasFormat = false;
+    bool hasData = false;
+    struct wavChunk_s chunk;
+    uint32_t pos = 12;
+
+    while (!(hasFormat && hasData) && PatchManager_NextWavChunk(f, fileSize, pos, chunk))
+    {
+        if (memcmp(chunk.id, "fmt ", 4) == 0 && chunk.size >= sizeof(struct wavFormat_s))
+        {
+            struct wavFormat_s format;
+            f.read((uint8_t *)&format, sizeof(format));
+            channels = format.numberOfChannels;
+            sampleRate = format.sampleRate;
+            hasFormat = true;
+        }
+        else if (memcmp(chunk.id, "data", 4) == 0)
+        {
+            dataSize = chunk.size;
+            hasData = true;
+        }
+    }
+    f.close();
+
+    return hasFormat && hasData;
+}
+
+/*
+ * walks the RIFF chunks instead of expecting the data right after a 44 byte header
+ * - fmt  gives the channels, anything but 16 bit PCM is refused,
+ *   an extensible fmt  counts as PCM when its SubFormat GUID does
+ * - data is read into buffer, at most bufferSize bytes
+ * - cue  points and smpl loop starts are collected as frame offsets into the data,
+ *   only when markers is not NULL
+ */
+static inline uint32_t PatchManager_LoadWavefileMarkers(FST &fs, const char *filename, int16_t *buffer, uint32_t bufferSize, bool &stereo,
+                                                 uint32_t *markers, uint16_t &numMarkers, uint16_t maxMarkers)
+{
+    numMarkers = 0;
+
+    File f;
+    uint32_t fileSize;
+    if (!PatchManager_OpenWavefile(fs, filename, f, fileSize))
+    {
+        return 0;
+    }
 
+    struct wavChunk_s chunk;
+    uint16_t channels = 1;
+    bool hasFormat = false;
     uint32_t bufferIn = 0;
+    uint32_t pos = 12;
+
+    while (PatchManager_NextWavChunk(f, fileSize, pos, chunk))
+    {
+        if (memcmp(chunk.id, "fmt ", 4) == 0 && chunk.size >= sizeof(struct wavFormat_s))
+        {
+            struct wavFormat_s format;
+            f.read((uint8_t *)&format, sizeof(format));
+            if (format.format_tag == 0xFFFE && chunk.size >= 40) /* 0xFFFE: extensible, the GUID says which format */
+            {
+                struct wavFormatExtension_s extension;
+                f.read((uint8_t *)&extension, sizeof(extension));
+                format.format_tag = extension.subFormat;
+            }
+            if (format.format_tag != 0x0001 || format.bitsPerSample != 16) /* 0x0001: PCM */
+            {
+                Serial.printf("%s: only 16 bit PCM is supported, not format %d with %d bits\n", filename, format.format_tag, format.bitsPerSample);
+                f.close();
+                return 0;
+            }
+            channels = format.numberOfChannels;
+            hasFormat = true;
+        }
+        else if (memcmp(chunk.id, "data", 4) == 0)
+        {
+            if (!hasFormat)
+            {
+                Serial.printf("%s: data before the fmt  chunk\n", filename);
+                f.close();
+                return 0;
+            }
+            uint32_t dataSize = chunk.size < bufferSize ? chunk.size : bufferSize;
+            bufferIn = f.read((uint8_t *)buffer, dataSize & ~1u);
+
+            /* avoid watchdog */
+            delay(1);
+        }
+        else if (markers != NULL && memcmp(chunk.id, "cue ", 4) == 0 && chunk.size >= 4)
+        {
+            uint32_t points = 0;
+            f.read((uint8_t *)&points, 4);
+            for (uint32_t i = 0; i < points && 4 + (i + 1) * sizeof(struct wavCuePoint_s) <= chunk.size; i++)
+            {
+                struct wavCuePoint_s point;
+                f.read((uint8_t *)&point, sizeof(point));
+                PatchManager_AddMarker(markers, numMarkers, maxMarkers, point.sampleOffset);
+            }
+        }
+        else if (markers != NULL && memcmp(chunk.id, "smpl", 4) == 0 && chunk.size >= sizeof(struct wavSampler_s))
+        {
+            struct wavSampler_s sampler;
+            f.read((uint8_t *)&sampler, sizeof(sampler));
+            for (uint32_t i = 0; i < sampler.numSampleLoops && sizeof(sampler) + (i + 1) * sizeof(struct wavSampleLoop_s) <= chunk.size; i++)
+            {
+                struct wavSampleLoop_s loop;
+                f.read((uint8_t *)&loop, sizeof(loop));
+                PatchManager_AddMarker(markers, numMarkers, maxMarkers, loop.start);
+            }
+        }
+    }
 
-    f.read((uint8_t *)buffer, wavHeader.dataSize);
-    bufferIn += wavHeader.dataSize;
-    
     f.close();
 
     /* avoid watchdog */
     delay(1);
 
-    stereo = (wavHeader.numberOfChannels == 2);
+    stereo = (channels == 2);
 
     return bufferIn / sizeof(int16_t);
 }
 
-static void PatchManager_CreateDir(FST &fs, const char *path)
+static inline uint32_t PatchManager_LoadWavefile(FST &fs, char *filename, int16_t *buffer, uint32_t bufferSize, bool& stereo)
+{
+    uint16_t numMarkers;
+    return PatchManager_LoadWavefileMarkers(fs, filename, buffer, bufferSize, stereo, NULL, numMarkers, 0);
+}
+
+static inline void PatchManager_CreateDir(FST &fs, const char *path)
 {
     Serial.printf("Creating Dir: %s\n", path);
     if (fs.mkdir(path))
@@ -441,7 +735,7 @@ static void PatchManager_CreateDir(FST &fs, const char *path)
     }
 }
 
-bool PatchManager_PrepareSdCard(void)
+static inline bool PatchManager_PrepareSdCard(void)
 {
 #ifdef ESP32
     if (!SD_MMC.begin("/sdcard", true)) /* makes less noise on recording! */
@@ -487,7 +781,7 @@ bool PatchManager_PrepareSdCard(void)
 }
 
 #ifdef ESP32
-bool PatchManager_PrepareLittleFs(void)
+static inline bool PatchManager_PrepareLittleFs(void)
 {
     if (!LittleFS.begin())
     {
@@ -499,7 +793,7 @@ bool PatchManager_PrepareLittleFs(void)
 }
 #endif
 
-static void PatchManager_SavePatchParam(FST &fs, char *filename, struct patchParam_s *patchParam)
+static inline void PatchManager_SavePatchParam(FST &fs, char *filename, struct patchParam_s *patchParam)
 {
     File f = fs.open(filename, FILE_WRITE);
     if (!f)
@@ -513,7 +807,7 @@ static void PatchManager_SavePatchParam(FST &fs, char *filename, struct patchPar
     f.close();
 }
 
-static void PatchManager_LoadPatchParam(FST &fs, char *filename, struct patchParam_s *patchParam)
+static inline void PatchManager_LoadPatchParam(FST &fs, char *filename, struct patchParam_s *patchParam)
 {
     File f = fs.open(filename, FILE_READ);
     if (!f)
@@ -553,7 +847,7 @@ static void PatchManager_LoadPatchParam(FST &fs, char *filename, struct patchPar
     f.close();
 }
 
-void PatchManager_SetDestination(uint8_t destination, float value)
+static inline void PatchManager_SetDestination(uint8_t destination, float value)
 {
     if (value > 0)
     {
@@ -572,7 +866,7 @@ void PatchManager_SetDestination(uint8_t destination, float value)
     }
 }
 
-static void PatchManager_CreateNewFileNames(FST &fs)
+static inline void PatchManager_CreateNewFileNames(FST &fs)
 {
 
     int i = 0;
@@ -598,7 +892,7 @@ static void PatchManager_CreateNewFileNames(FST &fs)
     }
 }
 
-void PatchManager_SaveNewPatch(struct patchParam_s *patchParam, int16_t *buffer, int bufferSize)
+static inline void PatchManager_SaveNewPatch(struct patchParam_s *patchParam, int16_t *buffer, int bufferSize)
 {
     if (patchManagerDest == patch_dest_sd_mmc)
     {
@@ -630,14 +924,14 @@ void PatchManager_SaveNewPatch(struct patchParam_s *patchParam, int16_t *buffer,
 #endif
 }
 
-void PatchManager_SetFilename(const char *filename)
+static inline void PatchManager_SetFilename(const char *filename)
 {
     strcpy(currentFileNameWav, filename);
     strcpy(currentFileNameBin, filename);
     strcpy(&currentFileNameBin[strlen(currentFileNameBin) - 3], "bin");
 }
 
-uint32_t PatchManager_LoadPatch(struct patchParam_s *patchParam, int16_t *buffer, int bufferSize)
+static inline uint32_t PatchManager_LoadPatch(struct patchParam_s *patchParam, int16_t *buffer, int bufferSize)
 {
     memset(patchParam, 0, sizeof(*patchParam));
 
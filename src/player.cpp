@@ -1,179 +1,1416 @@
 #include "player.hpp"
+#include <algorithm>
 #include "patch_manager.hpp"
+#include "storage.hpp"
+#include "mix_kernels.hpp"
+#include "trace.hpp"
 
 SamplePlayer::Player SamplePlayer::samplePlayers[NUM_PLAYERS];
+SamplePlayer::Voice SamplePlayer::voices[NUM_VOICES];
+uint8_t SamplePlayer::activeList[NUM_VOICES];
+uint8_t SamplePlayer::activeCount = 0;
+uint32_t SamplePlayer::voiceAge = 0;
+SamplePlayer::ControlParams SamplePlayer::channelControls[MIDI_CHANNELS];
+SamplePlayer::ChannelState SamplePlayer::channelStates[MIDI_CHANNELS];
+SamplePlayer::SlotState SamplePlayer::slotStates[NUM_PLAYERS];
+float SamplePlayer::cutoffLut[MIDI_NOTES];
+SamplePlayer::ScheduledNote SamplePlayer::noteQueue[NOTE_QUEUE_SIZE];
+std::atomic<uint16_t> SamplePlayer::noteQueueHead(0);
+std::atomic<uint16_t> SamplePlayer::noteQueueTail(0);
+SamplePlayer::ScheduledNote SamplePlayer::pendingNotes[NOTE_QUEUE_SIZE];
+uint8_t SamplePlayer::pendingCount = 0;
+std::atomic<uint32_t> SamplePlayer::blockFrame(0);
+std::atomic<uint32_t> SamplePlayer::blockMicros(0);
+std::atomic<bool> SamplePlayer::rendering(false);
+uint32_t SamplePlayer::nextBlockFrame = 0;
+uint32_t SamplePlayer::lateNotes = 0;
+std::atomic<uint32_t> SamplePlayer::notesStarted(0);
+std::atomic<uint32_t> SamplePlayer::notesRetriggered(0);
+std::atomic<uint32_t> SamplePlayer::voicesStolen(0);
+std::atomic<uint32_t> SamplePlayer::notesDropped(0);
+std::atomic<uint32_t> SamplePlayer::voicesRetired(0);
+uint8_t SamplePlayer::peakVoices = 0;
+SamplePlayer::RetiredBuffer SamplePlayer::retired[RETIRED_BUFFERS];
+uint8_t SamplePlayer::retiredCount = 0;
+uint8_t SamplePlayer::voiceCap = NUM_VOICES;
+uint8_t SamplePlayer::lowestCap = NUM_VOICES;
+bool SamplePlayer::fastInterpolation = false;
+uint16_t SamplePlayer::calmBlocks = 0;
+uint8_t SamplePlayer::lastLoad = 0;
+uint8_t SamplePlayer::peakLoad = 0;
+std::atomic<uint32_t> SamplePlayer::voicesShed(0);
+float pan_lut[2][PAN_STEPS];
 uint32_t SamplePlayer::totalSampleStorageLen = 0;
 uint8_t SamplePlayer::sampleCount = 0;
+uint32_t SamplePlayer::outputRate = SAMPLE_RATE;
 
-SamplePlayer::SamplePlayer() {
+SamplePlayer::SamplePlayer(uint32_t sampleRate) {
+    outputRate = sampleRate; // before init(), the envelope rates depend on it
     psramInit();
     Serial.printf("Total PSRAM: %d\n", ESP.getPsramSize());
     Serial.printf("Free PSRAM: %d\n", ESP.getFreePsram());
     
     totalSampleStorageLen = ESP.getFreePsram() / sizeof(int16_t);
     PatchManager_SetDestination(1, 1);
+    init();
+}
+
+void SamplePlayer::init() {
+    // MMA equal-power curve, 0 and 1 are both hard left so that 64 is the exact centre
+    for (int p = 0; p < PAN_STEPS; p++)
+    {
+        float angle = (float)(p > 0 ? p - 1 : 0) / (PAN_STEPS - 2) * (float)M_PI_2;
+        pan_lut[0][p] = cosf(angle);
+        pan_lut[1][p] = sinf(angle);
+    }
+
+    // Filter cutoff per note number, equal tempered like the keys, kept under Nyquist.
+    // The tan() prewarp runs here only, the blocks just interpolate the table.
+    for (int note = 0; note < MIDI_NOTES; note++)
+    {
+        float freq = 440.0f * exp2f((float)(note - 69) / 12.0f);
+        if (freq > FILTER_MAX_CUTOFF * outputRate)
+        {
+            freq = FILTER_MAX_CUTOFF * outputRate;
+        }
+        cutoffLut[note] = tanf((float)M_PI * freq / outputRate);
+    }
+
+    for (int ch = 0; ch < MIDI_CHANNELS; ch++)
+    {
+        channelControls[ch].volume = 127;
+        channelControls[ch].pan = PAN_CENTER;
+        channelControls[ch].attack = 0;
+        channelControls[ch].decay = 127;
+        channelControls[ch].delaySend = 0;
+        channelControls[ch].reverbSend = 0;
+        channelControls[ch].cutoff = 127;
+        channelControls[ch].resonance = 0;
+        channelControls[ch].filterMode = FILTER_OFF;
+        channelControls[ch].pitchBend = 0;
+        updateChannelState(&channelStates[ch], &channelControls[ch]);
+    }
+
+    voiceCap = NUM_VOICES;
+    fastInterpolation = false;
+    calmBlocks = 0;
 }
 
 SamplePlayer::~SamplePlayer() {
     // Destructor code here, such as freeing dynamic memory if used
 }
 
+// Completion of the storage requests below, runs on the storage I/O task
+struct WavLoad {
+    std::atomic<int8_t> result; // -1 while the request is queued
+};
+
+void SamplePlayer::wavLoaded(StorageRequest &request) {
+    WavLoad *load = (WavLoad*)request.context;
+    if (load != NULL) {
+        load->result.store(request.ok ? 1 : 0, std::memory_order_release);
+    }
+}
+
+bool SamplePlayer::wavJob(fs::FS &fs, StorageRequest &request) {
+    SampleBuffer *buffer = fetchSample(fs, request.path);
+    if (buffer == NULL) {
+        return false;
+    }
+    installSample(request.tag, buffer);
+    return true;
+}
+
 bool SamplePlayer::loadWav(uint8_t sampleNum, char* filename) {
-    if (! PatchManager_PrepareSdCard())
-    {
+    if (sampleNum >= NUM_PLAYERS) {
+        Serial.println("Sample number out of bounds.");
+        return false;
+    }
+
+    WavLoad load;
+    load.result.store(-1, std::memory_order_relaxed);
+    if (!storage.run(wavJob, wavLoaded, &load, filename, sampleNum)) {
+        return false;
+    }
+    while (load.result.load(std::memory_order_acquire) < 0) {
+        delay(1);
+    }
+    return load.result.load(std::memory_order_relaxed) == 1;
+}
+
+bool SamplePlayer::loadWavAsync(uint8_t sampleNum, const char* filename) {
+    if (sampleNum >= NUM_PLAYERS) {
+        Serial.println("Sample number out of bounds.");
         return false;
     }
+    return storage.run(wavJob, NULL, NULL, filename, sampleNum);
+}
+
+// A buffer from the sample store, read from the card only when no slot holds the file yet
+SampleBuffer* SamplePlayer::fetchSample(fs::FS &fs, const char* filename) {
+    auto dataSize = PatchManager_WaveSize(fs, filename);
+    if (dataSize == 0)
+    {
+        return NULL;
+    }
+
+    SampleBuffer *buffer = sampleStore.find(filename, dataSize);
+    if (buffer != NULL)
+    {
+        Serial.printf("Sharing %s\n", filename);
+        return buffer;
+    }
+
+    uint32_t markers[MAX_SLICES];
+    StorageRequest wav;
+    memset(&wav, 0, sizeof(wav));
+    strncpy(wav.path, filename, sizeof(wav.path) - 1);
+    wav.markers = markers;
+    wav.maxMarkers = MAX_SLICES;
+    if (!StorageService::readWav(fs, wav))
+    {
+        return NULL;
+    }
+    Serial.printf("Read %d samples from %s\n", wav.numSamples, filename);
+
+    buffer = sampleStore.add(filename, dataSize, wav.data, wav.numSamples, wav.stereo, true, markers, wav.numMarkers);
+    if (buffer == NULL)
+    {
+        free(wav.data);
+        return NULL;
+    }
+    Serial.printf("Trimmed %d silent frames, peak %0.1f dBFS, rms %0.1f dBFS\n", buffer->trimmedFrames,
+        20.0f * log10f(buffer->peak + 1e-9f), 20.0f * log10f(buffer->rms + 1e-9f));
+    if (buffer->numSlices > 0)
+    {
+        Serial.printf("%d slices\n", buffer->numSlices);
+    }
+    return buffer;
+}
+
+// Returns true after the render loop has started the given number of blocks, or right away
+// when it never started one (setup, host tools). false when it stalled for SLOT_SWAP_TIMEOUT_MS,
+// a voice may still be reading the slot's old buffer then.
+bool SamplePlayer::waitForBlocks(uint8_t blocks) {
+    // seq_cst against beginBlock(): either it sees the slot disabled or we see it rendering
+    if (!rendering.load())
+    {
+        return true;
+    }
+    const uint32_t start = blockFrame.load(std::memory_order_acquire);
+    const uint32_t startMillis = millis();
+    while (blockFrame.load(std::memory_order_acquire) - start < (uint32_t)blocks * SAMPLE_BUFFER_SIZE)
+    {
+        if (millis() - startMillis >= SLOT_SWAP_TIMEOUT_MS)
+        {
+            return false;
+        }
+        delay(1);
+    }
+    return true;
+}
+
+// Holds back a buffer a slot let go of while waitForBlocks() timed out, a later load
+// releases it once the render loop has moved on, see releaseRetired()
+void SamplePlayer::retireBuffer(SampleBuffer *buffer) {
+    if (buffer == NULL)
+    {
+        return;
+    }
+    if (retiredCount >= RETIRED_BUFFERS)
+    {
+        // leaking it beats freeing what a voice may still read
+        Serial.printf("Render loop stalled, keeping %s for good\n", buffer->path);
+        return;
+    }
+    Serial.printf("Render loop stalled, holding %s back\n", buffer->path);
+    retired[retiredCount].buffer = buffer;
+    retired[retiredCount].frame = blockFrame.load(std::memory_order_acquire);
+    retiredCount++;
+}
+
+// Releases the held back buffers the render loop has moved two blocks past
+void SamplePlayer::releaseRetired() {
+    const uint32_t frame = blockFrame.load(std::memory_order_acquire);
+    uint8_t kept = 0;
+    for (int i = 0; i < retiredCount; i++)
+    {
+        if (frame - retired[i].frame >= 2 * SAMPLE_BUFFER_SIZE)
+        {
+            sampleStore.release(retired[i].buffer);
+        }
+        else
+        {
+            retired[kept++] = retired[i];
+        }
+    }
+    retiredCount = kept;
+}
+
+// Points a slot at a buffer, or one slice of it, taking over the caller's reference
+bool SamplePlayer::installSample(uint8_t sampleNum, SampleBuffer *buffer, int16_t slice) {
     // Ensure the sample number is within bounds
     if (sampleNum >= NUM_PLAYERS) {
         Serial.println("Sample number out of bounds.");
+        sampleStore.release(buffer);
+        return false;
+    }
+
+    const uint32_t channels = buffer->stereo ? 2 : 1;
+    uint32_t first = 0;
+    uint32_t end = buffer->numSamples / channels;
+    if (slice >= 0 && !SampleStore::sliceFrames(buffer, slice, first, end))
+    {
+        Serial.printf("%s has no slice %d\n", buffer->path, slice);
+        sampleStore.release(buffer);
         return false;
     }
+    // a slice reads the tail peaks from the block it starts in, an upper bound for the rest of it
+    const uint32_t firstBlock = std::min(first / ENVELOPE_BLOCK_FRAMES, buffer->envelopeBlocks);
 
+    releaseRetired();
     Player* newPatch = &samplePlayers[sampleNum];
-    // Ideally reset the newPatch fields to defaults here, omitted for brevity
+    SampleBuffer *previous = newPatch->buffer;
+    newPatch->changes.fetch_add(1);
+    newPatch->enabled = false;
+    // beginBlock() stops the slot's voices, the old buffer can go once a block has started without them
+    const bool stopped = previous == NULL || waitForBlocks(2);
 
-    auto dataSize = PatchManager_WaveSize(SD_MMC, filename);
-    if (dataSize == 0)
+    // Setup the newPatch properties after successful loading
+    newPatch->buffer = buffer;
+    newPatch->sampleStorage = &buffer->data[first * channels];
+    newPatch->numSamples = (end - first) * channels;
+    newPatch->stereo = buffer->stereo;
+    newPatch->tailPeak = buffer->tailPeak != NULL ? &buffer->tailPeak[firstBlock] : NULL;
+    newPatch->envelopeBlocks = buffer->envelopeBlocks - firstBlock;
+    newPatch->firstFrame = first;
+    newPatch->volume = 127;
+    newPatch->pan = PAN_CENTER; // Assuming mid-pan as default
+    snprintf(newPatch->filename, sizeof(newPatch->filename), "%s", buffer->path);
+    newPatch->enabled = true;
+    if (sampleNum >= sampleCount)
     {
-        return false;
+        sampleCount = sampleNum + 1;
+    }
+    if (stopped)
+    {
+        sampleStore.release(previous);
+    }
+    else
+    {
+        retireBuffer(previous);
+    }
+    newPatch->changes.fetch_add(1, std::memory_order_release);
+    TRACE_INSTANT(TRACE_LOADED, sampleNum, 0);
+
+    Serial.println("Successfully initialized sample.");
+
+    return true;
+}
+
+// Empties a slot, its buffer goes back to the store
+void SamplePlayer::releaseSlot(uint8_t sampleNum) {
+    Player *slot = &samplePlayers[sampleNum];
+    if (slot->buffer == NULL)
+    {
+        return;
+    }
+    releaseRetired();
+    SampleBuffer *previous = slot->buffer;
+    slot->changes.fetch_add(1);
+    slot->enabled = false;
+    const bool stopped = waitForBlocks(2);
+    slot->buffer = NULL;
+    slot->filename[0] = '\0';
+    if (!stopped)
+    {
+        // a stalled block may still read the slot, its fields keep pointing into the held back buffer
+        retireBuffer(previous);
+    }
+    else
+    {
+        slot->sampleStorage = NULL;
+        slot->numSamples = 0;
+        slot->firstFrame = 0;
+        sampleStore.release(previous);
+    }
+    slot->changes.fetch_add(1, std::memory_order_release);
+}
+
+// Storage I/O task: waits up to timeoutMs for the slots to go quiet. The stream keeps
+// its turns meanwhile, a take recording through a bank switch must not overrun.
+void SamplePlayer::waitForSilence(uint8_t firstSlot, uint8_t numSlots, uint32_t timeoutMs) {
+    const uint32_t start = millis();
+    while (millis() - start < timeoutMs)
+    {
+        bool sounding = false;
+        for (uint8_t slot = 0; slot < numSlots && !sounding; slot++)
+        {
+            sounding = slotSounding(firstSlot + slot);
+        }
+        if (!sounding)
+        {
+            return;
+        }
+        storage.pollStream();
+        delay(1);
     }
-    Serial.print("Datasize: ");
-    Serial.println(dataSize);
+}
 
-    auto freePSRAM = ESP.getFreePsram();
-    if (dataSize > freePSRAM) {
-        Serial.println("Not enough PSRAM memory for sample storage!");
+// Whether a voice still plays the slot, read from another core so only a hint
+bool SamplePlayer::slotSounding(uint8_t sampleNum) {
+    if (!samplePlayers[sampleNum].enabled)
+    {
         return false;
     }
+    for (int i = 0; i < NUM_VOICES; i++)
+    {
+        if (voices[i].active && voices[i].sampleNum == sampleNum)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t SamplePlayer::loadKit(const char* kitFile, KitEntry *entries, uint16_t maxEntries, uint8_t firstSlot, uint8_t numSlots) {
+    KitLoad load;
+    load.kitFile = kitFile;
+    load.entries = entries;
+    load.maxEntries = maxEntries;
+    load.firstSlot = firstSlot;
+    load.numSlots = numSlots;
+
+    if (!loadKitAsync(&load))
+    {
+        return 0;
+    }
+    while (!load.done.load(std::memory_order_acquire))
+    {
+        delay(1);
+    }
+    return load.numEntries;
+}
 
-    newPatch->numSamples = dataSize / 2;
-    newPatch->sampleStorage = (int16_t*)ps_malloc(dataSize);
-    if (newPatch->sampleStorage == NULL) {
-        Serial.println("Could not allocate PSRAM!");
+bool SamplePlayer::loadKitAsync(KitLoad *load) {
+    if (load->firstSlot >= NUM_PLAYERS || load->numSlots == 0 || load->firstSlot + load->numSlots > NUM_PLAYERS)
+    {
+        Serial.println("Kit slot range out of bounds.");
         return false;
     }
+    load->numEntries = 0;
+    load->done.store(false, std::memory_order_relaxed);
+    return storage.run(kitJob, kitLoaded, load);
+}
 
-    auto readWavSamples = PatchManager_LoadWavefile(SD_MMC, filename, newPatch->sampleStorage, dataSize, newPatch->stereo);
-    SD_MMC.end();
+void SamplePlayer::kitLoaded(StorageRequest &request) {
+    ((KitLoad*)request.context)->done.store(true, std::memory_order_release);
+}
 
-    if (readWavSamples <= 0) {
-        Serial.println("Error reading WAV file.");
-        // Free allocated memory if WAV file read fails
-        free(newPatch->sampleStorage);
-        newPatch->sampleStorage = NULL;
+// Runs on the storage I/O task: parse every line first, then load each distinct file once
+bool SamplePlayer::kitJob(fs::FS &fs, StorageRequest &request) {
+    KitLoad *load = (KitLoad*)request.context;
+    KitEntry *entries = load->entries;
+
+    File f = fs.open(load->kitFile, FILE_READ);
+    if (!f)
+    {
+        Serial.printf("No kit file %s\n", load->kitFile);
         return false;
     }
 
-    Serial.printf("Read %d samples from %s on SD_MMC\n", readWavSamples, filename);
+    char line[128];
+    char files[NUM_PLAYERS][64];
+    int16_t fileSlices[NUM_PLAYERS]; // slice each slot plays, -1 for the whole file
+    uint8_t numFiles = 0;
+    uint16_t numEntries = 0;
 
-    // Setup the newPatch properties after successful loading
-    newPatch->velocity = 1.0f;
-    newPatch->pan = 9; // Assuming mid-pan as default
-    // Assuming 'filename' fits within the char* array, consider strncpy for safety
-    strncpy((char*)newPatch->filename, filename, sizeof(newPatch->filename) - 1);
-    newPatch->enabled = true;
-    newPatch->playing = false;
-    newPatch->pos = 0;
-    newPatch->decay_sample = 0.0f;
-    newPatch->decay = 0.0f;
+    // the same file (and slice) in several zones shares one slot, -1 when the range is full
+    auto slotFor = [&](const char *path, int16_t slice) {
+        uint8_t slot = 0;
+        while (slot < numFiles && (strcmp(files[slot], path) != 0 || fileSlices[slot] != slice))
+        {
+            slot++;
+        }
+        if (slot == numFiles)
+        {
+            if (numFiles >= load->numSlots)
+            {
+                return -1;
+            }
+            strcpy(files[numFiles], path);
+            fileSlices[numFiles++] = slice;
+        }
+        return (int)slot;
+    };
 
-    Serial.println("Successfully initialized sample.");
+    while (f.available() && numEntries < load->maxEntries)
+    {
+        int len = 0;
+        while (f.available())
+        {
+            char c = f.read();
+            if (c == '\n')
+            {
+                break;
+            }
+            if (len < (int)sizeof(line) - 1)
+            {
+                line[len++] = c;
+            }
+        }
+        line[len] = '\0';
+
+        if (line[0] == '#' || line[0] == '\0' || line[0] == '\r')
+        {
+            continue;
+        }
+
+        int channel, loKey, hiKey, rootKey, loVel, hiVel;
+        char path[64];
+        char option[16];
+        const int fields = sscanf(line, "%d %d %d %d %d %d %63s %15s", &channel, &loKey, &hiKey, &rootKey, &loVel, &hiVel, path, option);
+        if (fields < 7 || (fields == 8 && strcmp(option, "slices") != 0))
+        {
+            Serial.printf("Kit: skipping malformed line '%s'\n", line);
+            continue;
+        }
+
+        // a sliced file becomes one untransposed zone per key, slice n on loKey + n
+        const bool sliced = fields == 8;
+        for (int key = loKey; key <= (sliced ? hiKey : loKey) && numEntries < load->maxEntries; key++)
+        {
+            const int slot = slotFor(path, sliced ? key - loKey : -1);
+            if (slot < 0)
+            {
+                Serial.printf("Kit: no free sample slot for %s\n", path);
+                break;
+            }
+
+            KitEntry *entry = &entries[numEntries];
+            entry->midiChannel = channel;
+            entry->loKey = sliced ? key : loKey;
+            entry->hiKey = sliced ? key : hiKey;
+            entry->rootKey = sliced ? key : rootKey;
+            entry->loVel = loVel;
+            entry->hiVel = hiVel;
+            entry->sampleNum = load->firstSlot + slot;
+            numEntries++;
+        }
+    }
+    f.close();
+
+    // slots that were playing another kit get to ring out first, all of them against one deadline,
+    // then the ones still sounding fade out together: cutting a voice off mid-sample clicks
+    waitForSilence(load->firstSlot, load->numSlots, BANK_RELEASE_MS);
+    for (uint8_t slot = 0; slot < load->numSlots; slot++)
+    {
+        samplePlayers[load->firstSlot + slot].fadeOut.store(true);
+    }
+    waitForSilence(load->firstSlot, load->numSlots, BANK_FADE_MS);
+
+    for (uint8_t slot = 0; slot < load->numSlots; slot++)
+    {
+        const uint8_t sampleNum = load->firstSlot + slot;
+        if (slot >= numFiles)
+        {
+            releaseSlot(sampleNum);
+            samplePlayers[sampleNum].fadeOut.store(false);
+            continue;
+        }
+
+        // slices of one file all find the buffer the first of them loaded
+        SampleBuffer *buffer = fetchSample(fs, files[slot]);
+        if (buffer == NULL || !installSample(sampleNum, buffer, fileSlices[slot]))
+        {
+            Serial.printf("Kit: could not load %s\n", files[slot]);
+            releaseSlot(sampleNum);
+        }
+        samplePlayers[sampleNum].fadeOut.store(false);
+    }
 
+    Serial.printf("Kit %s: %d zones, %d samples\n", load->kitFile, numEntries, numFiles);
+    load->numEntries = numEntries;
     return true;
 }
 
+bool SamplePlayer::loadBuffer(uint8_t sampleNum, int16_t *buffer, uint32_t numSamples, bool stereo) {
+    if (sampleNum >= NUM_PLAYERS) {
+        Serial.println("Sample number out of bounds.");
+        return false;
+    }
+
+    // the caller's buffer, measured but not trimmed or freed
+    SampleBuffer *shared = sampleStore.add(NULL, 0, buffer, numSamples, stereo, false);
+    if (shared == NULL) {
+        return false;
+    }
+    return installSample(sampleNum, shared);
+}
+
+// The console asks from core 0 while the storage task may swap the slot's buffer. The store's
+// entries never move, so reading one is safe, a copy that overlapped a change is taken again.
+bool SamplePlayer::sampleInfo(uint8_t sampleNum, SampleInfo &info, bool *changing) {
+    if (changing != NULL)
+    {
+        *changing = false;
+    }
+    if (sampleNum >= NUM_PLAYERS)
+    {
+        return false;
+    }
+
+    const Player *slot = &samplePlayers[sampleNum];
+    const uint32_t start = millis();
+    while (true)
+    {
+        const uint32_t changes = slot->changes.load(std::memory_order_acquire);
+        if ((changes & 1) == 0)
+        {
+            if (!slot->enabled)
+            {
+                return false;
+            }
+            // a slice reports its own length and envelope, the rest belongs to the whole buffer
+            const SampleBuffer *buffer = slot->buffer;
+            const uint32_t frames = slot->numSamples / (buffer->stereo ? 2 : 1);
+            const uint32_t firstBlock = slot->firstFrame / ENVELOPE_BLOCK_FRAMES;
+            info.stereo = buffer->stereo;
+            info.frames = frames;
+            info.trimmedFrames = buffer->trimmedFrames;
+            info.peak = buffer->peak;
+            info.rms = buffer->rms;
+            info.envelope = buffer->envelope != NULL ? &buffer->envelope[firstBlock] : NULL;
+            info.envelopeBlocks = buffer->envelope != NULL ? (slot->firstFrame + frames + ENVELOPE_BLOCK_FRAMES - 1) / ENVELOPE_BLOCK_FRAMES - firstBlock : 0;
+            snprintf(info.path, sizeof(info.path), "%s", buffer->path);
+            info.bytes = SampleStore::footprint(buffer);
+            info.sharedBy = buffer->refs;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->changes.load(std::memory_order_relaxed) == changes)
+            {
+                return true;
+            }
+        }
+        // a change waits for up to SLOT_SWAP_TIMEOUT_MS itself
+        if (millis() - start >= 2 * SLOT_SWAP_TIMEOUT_MS)
+        {
+            if (changing != NULL)
+            {
+                *changing = true;
+            }
+            return false;
+        }
+        delay(1);
+    }
+}
+
+uint32_t SamplePlayer::sampleBudget() {
+    return totalSampleStorageLen * sizeof(int16_t);
+}
+
 bool SamplePlayer::setPan(uint8_t sampleNum, uint8_t pan) {
-    if (pan >= 19)
+    if (sampleNum >= NUM_PLAYERS || pan >= PAN_STEPS)
     {
         Serial.println("Invalid pan value");
         return false;
     }
-    samplePlayers[sampleNum].pan = pan;
+    samplePlayers[sampleNum].pan.store(pan, std::memory_order_relaxed);
     return true;
 }
 
 bool SamplePlayer::setVol(uint8_t sampleNum, uint8_t vol) {
-    if (vol >= 16)
+    if (sampleNum >= NUM_PLAYERS || vol > 127)
     {
         Serial.println("Invalid vol value");
         return false;
     }
-    samplePlayers[sampleNum].velocity = (float)vol / 16;
+    samplePlayers[sampleNum].volume.store(vol, std::memory_order_relaxed);
     return true;
 }
 
-bool SamplePlayer::sampleOn(uint8_t sampleNum, uint8_t velocity) {
-    auto *player = &samplePlayers[sampleNum];
-    player->velocity = (float)velocity / 127;
-    if(player->enabled)
+bool SamplePlayer::controlChange(uint8_t midiChannel, uint8_t cc, uint8_t value) {
+    if (midiChannel < 1 || midiChannel > MIDI_CHANNELS || value > 127)
     {
-        if(player->playing)
-        {
-            player->decay_sample = ((float)player->sampleStorage[player->pos]) / ((float)0x8000) * player->velocity;
-            player->pos = 0;
-            return true;
-        }
-        player->playing = true;
+        return false;
+    }
+
+    ControlParams *params = &channelControls[midiChannel - 1];
+    switch (cc)
+    {
+    case MIDI_CC_VOLUME:
+        params->volume.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_PAN:
+        params->pan.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_ATTACK:
+        params->attack.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_DECAY:
+        params->decay.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_DELAY:
+        params->delaySend.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_REVERB:
+        params->reverbSend.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_CUTOFF:
+        params->cutoff.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_RESONANCE:
+        params->resonance.store(value, std::memory_order_relaxed);
+        return true;
+    case MIDI_CC_FILTER:
+        params->filterMode.store((value == 0) ? FILTER_OFF : (value < 43) ? FILTER_LOWPASS : (value < 86) ? FILTER_BANDPASS : FILTER_HIGHPASS,
+                                 std::memory_order_relaxed);
         return true;
     }
     return false;
 }
 
-void SamplePlayer::process(float *signal_l, float *signal_r, const int buffLen) {
+bool SamplePlayer::pitchBend(uint8_t midiChannel, int16_t bend) {
+    if (midiChannel < 1 || midiChannel > MIDI_CHANNELS)
+    {
+        return false;
+    }
+    channelControls[midiChannel - 1].pitchBend.store(bend, std::memory_order_relaxed);
+    return true;
+}
+
+void SamplePlayer::updateChannelState(ChannelState *state, const ControlParams *params) {
+    state->volume = params->volume.load(std::memory_order_relaxed);
+    state->pan = params->pan.load(std::memory_order_relaxed);
+    state->attack = params->attack.load(std::memory_order_relaxed);
+    state->decay = params->decay.load(std::memory_order_relaxed);
+    state->delaySend = params->delaySend.load(std::memory_order_relaxed);
+    state->reverbSend = params->reverbSend.load(std::memory_order_relaxed);
+    state->cutoff = params->cutoff.load(std::memory_order_relaxed);
+    state->resonance = params->resonance.load(std::memory_order_relaxed);
+    state->filterMode = params->filterMode.load(std::memory_order_relaxed);
+    state->pitchBend = params->pitchBend.load(std::memory_order_relaxed);
+
+    state->gain = (float)state->volume / 127;
+    state->delayGain = (float)state->delaySend / 127;
+    state->reverbGain = (float)state->reverbSend / 127;
+    state->filterDamping = 2.0f * (1.0f - FILTER_MAX_RESONANCE * (float)state->resonance / 127);
+    state->bendRatio = exp2f((float)state->pitchBend / 8192.0f * PITCH_BEND_RANGE / 12.0f);
+
+    float attack = (float)state->attack / 127;
+    float attackTime = attack * attack * MAX_ATTACK_TIME;
+    state->attackInc = (state->attack == 0) ? 1.0f : (float)SAMPLE_BUFFER_SIZE / (attackTime * outputRate);
+
+    float decay = (float)state->decay / 126;
+    float decayTime = 0.01f + decay * decay * MAX_DECAY_TIME;
+    state->decayMul = (state->decay == 127) ? 1.0f : powf(0.001f, (float)SAMPLE_BUFFER_SIZE / (decayTime * outputRate));
+}
+
+void SamplePlayer::snapshotControls() {
+    for (int ch = 0; ch < MIDI_CHANNELS; ch++)
+    {
+        const ControlParams *params = &channelControls[ch];
+        ChannelState *state = &channelStates[ch];
+
+        // only pay for the derived values when something actually moved
+        if (params->volume.load(std::memory_order_relaxed) != state->volume ||
+            params->pan.load(std::memory_order_relaxed) != state->pan ||
+            params->attack.load(std::memory_order_relaxed) != state->attack ||
+            params->decay.load(std::memory_order_relaxed) != state->decay ||
+            params->delaySend.load(std::memory_order_relaxed) != state->delaySend ||
+            params->reverbSend.load(std::memory_order_relaxed) != state->reverbSend ||
+            params->cutoff.load(std::memory_order_relaxed) != state->cutoff ||
+            params->resonance.load(std::memory_order_relaxed) != state->resonance ||
+            params->filterMode.load(std::memory_order_relaxed) != state->filterMode ||
+            params->pitchBend.load(std::memory_order_relaxed) != state->pitchBend)
+        {
+            updateChannelState(state, params);
+        }
+    }
+
     for (int i = 0; i < sampleCount; i++)
     {
-        auto *player = &samplePlayers[i];
+        slotStates[i].gain = (float)samplePlayers[i].volume.load(std::memory_order_relaxed) / 127;
+        slotStates[i].pan = samplePlayers[i].pan.load(std::memory_order_relaxed);
+    }
+}
 
-        for (int n = 0; n < buffLen; n++)
+// Upper bound of what the sample still holds from pos on, 0.0 -> 1.0 of full scale
+float SamplePlayer::remainingPeak(const Player *sample, uint32_t pos) {
+    const uint32_t block = pos / (sample->stereo ? 2 : 1) / ENVELOPE_BLOCK_FRAMES;
+    if (sample->tailPeak == NULL || block >= sample->envelopeBlocks)
+    {
+        return 1.0f;
+    }
+    return (float)sample->tailPeak[block] / 32768.0f;
+}
+
+// How loud the voice can still get, for picking the one to steal
+float SamplePlayer::voiceLoudness(const Voice *voice) {
+    float loudness = fabsf(voice->decay_sample);
+    if (voice->playing)
+    {
+        // a fresh voice has no level yet, its velocity bounds it
+        const float gain = (voice->fresh || voice->attacking) ? voice->velocity : voice->level;
+        loudness += gain * remainingPeak(&samplePlayers[voice->sampleNum], voice->pos);
+    }
+    return loudness;
+}
+
+SamplePlayer::Voice* SamplePlayer::allocateVoice() {
+    Voice *quietest = &voices[0];
+    float quietestLoudness = voiceLoudness(quietest);
+    for (int i = 0; i < NUM_VOICES; i++)
+    {
+        if (!voices[i].active)
+        {
+            return &voices[i];
+        }
+        float loudness = voiceLoudness(&voices[i]);
+        if (loudness < quietestLoudness || (loudness == quietestLoudness && voices[i].age < quietest->age))
+        {
+            quietest = &voices[i];
+            quietestLoudness = loudness;
+        }
+    }
+    // Out of voices, steal the one that is least audible, the oldest on a tie
+    voicesStolen.fetch_add(1, std::memory_order_relaxed);
+    TRACE_INSTANT(TRACE_STEAL, quietest->sampleNum, quietest - voices);
+    return quietest;
+}
+
+void SamplePlayer::startVoice(Voice *voice, uint8_t sampleNum, uint8_t velocity, int8_t transpose, uint8_t midiChannel) {
+    if (voice->playing)
+    {
+        // Fade from the current output level instead of jumping to the new start
+        auto *current = &samplePlayers[voice->sampleNum];
+        voice->decay_sample = ((float)current->sampleStorage[voice->pos]) / ((float)0x8000) * voice->level;
+    }
+    else if (!voice->active)
+    {
+        voice->decay_sample = 0.0f;
+    }
+
+    voice->sampleNum = sampleNum;
+    voice->midiChannel = (midiChannel >= 1 && midiChannel <= MIDI_CHANNELS) ? midiChannel - 1 : 0;
+    voice->transpose = transpose;
+    voice->velocity = (float)velocity / 127;
+    voice->baseStep = (transpose == 0) ? 1.0f : exp2f((float)transpose / 12.0f);
+    voice->step = voice->baseStep;
+    voice->frac = 0.0f;
+    voice->pos = 0;
+    voice->age = voiceAge++;
+    voice->attacking = (channelStates[voice->midiChannel].attack != 0);
+    voice->env = voice->attacking ? 0.0f : 1.0f;
+    voice->startDelay = 0;
+    memset(voice->svf_l, 0, sizeof(voice->svf_l));
+    memset(voice->svf_r, 0, sizeof(voice->svf_r));
+    voice->fresh = true;
+    voice->playing = true;
+    voice->active = true;
+    notesStarted.fetch_add(1, std::memory_order_relaxed);
+    TRACE_INSTANT(TRACE_VOICE, sampleNum, voice - voices);
+}
+
+bool SamplePlayer::sampleOn(uint8_t sampleNum, uint8_t velocity, int8_t transpose, uint8_t midiChannel) {
+    return triggerSample(sampleNum, velocity, transpose, midiChannel) != NULL;
+}
+
+SamplePlayer::Voice* SamplePlayer::triggerSample(uint8_t sampleNum, uint8_t velocity, int8_t transpose, uint8_t midiChannel) {
+    if (sampleNum >= NUM_PLAYERS || !samplePlayers[sampleNum].enabled)
+    {
+        return NULL;
+    }
+
+    // A retriggered sample restarts its own voice, other samples and pitches keep ringing
+    Voice *voice = NULL;
+    for (int i = 0; i < NUM_VOICES; i++)
+    {
+        if (voices[i].playing && voices[i].sampleNum == sampleNum && voices[i].transpose == transpose)
+        {
+            voice = &voices[i];
+            notesRetriggered.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+    if (voice == NULL)
+    {
+        voice = allocateVoice();
+    }
+    startVoice(voice, sampleNum, velocity, transpose, midiChannel);
+    return voice;
+}
+
+bool SamplePlayer::voiceOn(uint8_t sampleNum, uint8_t velocity, int8_t transpose, uint8_t midiChannel) {
+    if (sampleNum >= NUM_PLAYERS || !samplePlayers[sampleNum].enabled)
+    {
+        return false;
+    }
+    startVoice(allocateVoice(), sampleNum, velocity, transpose, midiChannel);
+    return true;
+}
+
+bool SamplePlayer::sampleOnAt(uint32_t frame, uint8_t sampleNum, uint8_t velocity, int8_t transpose, uint8_t midiChannel) {
+    if (sampleNum >= NUM_PLAYERS || !samplePlayers[sampleNum].enabled)
+    {
+        return false;
+    }
+
+    uint16_t head = noteQueueHead.load(std::memory_order_relaxed);
+    uint16_t next = (head + 1) & (NOTE_QUEUE_SIZE - 1);
+    if (next == noteQueueTail.load(std::memory_order_acquire))
+    {
+        Serial.println("Note queue full!");
+        notesDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    ScheduledNote *note = &noteQueue[head];
+    note->frame = frame;
+    note->sampleNum = sampleNum;
+    note->velocity = velocity;
+    note->transpose = transpose;
+    note->midiChannel = midiChannel;
+    noteQueueHead.store(next, std::memory_order_release);
+    return true;
+}
+
+uint32_t SamplePlayer::currentFrame() {
+    return frameAt(micros());
+}
+
+uint32_t SamplePlayer::frameAt(uint32_t micros) {
+    uint32_t frame = blockFrame.load(std::memory_order_acquire);
+    // signed, timestamps taken before the current block started land in the past
+    int32_t elapsed = (int32_t)(micros - blockMicros.load(std::memory_order_relaxed));
+    return frame + (int32_t)((int64_t)elapsed * outputRate / 1000000);
+}
+
+uint32_t SamplePlayer::sampleRate() {
+    return outputRate;
+}
+
+uint32_t SamplePlayer::lateEvents() {
+    return lateNotes;
+}
+
+VoiceStats SamplePlayer::voiceStats() {
+    VoiceStats stats;
+    stats.started = notesStarted.load(std::memory_order_relaxed);
+    stats.retriggered = notesRetriggered.load(std::memory_order_relaxed);
+    stats.stolen = voicesStolen.load(std::memory_order_relaxed);
+    stats.dropped = notesDropped.load(std::memory_order_relaxed);
+    stats.retired = voicesRetired.load(std::memory_order_relaxed);
+    stats.blockVoices = activeCount;
+    stats.peakVoices = peakVoices;
+    stats.shed = voicesShed.load(std::memory_order_relaxed);
+    stats.voiceCap = voiceCap;
+    stats.lowestCap = lowestCap;
+    stats.load = lastLoad;
+    stats.peakLoad = peakLoad;
+    stats.fastInterpolation = fastInterpolation;
+    return stats;
+}
+
+void SamplePlayer::dispatchScheduledNotes(const int buffLen) {
+    const uint32_t start = blockFrame.load(std::memory_order_relaxed);
+    uint16_t tail = noteQueueTail.load(std::memory_order_relaxed);
+    const uint16_t head = noteQueueHead.load(std::memory_order_acquire);
+
+    // Take everything queued into the pending list, sorted by frame. MIDI input and
+    // the sequencer schedule with different lookaheads, so the queue is not in time order.
+    while (tail != head && pendingCount < NOTE_QUEUE_SIZE)
+    {
+        const ScheduledNote &note = noteQueue[tail];
+        int i = pendingCount++;
+        while (i > 0 && (int32_t)(pendingNotes[i - 1].frame - note.frame) > 0)
+        {
+            pendingNotes[i] = pendingNotes[i - 1];
+            i--;
+        }
+        pendingNotes[i] = note;
+        tail = (tail + 1) & (NOTE_QUEUE_SIZE - 1);
+    }
+    noteQueueTail.store(tail, std::memory_order_release);
+
+    int due = 0;
+    while (due < pendingCount)
+    {
+        const ScheduledNote *note = &pendingNotes[due];
+        int32_t offset = (int32_t)(note->frame - start);
+        if (offset >= buffLen)
+        {
+            break; // belongs to a later block
+        }
+        if (offset < 0)
+        {
+            lateNotes++;
+            offset = 0;
+        }
+
+        Voice *voice = triggerSample(note->sampleNum, note->velocity, note->transpose, note->midiChannel);
+        if (voice != NULL)
+        {
+            voice->startDelay = offset;
+        }
+        due++;
+    }
+    if (due > 0)
+    {
+        pendingCount -= due;
+        memmove(&pendingNotes[0], &pendingNotes[due], pendingCount * sizeof(ScheduledNote));
+    }
+}
+
+void SamplePlayer::allVoicesOff() {
+    for (int i = 0; i < NUM_VOICES; i++)
+    {
+        voices[i].active = false;
+        voices[i].playing = false;
+        voices[i].decay_sample = 0.0f;
+    }
+    activeCount = 0;
+}
+
+uint8_t SamplePlayer::activeVoices() {
+    uint8_t count = 0;
+    for (int i = 0; i < NUM_VOICES; i++)
+    {
+        if (voices[i].active)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint8_t SamplePlayer::beginBlock(const int buffLen) {
+    rendering.store(true);
+    blockFrame.store(nextBlockFrame, std::memory_order_release);
+    blockMicros.store(micros(), std::memory_order_relaxed);
+    nextBlockFrame += buffLen;
+
+    snapshotControls();
+    dispatchScheduledNotes(buffLen);
+
+    activeCount = 0;
+    for (int i = 0; i < NUM_VOICES; i++)
+    {
+        Voice *voice = &voices[i];
+        if (voice->active && !samplePlayers[voice->sampleNum].enabled)
+        {
+            // the slot is changing buffers, let go of the old one
+            voice->active = false;
+            voice->playing = false;
+            voice->decay_sample = 0.0f;
+        }
+        if (voice->playing && samplePlayers[voice->sampleNum].fadeOut.load(std::memory_order_relaxed))
+        {
+            fadeVoice(voice); // the bank prefetch is about to reuse the slot
+        }
+        if (voice->active)
+        {
+            activeList[activeCount++] = i;
+        }
+    }
+    if (activeCount > peakVoices)
+    {
+        peakVoices = activeCount;
+    }
+    enforceVoiceCap();
+    return activeCount;
+}
+
+// Fade out like a retrigger does, the tail stays active but costs next to nothing
+void SamplePlayer::fadeVoice(Voice *voice) {
+    if (!voice->fresh)
+    {
+        auto *sample = &samplePlayers[voice->sampleNum];
+        voice->decay_sample = ((float)sample->sampleStorage[voice->pos]) / ((float)0x8000) * voice->level;
+    }
+    voice->playing = false;
+    voice->pos = 0;
+    if (voice->decay_sample == 0.0f)
+    {
+        voice->active = false;
+    }
+}
+
+void SamplePlayer::shedVoice(Voice *voice) {
+    fadeVoice(voice);
+    voicesShed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SamplePlayer::enforceVoiceCap() {
+    uint8_t playing = 0;
+    for (int i = 0; i < activeCount; i++)
+    {
+        if (voices[activeList[i]].playing)
+        {
+            playing++;
+        }
+    }
+
+    // least audible first, a new loud note outranks an old quiet one
+    while (playing > voiceCap)
+    {
+        Voice *quietest = NULL;
+        float quietestLoudness = 0.0f;
+        for (int i = 0; i < activeCount; i++)
+        {
+            Voice *voice = &voices[activeList[i]];
+            if (!voice->playing)
+            {
+                continue;
+            }
+            float loudness = voiceLoudness(voice);
+            if (quietest == NULL || loudness < quietestLoudness || (loudness == quietestLoudness && voice->age < quietest->age))
+            {
+                quietest = voice;
+                quietestLoudness = loudness;
+            }
+        }
+        shedVoice(quietest);
+        playing--;
+    }
+}
+
+void SamplePlayer::endBlock(uint32_t renderUs) {
+    const float deadlineUs = 1000000.0f * SAMPLE_BUFFER_SIZE / outputRate;
+    const float load = (float)renderUs / deadlineUs;
+    lastLoad = (load >= 2.55f) ? 255 : (uint8_t)(load * 100.0f);
+    if (lastLoad > peakLoad)
+    {
+        peakLoad = lastLoad;
+    }
+
+    if (load > GOVERNOR_HIGH_LOAD)
+    {
+        calmBlocks = 0;
+        if (!fastInterpolation)
+        {
+            // cheapest step first, nothing stops sounding
+            fastInterpolation = true;
+            return;
+        }
+
+        // cap what played this block down to where the load should land between the thresholds
+        uint8_t playing = 0;
+        for (int i = 0; i < activeCount; i++)
+        {
+            if (voices[activeList[i]].playing)
+            {
+                playing++;
+            }
+        }
+        int cap = (int)(playing * (GOVERNOR_HIGH_LOAD + GOVERNOR_LOW_LOAD) / 2 / load);
+        if (cap >= playing)
+        {
+            cap = playing - 1;
+        }
+        if (cap < GOVERNOR_MIN_VOICES)
+        {
+            cap = GOVERNOR_MIN_VOICES;
+        }
+        if (cap < voiceCap)
+        {
+            voiceCap = cap;
+            if (voiceCap < lowestCap)
+            {
+                lowestCap = voiceCap;
+            }
+        }
+        return;
+    }
+
+    if (load >= GOVERNOR_LOW_LOAD)
+    {
+        calmBlocks = 0; // inside the hysteresis band, hold
+        return;
+    }
+    if (++calmBlocks < GOVERNOR_HOLD_BLOCKS)
+    {
+        return;
+    }
+
+    // back off in the reverse order, the voices come back one at a time
+    calmBlocks = 0;
+    if (voiceCap < NUM_VOICES)
+    {
+        voiceCap++;
+    }
+    else
+    {
+        fastInterpolation = false;
+    }
+}
+
+// Trapezoidal state-variable filter (Simper), stable at any cutoff and resonance
+template <uint8_t mode>
+static void SamplePlayer_Svf(float *buf, float *state, float a1, float a2, float a3, float k, int from, int to)
+{
+    float ic1 = state[0];
+    float ic2 = state[1];
+    for (int n = from; n < to; n++)
+    {
+        const float v0 = buf[n];
+        const float v3 = v0 - ic2;
+        const float v1 = a1 * ic1 + a2 * v3;
+        const float v2 = ic2 + a2 * ic1 + a3 * v3;
+        ic1 = 2.0f * v1 - ic1;
+        ic2 = 2.0f * v2 - ic2;
+        buf[n] = (mode == FILTER_LOWPASS) ? v2 : (mode == FILTER_BANDPASS) ? v1 : v0 - k * v1 - v2;
+    }
+    state[0] = ic1;
+    state[1] = ic2;
+}
+
+// Coefficients once per block from the cutoff table, lower velocities play darker
+void SamplePlayer::filterVoice(Voice *voice, const ChannelState *chan, float *src_l, float *src_r, bool stereo, int from, int to) {
+    float note = (float)chan->cutoff - FILTER_VELOCITY_DEPTH * (1.0f - voice->velocity);
+    note = (note < 0.0f) ? 0.0f : note;
+    const int index = (int)note;
+    const float g = (index >= MIDI_NOTES - 1) ? cutoffLut[MIDI_NOTES - 1]
+                  : cutoffLut[index] + (cutoffLut[index + 1] - cutoffLut[index]) * (note - index);
+    const float k = chan->filterDamping;
+    const float a1 = 1.0f / (1.0f + g * (g + k));
+    const float a2 = g * a1;
+    const float a3 = g * a2;
+
+    switch (chan->filterMode)
+    {
+    case FILTER_LOWPASS:
+        SamplePlayer_Svf<FILTER_LOWPASS>(src_l, voice->svf_l, a1, a2, a3, k, from, to);
+        if (stereo)
+        {
+            SamplePlayer_Svf<FILTER_LOWPASS>(src_r, voice->svf_r, a1, a2, a3, k, from, to);
+        }
+        break;
+    case FILTER_BANDPASS:
+        SamplePlayer_Svf<FILTER_BANDPASS>(src_l, voice->svf_l, a1, a2, a3, k, from, to);
+        if (stereo)
+        {
+            SamplePlayer_Svf<FILTER_BANDPASS>(src_r, voice->svf_r, a1, a2, a3, k, from, to);
+        }
+        break;
+    default:
+        SamplePlayer_Svf<FILTER_HIGHPASS>(src_l, voice->svf_l, a1, a2, a3, k, from, to);
+        if (stereo)
+        {
+            SamplePlayer_Svf<FILTER_HIGHPASS>(src_r, voice->svf_r, a1, a2, a3, k, from, to);
+        }
+        break;
+    }
+}
+
+void SamplePlayer::renderVoice(Voice *voice, float *signal_l, float *signal_r, float *send_delay, float *send_reverb, const int buffLen) {
+    auto *sample = &samplePlayers[voice->sampleNum];
+    const ChannelState *chan = &channelStates[voice->midiChannel];
+    const SlotState *slot = &slotStates[voice->sampleNum];
+    const uint32_t channels = sample->stereo ? 2 : 1;
+
+    int pan = (int)slot->pan + (int)chan->pan - PAN_CENTER;
+    pan = (pan < 0) ? 0 : (pan >= PAN_STEPS) ? PAN_STEPS - 1 : pan;
+    const float pan_l = pan_lut[0][pan];
+    const float pan_r = pan_lut[1][pan];
+    const float volume = voice->velocity * slot->gain * chan->gain;
+    const bool interpolate = !fastInterpolation;
+
+    if (voice->fresh)
+    {
+        voice->gain_l = volume * voice->env * pan_l;
+        voice->gain_r = volume * voice->env * pan_r;
+        voice->send_delay = volume * voice->env * chan->delayGain;
+        voice->send_reverb = volume * voice->env * chan->reverbGain;
+        voice->fresh = false;
+    }
+
+    // Block-rate envelope, the per-sample gain ramp below smooths it
+    if (voice->attacking)
+    {
+        voice->env += chan->attackInc;
+        if (voice->env >= 1.0f)
+        {
+            voice->env = 1.0f;
+            voice->attacking = false;
+        }
+    }
+    else
+    {
+        voice->env *= chan->decayMul;
+    }
+
+    voice->level = volume * voice->env;
+    voice->step = voice->baseStep * chan->bendRatio;
+
+    const int startDelay = voice->startDelay;
+    voice->startDelay = 0;
+
+    // Ramp linearly from last block's gains to this block's targets
+    const float target_l = voice->level * pan_l;
+    const float target_r = voice->level * pan_r;
+    const float inc_l = (target_l - voice->gain_l) / buffLen;
+    const float inc_r = (target_r - voice->gain_r) / buffLen;
+    const float targetDelay = (send_delay != NULL) ? voice->level * chan->delayGain : 0.0f;
+    const float targetReverb = (send_reverb != NULL) ? voice->level * chan->reverbGain : 0.0f;
+
+    // Source frames for the block, silent before the start delay and after the end
+    float src_l[SAMPLE_BUFFER_SIZE];
+    float src_r[SAMPLE_BUFFER_SIZE]; // stereo samples only, mono plays src_l on both sides
+    const bool sounding = voice->playing && startDelay < buffLen;
+    int endFrame = -1;    // frame of the block the sample ran out on
+    float endTail = 0.0f; // fade out from its last frame
+    if (sounding)
+    {
+        Mix_Clear(src_l, startDelay);
+        if (sample->stereo)
+        {
+            Mix_Clear(src_r, startDelay);
+        }
+
+        int n = startDelay;
+        if (voice->step == 1.0f)
+        {
+            const uint32_t framesLeft = (sample->numSamples - voice->pos) / channels;
+            const int count = ((uint32_t)(buffLen - n) < framesLeft) ? buffLen - n : (int)framesLeft;
+            const int16_t *frame = &sample->sampleStorage[voice->pos];
+            Mix_Int16ToFloat(&src_l[n], frame, channels, 1.0f / 0x8000, count);
+            if (sample->stereo)
+            {
+                Mix_Int16ToFloat(&src_r[n], frame + 1, channels, 1.0f / 0x8000, count);
+            }
+            voice->pos += count * channels;
+            n += count;
+        }
+        else
         {
-            float sample_f_l = 0; // Left channel sample
-            float sample_f_r = 0; // Right channel sample
-            
-            if (player->decay_sample != 0.0)
+            // Transposed: interpolate towards the next frame and advance by the pitch ratio
+            while (n < buffLen && voice->pos < sample->numSamples)
             {
-                if (player->decay_sample > AUDIBLE_LIMIT)
+                const int16_t *frame = &sample->sampleStorage[voice->pos];
+                float play_l = ((float)frame[0]) / ((float)0x8000);
+                float play_r = sample->stereo ? ((float)frame[1]) / ((float)0x8000) : play_l;
+                if (interpolate && voice->pos + channels < sample->numSamples)
                 {
-                    player->decay_sample *= 0.99;
-                    sample_f_l += player->decay_sample;
-                    sample_f_r += player->decay_sample; // Apply decay equally to both channels for simplicity
+                    const int16_t *next = frame + channels;
+                    float next_l = ((float)next[0]) / ((float)0x8000);
+                    float next_r = sample->stereo ? ((float)next[1]) / ((float)0x8000) : next_l;
+                    play_l += (next_l - play_l) * voice->frac;
+                    play_r += (next_r - play_r) * voice->frac;
                 }
-                else
+                src_l[n] = play_l;
+                if (sample->stereo)
                 {
-                    player->decay_sample = 0;
+                    src_r[n] = play_r;
                 }
+                voice->frac += voice->step;
+                uint32_t frames = (uint32_t)voice->frac;
+                voice->frac -= frames;
+                voice->pos += frames * channels;
+                n++;
+            }
+        }
+
+        if (voice->pos >= sample->numSamples)
+        {
+            endFrame = n - 1;
+            endTail = (src_l[endFrame] + (sample->stereo ? src_r[endFrame] : src_l[endFrame])) / 2 * voice->level; // Average decay for simplicity
+            voice->playing = false;
+            voice->pos = 0;
+        }
+
+        Mix_Clear(&src_l[n], buffLen - n);
+        if (sample->stereo)
+        {
+            Mix_Clear(&src_r[n], buffLen - n);
+        }
+
+        // a bypassed filter is this one test
+        if (chan->filterMode != FILTER_OFF)
+        {
+            filterVoice(voice, chan, src_l, src_r, sample->stereo, startDelay, n);
+        }
+
+        Mix_MacGain(signal_l, src_l, voice->gain_l, inc_l, buffLen);
+        Mix_MacGain(signal_r, sample->stereo ? src_r : src_l, voice->gain_r, inc_r, buffLen);
+
+        // The sends are mono and post-fader, only voices with a send level pay for them
+        const bool sendsDelay = send_delay != NULL && (voice->send_delay != 0.0f || targetDelay != 0.0f);
+        const bool sendsReverb = send_reverb != NULL && (voice->send_reverb != 0.0f || targetReverb != 0.0f);
+        if (sample->stereo && (sendsDelay || sendsReverb))
+        {
+            for (int n = 0; n < buffLen; n++)
+            {
+                src_l[n] = (src_l[n] + src_r[n]) * 0.5f;
             }
-            
-            if (player->playing)
+        }
+        if (sendsDelay)
+        {
+            Mix_MacGain(send_delay, src_l, voice->send_delay, (targetDelay - voice->send_delay) / buffLen, buffLen);
+        }
+        if (sendsReverb)
+        {
+            Mix_MacGain(send_reverb, src_l, voice->send_reverb, (targetReverb - voice->send_reverb) / buffLen, buffLen);
+        }
+    }
+
+    // Fade out of the retriggered note or of the sample's last frame, from the frame after it
+    float tail = voice->decay_sample;
+    if (tail != 0.0f || endFrame >= 0)
+    {
+        for (int n = 0; n < buffLen; n++)
+        {
+            if (tail != 0.0f)
             {
-                if (player->stereo)
+                if (fabsf(tail) > AUDIBLE_LIMIT)
                 {
-                    // For stereo samples, read two consecutive samples for L and R channels
-                    sample_f_l = ((float)player->sampleStorage[player->pos]) / ((float)0x8000);
-                    sample_f_r = ((float)player->sampleStorage[player->pos + 1]) / ((float)0x8000);
-                    player->pos += 2; // Move to the next pair of samples
+                    tail *= 0.99;
+                    signal_l[n] += tail * pan_l;
+                    signal_r[n] += tail * pan_r; // Apply decay equally to both channels for simplicity
                 }
                 else
                 {
-                    // For mono samples, the same sample is applied to both L and R channels
-                    sample_f_l = sample_f_r = ((float)player->sampleStorage[player->pos]) / ((float)0x8000);
-                    player->pos += 1; // Move to the next sample
+                    tail = 0;
                 }
-
-                sample_f_l *= player->velocity;
-                sample_f_r *= player->velocity;
-                
-                if (player->pos >= player->numSamples * (player->stereo ? 2 : 1))
-                {
-                    player->playing = false;
-                    player->decay_sample = (sample_f_l + sample_f_r) / 2; // Average decay for simplicity
-                    player->pos = 0;
-                }
-                
-                // Apply panning only for mono samples or handle stereo panning differently
-
-                signal_l[n] += sample_f_l * pan_lut[0][player->pan];
-                signal_r[n] += sample_f_r * pan_lut[1][player->pan];
+            }
+            if (n == endFrame)
+            {
+                tail = endTail;
             }
         }
+        voice->decay_sample = tail;
+    }
+
+    voice->gain_l = target_l;
+    voice->gain_r = target_r;
+    voice->send_delay = targetDelay;
+    voice->send_reverb = targetReverb;
+
+    // Nothing left in the sample can be heard at this velocity and envelope, stop reading it.
+    // Volume and pan stay out of it, they can be turned back up while the note rings.
+    if (voice->playing && !voice->attacking &&
+        voice->velocity * voice->env * remainingPeak(sample, voice->pos) < RETIRE_LEVEL)
+    {
+        voice->playing = false;
+        voice->pos = 0;
+        voicesRetired.fetch_add(1, std::memory_order_relaxed);
     }
+
+    if (!voice->playing && voice->decay_sample == 0.0f)
+    {
+        voice->active = false;
+    }
+}
+
+void SamplePlayer::processPartition(uint8_t partition, uint8_t partitions, float *signal_l, float *signal_r, const int buffLen,
+                                    float *send_delay, float *send_reverb) {
+    // Interleave the snapshot so each partition gets an even share of the voices
+    for (int i = partition; i < activeCount; i += partitions)
+    {
+        renderVoice(&voices[activeList[i]], signal_l, signal_r, send_delay, send_reverb, buffLen);
+    }
+}
+
+void SamplePlayer::process(float *signal_l, float *signal_r, const int buffLen, float *send_delay, float *send_reverb) {
+    beginBlock(buffLen);
+    processPartition(0, 1, signal_l, signal_r, buffLen, send_delay, send_reverb);
 }
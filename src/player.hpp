@@ -2,45 +2,312 @@
 #define SAMPLE_PLAYER_HPP
 
 #include <Arduino.h>
+#include <FS.h>
+#include <atomic>
 #include "config.hpp"
+#include "storage.hpp"
+#include "sample_store.hpp"
 
 #define SAMPLE_FOLDER "samples"
 
-// Precomputed panning values, L, R
-const float pan_lut[2][19] = {
-    {1.000, 0.996, 0.985, 0.966, 0.940, 0.906, 0.866, 0.819, 0.766, 0.707, 0.643, 0.574, 0.500, 0.423, 0.342, 0.259, 0.174, 0.087, 0.000},
-    {0.000, 0.087, 0.174, 0.259, 0.342, 0.423, 0.500, 0.574, 0.643, 0.707, 0.766, 0.819, 0.866, 0.906, 0.940, 0.966, 0.985, 0.996, 1.000}
+// Controllers understood by controlChange()
+#define MIDI_CC_VOLUME  7
+#define MIDI_CC_PAN     10
+#define MIDI_CC_RESONANCE 71 // sound controller 2, filter resonance
+#define MIDI_CC_ATTACK  73 // sound controller 4, attack time
+#define MIDI_CC_CUTOFF  74 // sound controller 5, brightness, filter cutoff as a note number
+#define MIDI_CC_DECAY   75 // sound controller 6, decay time, 127 = no decay
+#define MIDI_CC_REVERB  91 // effects 1 depth, send to the reverb bus
+#define MIDI_CC_DELAY   94 // effects 4 depth, send to the delay bus
+#define MIDI_CC_FILTER  80 // general purpose 5, filter mode: 0 off, then low, band and high pass in thirds
+
+// Per-voice state-variable filter, see MIDI_CC_FILTER
+enum FilterMode : uint8_t {
+    FILTER_OFF,
+    FILTER_LOWPASS,
+    FILTER_BANDPASS,
+    FILTER_HIGHPASS
+};
+
+#define PAN_STEPS 128
+#define PAN_CENTER 64
+
+// Equal-power panning values, L, R, filled in by init()
+extern float pan_lut[2][PAN_STEPS];
+
+// One line of a kit file: "channel loKey hiKey rootKey loVel hiVel /samples/file.wav"
+// With "slices" after the file, its cue/smpl slices go onto loKey, loKey + 1 ... hiKey
+// untransposed, each into its own slot playing a range of the one shared buffer.
+struct KitEntry {
+    uint8_t midiChannel; // 1-16, 0 for omni
+    uint8_t loKey;
+    uint8_t hiKey;
+    uint8_t rootKey;
+    uint8_t loVel;
+    uint8_t hiVel;
+    uint8_t sampleNum;
+};
+
+// A kit file load into a range of slots, see SamplePlayer::loadKitAsync()
+struct KitLoad {
+    const char *kitFile;
+    KitEntry *entries;
+    uint16_t maxEntries;
+    uint8_t firstSlot; // the kit's files go into firstSlot.., slots of the range it leaves unused are emptied
+    uint8_t numSlots;
+    uint16_t numEntries; // result, 0 when the kit file could not be read
+    std::atomic<bool> done;
+};
+
+// Load-time analysis of a slot, see SamplePlayer::sampleInfo()
+struct SampleInfo {
+    uint32_t frames;        // after trimming
+    uint32_t trimmedFrames; // inaudible head and tail frames dropped at load
+    bool stereo;
+    float peak;             // 0.0 -> 1.0 of full scale, both channels
+    float rms;
+    const uint16_t *envelope; // peak magnitude per ENVELOPE_BLOCK_FRAMES, int16 steps, only while the slot keeps the buffer
+    uint32_t envelopeBlocks;
+    char path[STORAGE_PATH_LEN]; // file the buffer came from, empty for loadBuffer()
+    uint32_t bytes;         // PSRAM of the whole buffer with its analysis, see SampleStore::footprint()
+    uint16_t sharedBy;      // slots playing the buffer, this one included
+};
+
+// Voice allocation counters since boot, see SamplePlayer::voiceStats()
+struct VoiceStats {
+    uint32_t started;     // notes that got a voice
+    uint32_t retriggered; // restarted their own sample's voice
+    uint32_t stolen;      // took a voice that was still sounding
+    uint32_t dropped;     // scheduled notes lost to a full note queue
+    uint32_t retired;     // stopped early, the rest of the sample was inaudible at the voice's gain
+    uint8_t blockVoices;  // voices rendered in the last block
+    uint8_t peakVoices;
+    // CPU governor, see SamplePlayer::endBlock()
+    uint32_t shed;        // faded out to get under the voice cap
+    uint8_t voiceCap;     // voices allowed to play right now
+    uint8_t lowestCap;
+    uint8_t load;         // render time of the last block, percent of the deadline
+    uint8_t peakLoad;
+    bool fastInterpolation; // transposed voices read the nearest frame instead of interpolating
 };
 
 class SamplePlayer {
 public:
-    SamplePlayer(); // Constructor
+    SamplePlayer(uint32_t sampleRate = SAMPLE_RATE); // output rate, fixed from here on
     ~SamplePlayer(); // Destructor
+    // Loading goes through the storage I/O task. loadWav() and loadKit() wait for it
+    // and are meant for setup, loadWavAsync() returns once the load is queued.
     bool loadWav(uint8_t sampleNum, char* filename);
-    bool setPan(uint8_t sampleNum, uint8_t pan);
-    bool setVol(uint8_t sampleNum, uint8_t vol);
-    bool sampleOn(uint8_t sampleNum, uint8_t velocity);
-    void process(float *signal_l, float *signal_r, const int buffLen);
+    bool loadWavAsync(uint8_t sampleNum, const char* filename);
+    uint16_t loadKit(const char* kitFile, KitEntry *entries, uint16_t maxEntries, uint8_t firstSlot = 0, uint8_t numSlots = NUM_PLAYERS);
+    // Queues the load and returns, load->done is set once the slots play the new kit.
+    // Slots still sounding get up to BANK_RELEASE_MS between them to finish first, then BANK_FADE_MS to fade out.
+    bool loadKitAsync(KitLoad *load);
+    bool loadBuffer(uint8_t sampleNum, int16_t *buffer, uint32_t numSamples, bool stereo);
+    // Parameter setters only post to the control mailbox and are safe from any thread,
+    // the audio thread picks the values up at the next block boundary.
+    bool setPan(uint8_t sampleNum, uint8_t pan); // 0 -> 127, 64 = centre
+    bool setVol(uint8_t sampleNum, uint8_t vol); // 0 -> 127
+    bool controlChange(uint8_t midiChannel, uint8_t cc, uint8_t value);
+    bool pitchBend(uint8_t midiChannel, int16_t bend); // -8192 -> 8191
+    bool sampleOn(uint8_t sampleNum, uint8_t velocity, int8_t transpose = 0, uint8_t midiChannel = 1); // transpose in semitones
+    bool voiceOn(uint8_t sampleNum, uint8_t velocity, int8_t transpose = 0, uint8_t midiChannel = 1); // always starts a new voice
+    // Queue a sampleOn() for an exact output frame, single producer (core 0)
+    bool sampleOnAt(uint32_t frame, uint8_t sampleNum, uint8_t velocity, int8_t transpose = 0, uint8_t midiChannel = 1);
+    uint32_t currentFrame(); // frame clock of the render loop, interpolated between blocks
+    uint32_t frameAt(uint32_t micros); // the same clock at another micros() timestamp
+    static uint32_t sampleRate(); // frames per second of the frame clock
+    uint32_t lateEvents();   // scheduled notes that arrived after their frame
+    void allVoicesOff();
+    uint8_t activeVoices();
+    VoiceStats voiceStats();
+    // A consistent copy of the slot from any thread, retried while a load changes it.
+    // false for an empty slot, or one that stayed mid-change for 2 * SLOT_SWAP_TIMEOUT_MS,
+    // which sets *changing so the two can be told apart.
+    bool sampleInfo(uint8_t sampleNum, SampleInfo &info, bool *changing = NULL);
+    static uint32_t sampleBudget(); // PSRAM bytes free for samples when the player started
+
+    // Block rendering. beginBlock() snapshots the active voices once per block,
+    // then each partition can be rendered on its own core into its own bus.
+    uint8_t beginBlock(const int buffLen = SAMPLE_BUFFER_SIZE);
+    // CPU governor, call after each block with how long rendering it took. Over
+    // GOVERNOR_HIGH_LOAD it first drops to nearest frame reads, then caps the voices
+    // and beginBlock() fades out the least audible ones over the cap. It backs off
+    // one step at a time after GOVERNOR_HOLD_BLOCKS under GOVERNOR_LOW_LOAD.
+    void endBlock(uint32_t renderUs);
+    // send_delay and send_reverb are mono send buses, NULL drops the sends
+    void processPartition(uint8_t partition, uint8_t partitions, float *signal_l, float *signal_r, const int buffLen,
+                          float *send_delay = NULL, float *send_reverb = NULL);
+    void process(float *signal_l, float *signal_r, const int buffLen, float *send_delay = NULL, float *send_reverb = NULL);
     static void init();
 
 private:
     static uint32_t totalSampleStorageLen;
     static uint8_t sampleCount;
+    static uint32_t outputRate;
     struct Player {
-        bool enabled;
-        int32_t pos;
-        float decay;
-        float decay_sample;
-        bool playing;
-        float velocity; // 0.0 -> 1.0
-        uint8_t pan;    // 0, 9, 18 (L, LR, R)
-        char* filename[64];
-        uint32_t numSamples;
+        std::atomic<bool> enabled; // cleared while the slot changes buffers
+        std::atomic<uint32_t> changes; // odd while installSample() or releaseSlot() rewrite the fields below
+        std::atomic<bool> fadeOut; // set before a slot still ringing is reused, beginBlock() fades its voices
+        std::atomic<uint8_t> volume; // 0 -> 127, set by setVol
+        std::atomic<uint8_t> pan;    // 0, 64, 127 (L, LR, R)
+        char filename[64];
+        uint32_t numSamples; // int16 values, both channels for stereo
         int16_t *sampleStorage;
         bool stereo;
+        const uint16_t *tailPeak; // see SampleBuffer
+        uint32_t envelopeBlocks;
+        uint32_t firstFrame; // where the slot's slice starts in the buffer, 0 for the whole buffer
+        SampleBuffer *buffer; // shared, the fields above are copied from it for the render loop
+    };
+
+    struct Voice {
+        bool active;    // playing or still fading out the retrigger tail
+        bool playing;
+        bool fresh;     // no block rendered yet, start at the target gain instead of ramping
+        bool attacking;
+        uint16_t startDelay; // frames into the next block before playback starts
+        uint8_t sampleNum;
+        uint8_t midiChannel; // 0 -> 15
+        int8_t transpose;
+        uint32_t pos;   // index into sampleStorage, steps by 2 for stereo
+        float frac;     // fractional frame position between pos and the next frame
+        float baseStep; // frames per output sample from the transpose, 1.0 at the root key
+        float step;     // baseStep with pitch bend applied, updated per block
+        uint32_t age;   // trigger order, oldest voice gets stolen first
+        float velocity; // 0.0 -> 1.0
+        float env;      // block-rate envelope level
+        float level;    // velocity * volumes * env at the end of the last block
+        float gain_l;   // gains reached at the end of the last block, ramped from here
+        float gain_r;
+        float send_delay; // send gains reached at the end of the last block
+        float send_reverb;
+        float decay_sample;
+        float svf_l[2]; // filter integrator states, zeroed at the start of a note
+        float svf_r[2];
+    };
+
+    // Control mailbox, written lock-free from any thread
+    struct ControlParams {
+        std::atomic<uint8_t> volume;
+        std::atomic<uint8_t> pan;
+        std::atomic<uint8_t> attack;
+        std::atomic<uint8_t> decay;
+        std::atomic<uint8_t> delaySend;
+        std::atomic<uint8_t> reverbSend;
+        std::atomic<uint8_t> cutoff;
+        std::atomic<uint8_t> resonance;
+        std::atomic<uint8_t> filterMode;
+        std::atomic<int16_t> pitchBend;
+    };
+
+    // Snapshot of the mailbox taken by beginBlock(), plus block-rate values derived from it
+    struct ChannelState {
+        uint8_t volume;
+        uint8_t pan;
+        uint8_t attack;
+        uint8_t decay;
+        uint8_t delaySend;
+        uint8_t reverbSend;
+        uint8_t cutoff;
+        uint8_t resonance;
+        uint8_t filterMode; // FilterMode
+        int16_t pitchBend;
+        float gain;
+        float delayGain;  // post-fader send levels
+        float reverbGain;
+        float bendRatio;
+        float attackInc;  // envelope increase per block
+        float decayMul;   // envelope multiplier per block
+        float filterDamping; // 1 / Q
+    };
+
+    struct SlotState {
+        float gain;
+        uint8_t pan;
+    };
+
+    struct ScheduledNote {
+        uint32_t frame;
+        uint8_t sampleNum;
+        uint8_t velocity;
+        int8_t transpose;
+        uint8_t midiChannel;
     };
 
     static Player samplePlayers[NUM_PLAYERS];
+    static Voice voices[NUM_VOICES];
+    static uint8_t activeList[NUM_VOICES];
+    static uint8_t activeCount;
+    static uint32_t voiceAge;
+    static ControlParams channelControls[MIDI_CHANNELS];
+    static ChannelState channelStates[MIDI_CHANNELS];
+    static SlotState slotStates[NUM_PLAYERS];
+    static float cutoffLut[MIDI_NOTES]; // prewarped filter gain per cutoff note number, filled by init()
+
+    // Scheduled notes, single producer / single consumer ring
+    static ScheduledNote noteQueue[NOTE_QUEUE_SIZE];
+    static std::atomic<uint16_t> noteQueueHead;
+    static std::atomic<uint16_t> noteQueueTail;
+    // Consumer side copy of the queue in frame order, the sources schedule with different lookaheads
+    static ScheduledNote pendingNotes[NOTE_QUEUE_SIZE];
+    static uint8_t pendingCount;
+    static std::atomic<uint32_t> blockFrame;
+    static std::atomic<uint32_t> blockMicros;
+    static std::atomic<bool> rendering; // a block has started since boot
+    static uint32_t nextBlockFrame;
+    static uint32_t lateNotes;
+
+    // Voice allocation counters, bumped from both cores
+    static std::atomic<uint32_t> notesStarted;
+    static std::atomic<uint32_t> notesRetriggered;
+    static std::atomic<uint32_t> voicesStolen;
+    static std::atomic<uint32_t> notesDropped;
+    static std::atomic<uint32_t> voicesRetired;
+    static uint8_t peakVoices;
+
+    // Buffers slots let go of while the render loop stalled, see retireBuffer()
+    struct RetiredBuffer {
+        SampleBuffer *buffer;
+        uint32_t frame; // blockFrame when the wait gave up
+    };
+    static RetiredBuffer retired[RETIRED_BUFFERS];
+    static uint8_t retiredCount;
+
+    // CPU governor, audio thread only apart from the stats
+    static uint8_t voiceCap;
+    static uint8_t lowestCap;
+    static bool fastInterpolation;
+    static uint16_t calmBlocks;
+    static uint8_t lastLoad;
+    static uint8_t peakLoad;
+    static std::atomic<uint32_t> voicesShed;
+
+    static SampleBuffer* fetchSample(fs::FS &fs, const char* filename);
+    static bool installSample(uint8_t sampleNum, SampleBuffer *buffer, int16_t slice = -1); // -1 plays the whole buffer
+    static void releaseSlot(uint8_t sampleNum);
+    static bool slotSounding(uint8_t sampleNum);
+    static bool waitForBlocks(uint8_t blocks);
+    static void retireBuffer(SampleBuffer *buffer);
+    static void releaseRetired();
+    static bool wavJob(fs::FS &fs, StorageRequest &request);
+    static void wavLoaded(StorageRequest &request);
+    static void kitLoaded(StorageRequest &request);
+    static bool kitJob(fs::FS &fs, StorageRequest &request);
+    static void waitForSilence(uint8_t firstSlot, uint8_t numSlots, uint32_t timeoutMs);
+    static float remainingPeak(const Player *sample, uint32_t pos);
+    static float voiceLoudness(const Voice *voice);
+    static void fadeVoice(Voice *voice);
+    static void shedVoice(Voice *voice);
+    void enforceVoiceCap();
+    Voice* allocateVoice();
+    Voice* triggerSample(uint8_t sampleNum, uint8_t velocity, int8_t transpose, uint8_t midiChannel);
+    void startVoice(Voice *voice, uint8_t sampleNum, uint8_t velocity, int8_t transpose, uint8_t midiChannel);
+    static void updateChannelState(ChannelState *state, const ControlParams *params);
+    void snapshotControls();
+    void dispatchScheduledNotes(const int buffLen);
+    static void filterVoice(Voice *voice, const ChannelState *chan, float *src_l, float *src_r, bool stereo, int from, int to);
+    void renderVoice(Voice *voice, float *signal_l, float *signal_r, float *send_delay, float *send_reverb, const int buffLen);
 };
 
-#endif // SAMPLE_PLAYER_H
\ No newline at end of file
+#endif // SAMPLE_PLAYER_H
@@ -0,0 +1,188 @@
+#include "recorder.hpp"
+#include "patch_manager.hpp"
+#include "storage.hpp"
+#include "mix_kernels.hpp"
+
+#define WAV_HEADER_SIZE 44
+#define RECORD_FRAME_BYTES (2 * sizeof(int16_t))
+
+Recorder::Recorder() : ring(NULL), ringHead(0), ringTail(0), capturing(false), inCapture(false), request(REQUEST_NONE), dropped(0),
+    sampleRate(SAMPLE_RATE), ditherState(1), chunk(NULL), chunkFill(0), dataBytes(0) {
+    filename[0] = '\0';
+}
+
+bool Recorder::begin(uint32_t sampleRate) {
+    this->sampleRate = sampleRate;
+    // the ring waits for a take, the chunk is small and internal RAM is harder to find later
+    chunk = (int16_t*)heap_caps_malloc(RECORD_CHUNK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (chunk == NULL) {
+        Serial.println("Could not allocate the recording buffers!");
+        return false;
+    }
+
+    storage.setStream(poll, this);
+    return true;
+}
+
+void Recorder::capture(const float *signal_l, const float *signal_r) {
+    // seq_cst against closeTake(): either it sees us in here or we see the take ended
+    inCapture.store(true);
+    if (!capturing.load()) {
+        inCapture.store(false, std::memory_order_release);
+        return;
+    }
+
+    uint32_t head = ringHead.load(std::memory_order_relaxed);
+    if (head - ringTail.load(std::memory_order_acquire) >= RECORD_RING_BLOCKS) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        float *block = &ring[(head % RECORD_RING_BLOCKS) * RECORD_BLOCK_FLOATS];
+        memcpy(block, signal_l, SAMPLE_BUFFER_SIZE * sizeof(float));
+        memcpy(block + SAMPLE_BUFFER_SIZE, signal_r, SAMPLE_BUFFER_SIZE * sizeof(float));
+        ringHead.store(head + 1, std::memory_order_release);
+    }
+    inCapture.store(false, std::memory_order_release);
+}
+
+void Recorder::start() {
+    request.store(REQUEST_START, std::memory_order_relaxed);
+    storage.wake();
+}
+
+void Recorder::stop() {
+    request.store(REQUEST_STOP, std::memory_order_relaxed);
+    storage.wake();
+}
+
+bool Recorder::isRecording() {
+    return capturing.load(std::memory_order_relaxed);
+}
+
+uint32_t Recorder::droppedBlocks() {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+uint32_t Recorder::memoryBytes() {
+    uint32_t total = 0;
+    if (ring != NULL) {
+        total += RECORD_RING_BLOCKS * RECORD_BLOCK_FLOATS * sizeof(float);
+    }
+    if (chunk != NULL) {
+        total += RECORD_CHUNK_SIZE;
+    }
+    return total;
+}
+
+bool Recorder::poll(fs::FS &fs, void *context) {
+    Recorder *recorder = (Recorder*)context;
+
+    uint8_t req = recorder->request.exchange(REQUEST_NONE, std::memory_order_relaxed);
+    if (req == REQUEST_START && !recorder->file) {
+        recorder->openTake(fs);
+    }
+    if (recorder->file && !recorder->drain()) {
+        Serial.println("Recorder: write failed, stopping");
+        req = REQUEST_STOP;
+    }
+    if (req == REQUEST_STOP && recorder->file) {
+        recorder->closeTake();
+    }
+    return (bool)recorder->file;
+}
+
+bool Recorder::openTake(fs::FS &fs) {
+    ring = (float*)ps_malloc(RECORD_RING_BLOCKS * RECORD_BLOCK_FLOATS * sizeof(float));
+    if (ring == NULL) {
+        Serial.printf("Recorder: no %u bytes of PSRAM left for the ring\n", (unsigned)(RECORD_RING_BLOCKS * RECORD_BLOCK_FLOATS * sizeof(float)));
+        return false;
+    }
+
+    PatchManager_NewWavFileName(fs, RECORD_FOLDER, "rec", filename, sizeof(filename));
+    file = fs.open(filename, FILE_WRITE);
+    if (!file || !PatchManager_WriteWavHeader(file, 2, sampleRate, 0)) {
+        Serial.printf("Recorder: could not create %s\n", filename);
+        file.close();
+        free(ring);
+        ring = NULL;
+        return false;
+    }
+
+    chunkFill = 0;
+    dataBytes = 0;
+    dropped.store(0, std::memory_order_relaxed);
+    // the ring is idle while not capturing, start from whatever the audio thread writes next
+    ringTail.store(ringHead.load(std::memory_order_acquire), std::memory_order_release);
+    capturing.store(true);
+    Serial.printf("Recorder: recording to %s, %d ms ring\n", filename,
+        (int)((uint64_t)RECORD_RING_BLOCKS * SAMPLE_BUFFER_SIZE * 1000 / sampleRate));
+    return true;
+}
+
+bool Recorder::flushChunk() {
+    if (chunkFill == 0) {
+        return true;
+    }
+    size_t written = file.write((const uint8_t*)chunk, chunkFill);
+    dataBytes += written;
+    bool ok = (written == chunkFill);
+    chunkFill = 0;
+    return ok;
+}
+
+bool Recorder::drain() {
+    uint32_t tail = ringTail.load(std::memory_order_relaxed);
+    const uint32_t head = ringHead.load(std::memory_order_acquire);
+
+    while (tail != head) {
+        const float *block = &ring[(tail % RECORD_RING_BLOCKS) * RECORD_BLOCK_FLOATS];
+        // same conversion as i2s_write_stereo_samples_buff(), the take matches the DAC data
+        int16_t frames[2 * SAMPLE_BUFFER_SIZE];
+#ifdef OUTPUT_DITHER
+        Mix_InterleaveDither16(frames, block, block + SAMPLE_BUFFER_SIZE, OUTPUT_SCALE_16, &ditherState, SAMPLE_BUFFER_SIZE);
+#else
+        Mix_InterleaveSat16(frames, block, block + SAMPLE_BUFFER_SIZE, OUTPUT_SCALE_16, SAMPLE_BUFFER_SIZE);
+#endif
+
+        const uint8_t *src = (const uint8_t*)frames;
+        uint32_t left = sizeof(frames);
+        while (left > 0) {
+            // fill up to the next chunk boundary of the file, so every write after the first is sector aligned
+            uint32_t room = RECORD_CHUNK_SIZE - (WAV_HEADER_SIZE + dataBytes + chunkFill) % RECORD_CHUNK_SIZE;
+            if (room > RECORD_CHUNK_SIZE - chunkFill) {
+                room = RECORD_CHUNK_SIZE - chunkFill;
+            }
+            uint32_t count = (left < room) ? left : room;
+            memcpy((uint8_t*)chunk + chunkFill, src, count);
+            chunkFill += count;
+            src += count;
+            left -= count;
+
+            if (count == room && !flushChunk()) {
+                ringTail.store(tail + 1, std::memory_order_release);
+                return false;
+            }
+        }
+        tail++;
+        // hand the block back straight away, a long SD write must not keep the ring full
+        ringTail.store(tail, std::memory_order_release);
+    }
+    return true;
+}
+
+void Recorder::closeTake() {
+    capturing.store(false);
+    // a block the audio thread is copying in right now still belongs to the take
+    while (inCapture.load()) {
+        delay(1);
+    }
+    drain();
+    flushChunk();
+    PatchManager_WriteWavHeader(file, 2, sampleRate, dataBytes);
+    file.close();
+    file = File();
+    free(ring);
+    ring = NULL;
+
+    Serial.printf("Recorder: %s, %0.1f s, %d blocks dropped\n", filename,
+        (float)dataBytes / RECORD_FRAME_BYTES / sampleRate, droppedBlocks());
+}
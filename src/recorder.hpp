@@ -0,0 +1,62 @@
+#ifndef Recorder_hpp
+#define Recorder_hpp
+
+#include <Arduino.h>
+#include <FS.h>
+#include <atomic>
+#include "config.hpp"
+
+#define RECORD_BLOCK_FLOATS (2 * SAMPLE_BUFFER_SIZE) // left block then right block
+
+// Records the master bus to a growing WAV on the SD card.
+// The audio thread copies each block into a PSRAM ring, the storage I/O task
+// polls the recorder as its stream, converts the ring and writes it out in
+// sector aligned chunks, then patches the header on stop. The ring only
+// exists while a take runs, in between its PSRAM is free for samples.
+class Recorder {
+public:
+    Recorder();
+    bool begin(uint32_t sampleRate = SAMPLE_RATE); // allocates the write chunk and attaches to storage
+
+    // Audio thread only, never waits: a full ring drops the block
+    void capture(const float *signal_l, const float *signal_r);
+
+    // Any thread, the storage I/O task acts on them once it is done with the current request
+    void start();
+    void stop();
+    bool isRecording();
+    uint32_t droppedBlocks(); // blocks lost to a full ring in the current or last take
+    uint32_t memoryBytes();   // internal RAM chunk, plus the PSRAM ring while a take runs
+
+private:
+    enum Request : uint8_t {
+        REQUEST_NONE,
+        REQUEST_START,
+        REQUEST_STOP
+    };
+
+    float *ring; // RECORD_RING_BLOCKS * RECORD_BLOCK_FLOATS, NULL between takes
+    std::atomic<uint32_t> ringHead; // blocks written, the audio thread owns it
+    std::atomic<uint32_t> ringTail; // blocks converted, the writer owns it
+    std::atomic<bool> capturing;
+    std::atomic<bool> inCapture; // the audio thread is inside capture(), the ring can't go yet
+    std::atomic<uint8_t> request;
+    std::atomic<uint32_t> dropped;
+    uint32_t sampleRate; // written into each take's header
+    uint32_t ditherState; // OUTPUT_DITHER noise, the storage I/O task's own
+
+    // storage I/O task only
+    File file;
+    char filename[64];
+    int16_t *chunk;      // internal RAM, SD writes from PSRAM go through a bounce buffer
+    uint32_t chunkFill;  // bytes
+    uint32_t dataBytes;  // written to the file so far
+
+    static bool poll(fs::FS &fs, void *context);
+    bool openTake(fs::FS &fs);
+    bool drain();
+    bool flushChunk();
+    void closeTake();
+};
+
+#endif /* Recorder_hpp */
@@ -0,0 +1,236 @@
+#include "sample_store.hpp"
+#include <algorithm>
+
+SampleStore sampleStore;
+
+SampleStore::SampleStore() {
+    memset(entries, 0, sizeof(entries));
+}
+
+SampleBuffer* SampleStore::find(const char *path, uint32_t fileSize) {
+    if (path == NULL || path[0] == '\0') {
+        return NULL;
+    }
+    for (int i = 0; i < SAMPLE_STORE_SIZE; i++) {
+        SampleBuffer *buffer = &entries[i];
+        if (buffer->refs > 0 && buffer->fileSize == fileSize && strcmp(buffer->path, path) == 0) {
+            buffer->refs++;
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+SampleBuffer* SampleStore::add(const char *path, uint32_t fileSize, int16_t *data, uint32_t numSamples, bool stereo, bool owned,
+                               const uint32_t *markers, uint16_t numMarkers) {
+    SampleBuffer *buffer = NULL;
+    for (int i = 0; i < SAMPLE_STORE_SIZE && buffer == NULL; i++) {
+        if (entries[i].refs == 0) {
+            buffer = &entries[i];
+        }
+    }
+    if (buffer == NULL) {
+        Serial.println("Sample store full!");
+        return NULL;
+    }
+
+    memset(buffer, 0, sizeof(*buffer));
+    if (path != NULL) {
+        strncpy(buffer->path, path, sizeof(buffer->path) - 1);
+    }
+    buffer->fileSize = fileSize;
+    buffer->owned = owned;
+    buffer->data = data;
+    buffer->numSamples = numSamples;
+    buffer->stereo = stereo;
+    if (numMarkers > 0) {
+        buffer->slices = (uint32_t*)ps_malloc(numMarkers * sizeof(uint32_t));
+        if (buffer->slices != NULL) {
+            memcpy(buffer->slices, markers, numMarkers * sizeof(uint32_t));
+            buffer->numSlices = numMarkers;
+        }
+    }
+    analyze(buffer);
+
+    // the same sound under another name, keep one copy
+    for (int i = 0; i < SAMPLE_STORE_SIZE && owned; i++) {
+        SampleBuffer *other = &entries[i];
+        if (other != buffer && other->refs > 0 && other->owned && other->hash == buffer->hash &&
+            other->numSamples == buffer->numSamples && other->stereo == buffer->stereo &&
+            other->numSlices == buffer->numSlices &&
+            (buffer->numSlices == 0 || memcmp(other->slices, buffer->slices, buffer->numSlices * sizeof(uint32_t)) == 0) &&
+            memcmp(other->data, buffer->data, buffer->numSamples * sizeof(int16_t)) == 0) {
+            Serial.printf("Store: %s has the same content as %s\n", path, other->path);
+            freeBuffer(buffer);
+            other->refs++;
+            return other;
+        }
+    }
+
+    buffer->refs = 1;
+    return buffer;
+}
+
+void SampleStore::release(SampleBuffer *buffer) {
+    if (buffer == NULL || buffer->refs == 0) {
+        return;
+    }
+    if (--buffer->refs == 0) {
+        freeBuffer(buffer);
+    }
+}
+
+void SampleStore::freeBuffer(SampleBuffer *buffer) {
+    if (buffer->owned) {
+        free(buffer->data);
+    }
+    free(buffer->envelope);
+    free(buffer->tailPeak);
+    free(buffer->slices);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+uint16_t SampleStore::buffers() {
+    uint16_t count = 0;
+    for (int i = 0; i < SAMPLE_STORE_SIZE; i++) {
+        if (entries[i].refs > 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint32_t SampleStore::bytes() {
+    uint32_t total = 0;
+    for (int i = 0; i < SAMPLE_STORE_SIZE; i++) {
+        if (entries[i].refs > 0) {
+            total += footprint(&entries[i]);
+        }
+    }
+    return total;
+}
+
+uint32_t SampleStore::footprint(const SampleBuffer *buffer) {
+    uint32_t total = 0;
+    if (buffer->owned) {
+        total += buffer->numSamples * sizeof(int16_t);
+    }
+    total += 2 * buffer->envelopeBlocks * sizeof(uint16_t);
+    total += buffer->numSlices * sizeof(uint32_t);
+    return total;
+}
+
+bool SampleStore::sliceFrames(const SampleBuffer *buffer, uint16_t slice, uint32_t &first, uint32_t &end) {
+    const uint32_t frames = buffer->numSamples / (buffer->stereo ? 2 : 1);
+    if (buffer->numSlices == 0) {
+        first = 0;
+        end = frames;
+        return slice == 0;
+    }
+    if (slice >= buffer->numSlices) {
+        return false;
+    }
+    first = buffer->slices[slice];
+    end = slice + 1 < buffer->numSlices ? buffer->slices[slice + 1] : frames;
+    return true;
+}
+
+uint32_t SampleStore::hashData(const int16_t *data, uint32_t numSamples) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < numSamples * sizeof(int16_t); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Trims inaudible frames off both ends of owned data and measures what is left
+void SampleStore::analyze(SampleBuffer *buffer) {
+    const uint32_t channels = buffer->stereo ? 2 : 1;
+    const uint32_t frames = buffer->numSamples / channels;
+    const int silence = TRIM_SILENCE;
+
+    auto audible = [&](uint32_t frame) {
+        for (uint32_t c = 0; c < channels; c++) {
+            if (abs(buffer->data[frame * channels + c]) > silence) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    uint32_t first = 0;
+    uint32_t last = frames;
+    if (buffer->owned) {
+        while (first < frames && !audible(first)) {
+            first++;
+        }
+        while (last > first && !audible(last - 1)) {
+            last--;
+        }
+        if (last == first && frames > 0) {
+            last = first + 1; // all silence, keep a frame so the slot still plays
+        }
+    }
+
+    if (first > 0 || last < frames) {
+        const uint32_t kept = (last - first) * channels;
+        memmove(buffer->data, &buffer->data[first * channels], kept * sizeof(int16_t));
+        int16_t *shrunk = (int16_t*)heap_caps_realloc(buffer->data, kept * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+        if (shrunk != NULL) {
+            buffer->data = shrunk;
+        }
+        buffer->numSamples = kept;
+    }
+    buffer->trimmedFrames = frames - (last - first);
+
+    // markers move with the head trim, the ones in the trimmed silence fold onto the first kept frame
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < buffer->numSlices; i++) {
+        const uint32_t frame = buffer->slices[i] > first ? buffer->slices[i] - first : 0;
+        if (frame < last - first && (kept == 0 || frame > buffer->slices[kept - 1])) {
+            buffer->slices[kept++] = frame;
+        }
+    }
+    buffer->numSlices = kept;
+    buffer->hash = hashData(buffer->data, buffer->numSamples);
+
+    const uint32_t keptFrames = last - first;
+    buffer->envelopeBlocks = (keptFrames + ENVELOPE_BLOCK_FRAMES - 1) / ENVELOPE_BLOCK_FRAMES;
+    buffer->envelope = (uint16_t*)ps_malloc(buffer->envelopeBlocks * sizeof(uint16_t));
+    buffer->tailPeak = (uint16_t*)ps_malloc(buffer->envelopeBlocks * sizeof(uint16_t));
+    if (buffer->envelope == NULL || buffer->tailPeak == NULL) {
+        free(buffer->envelope);
+        free(buffer->tailPeak);
+        buffer->envelope = NULL;
+        buffer->tailPeak = NULL;
+        buffer->envelopeBlocks = 0;
+    }
+
+    int peak = 0;
+    double sumSquares = 0.0;
+    for (uint32_t block = 0; block * ENVELOPE_BLOCK_FRAMES < keptFrames; block++) {
+        const uint32_t begin = block * ENVELOPE_BLOCK_FRAMES * channels;
+        const uint32_t end = std::min((block + 1) * ENVELOPE_BLOCK_FRAMES, keptFrames) * channels;
+        int blockPeak = 0;
+        for (uint32_t i = begin; i < end; i++) {
+            const int value = buffer->data[i];
+            blockPeak = std::max(blockPeak, abs(value));
+            sumSquares += (double)value * value;
+        }
+        if (buffer->envelope != NULL) {
+            buffer->envelope[block] = (uint16_t)blockPeak;
+        }
+        peak = std::max(peak, blockPeak);
+    }
+
+    // what is left to play from each block on, so a voice can tell when its tail stops mattering
+    uint16_t tail = 0;
+    for (uint32_t block = buffer->envelopeBlocks; block-- > 0;) {
+        tail = std::max(tail, buffer->envelope[block]);
+        buffer->tailPeak[block] = tail;
+    }
+
+    buffer->peak = (float)peak / 32768.0f;
+    buffer->rms = buffer->numSamples ? (float)(sqrt(sumSquares / buffer->numSamples) / 32768.0) : 0.0f;
+}
@@ -0,0 +1,58 @@
+#ifndef SampleStore_hpp
+#define SampleStore_hpp
+
+#include <Arduino.h>
+#include "config.hpp"
+
+#define ENVELOPE_BLOCK_FRAMES SAMPLE_BUFFER_SIZE // one envelope point per render block
+
+// One immutable sample shared by every slot that plays it, with its load-time analysis
+struct SampleBuffer {
+    char path[STORAGE_PATH_LEN]; // empty for buffers handed in by the caller
+    uint32_t fileSize;    // with path, identifies the file without reading it
+    uint32_t hash;        // FNV-1a of the data after trimming
+    uint16_t refs;        // slots holding the buffer, 0 = unused entry
+    bool owned;           // data came from ps_malloc and goes with the buffer
+    int16_t *data;
+    uint32_t numSamples;  // int16 values, both channels for stereo
+    bool stereo;
+    uint32_t trimmedFrames; // inaudible head and tail frames dropped at load
+    float peak;           // 0.0 -> 1.0 of full scale, both channels
+    float rms;
+    uint16_t *envelope;   // peak magnitude per ENVELOPE_BLOCK_FRAMES, int16 steps
+    uint16_t *tailPeak;   // loudest envelope point from each block to the end
+    uint32_t envelopeBlocks;
+    uint32_t *slices;     // start frames of the file's cue/smpl markers, after trimming, ascending
+    uint16_t numSlices;   // each slice runs to the next one or the end, 0 = the whole buffer is one
+};
+
+// Reference counted sample buffers, looked up by file identity before a load
+// and by content after one. Only the storage I/O task changes it, or setup
+// code while nothing is loading, so it needs no locking.
+class SampleStore {
+public:
+    SampleStore();
+    SampleBuffer* find(const char *path, uint32_t fileSize); // adds a reference, NULL when not loaded
+    // Takes data over (or only refers to it when !owned), analyses it and adds a reference.
+    // Identical content already in the store is shared and the new copy freed.
+    // markers are slice start frames into the untrimmed data, copied.
+    SampleBuffer* add(const char *path, uint32_t fileSize, int16_t *data, uint32_t numSamples, bool stereo, bool owned,
+                      const uint32_t *markers = NULL, uint16_t numMarkers = 0);
+    // Frame range of a slice, false when the buffer has no such slice
+    static bool sliceFrames(const SampleBuffer *buffer, uint16_t slice, uint32_t &first, uint32_t &end);
+    void release(SampleBuffer *buffer); // frees the buffer with its last reference
+    uint16_t buffers(); // in use
+    uint32_t bytes();   // PSRAM held by the owned buffers and all analysis data
+    static uint32_t footprint(const SampleBuffer *buffer); // the share of bytes() one buffer holds
+
+private:
+    SampleBuffer entries[SAMPLE_STORE_SIZE];
+
+    static void analyze(SampleBuffer *buffer);
+    static uint32_t hashData(const int16_t *data, uint32_t numSamples);
+    static void freeBuffer(SampleBuffer *buffer);
+};
+
+extern SampleStore sampleStore;
+
+#endif /* SampleStore_hpp */
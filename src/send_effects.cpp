@@ -0,0 +1,189 @@
+#include "send_effects.hpp"
+
+#define Q15(x) ((int32_t)((x) * 32767.0f))
+
+// Freeverb's tunings at 44.1 kHz, scaled to the output rate
+static const uint16_t combTuning[REVERB_COMBS] = {1116, 1188, 1277, 1356};
+static const uint16_t allpassTuning[REVERB_ALLPASSES] = {556, 441};
+#define REVERB_STEREO_SPREAD 23
+
+static inline int16_t saturate16(int32_t x) {
+    return (x > 32767) ? 32767 : (x < -32768) ? -32768 : (int16_t)x;
+}
+
+static inline int32_t toQ15(float x) {
+    return saturate16((int32_t)(x * 32767.0f));
+}
+
+static inline uint16_t scaleLength(uint16_t length, uint32_t sampleRate) {
+    return (uint16_t)((uint32_t)length * sampleRate / 44100);
+}
+
+SendEffects::SendEffects() : lines(NULL), bytes(0), onChip(false), rate(SAMPLE_RATE), delay_l(NULL), delay_r(NULL),
+    delayFrames(0), delayPos(0), delayFilter_l(0), delayFilter_r(0),
+    delayTime(DELAY_TIME_MS), delayFeedback(DELAY_FEEDBACK), reverbSize(REVERB_SIZE), reverbDamping(REVERB_DAMPING) {
+    memset(combs, 0, sizeof(combs));
+    memset(allpass_l, 0, sizeof(allpass_l));
+    memset(allpass_r, 0, sizeof(allpass_r));
+}
+
+SendEffects::~SendEffects() {
+    free(lines); // either heap
+}
+
+bool SendEffects::begin(uint32_t sampleRate) {
+    rate = sampleRate;
+    delayFrames = DELAY_MAX_MS * sampleRate / 1000;
+
+    uint32_t frames = 2 * delayFrames;
+    for (int c = 0; c < REVERB_COMBS; c++) {
+        combs[c].length = scaleLength(combTuning[c], sampleRate);
+        frames += combs[c].length;
+    }
+    for (int a = 0; a < REVERB_ALLPASSES; a++) {
+        allpass_l[a].length = scaleLength(allpassTuning[a], sampleRate);
+        allpass_r[a].length = scaleLength(allpassTuning[a] + REVERB_STEREO_SPREAD, sampleRate);
+        frames += allpass_l[a].length + allpass_r[a].length;
+    }
+    bytes = frames * sizeof(int16_t);
+
+#ifdef EFFECTS_INTERNAL_RAM
+    lines = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    onChip = (lines != NULL);
+    if (lines == NULL) {
+        Serial.printf("Send effects: no %d bytes of internal RAM, using PSRAM\n", (int)bytes);
+    }
+#endif
+    if (lines == NULL) {
+        lines = (int16_t*)ps_malloc(bytes);
+    }
+    if (lines == NULL) {
+        Serial.println("Could not allocate the send effect lines!");
+        return false;
+    }
+    memset(lines, 0, bytes);
+
+    int16_t *next = lines;
+    delay_l = next;
+    next += delayFrames;
+    delay_r = next;
+    next += delayFrames;
+    for (int c = 0; c < REVERB_COMBS; c++) {
+        combs[c].line = next;
+        next += combs[c].length;
+    }
+    for (int a = 0; a < REVERB_ALLPASSES; a++) {
+        allpass_l[a].line = next;
+        next += allpass_l[a].length;
+        allpass_r[a].line = next;
+        next += allpass_r[a].length;
+    }
+
+    Serial.printf("Send effects: %d ms delay and reverb, %d KB in %s\n", DELAY_MAX_MS, (int)(bytes / 1024),
+                  onChip ? "internal RAM" : "PSRAM");
+    return true;
+}
+
+void SendEffects::setDelay(uint16_t timeMs, float feedback) {
+    delayTime.store(timeMs > DELAY_MAX_MS ? DELAY_MAX_MS : timeMs, std::memory_order_relaxed);
+    delayFeedback.store(feedback < 0.0f ? 0.0f : feedback > 0.95f ? 0.95f : feedback, std::memory_order_relaxed);
+}
+
+void SendEffects::setReverb(float size, float damping) {
+    reverbSize.store(size < 0.0f ? 0.0f : size > 1.0f ? 1.0f : size, std::memory_order_relaxed);
+    reverbDamping.store(damping < 0.0f ? 0.0f : damping > 1.0f ? 1.0f : damping, std::memory_order_relaxed);
+}
+
+uint32_t SendEffects::memoryBytes() {
+    return bytes;
+}
+
+bool SendEffects::internalRam() {
+    return onChip;
+}
+
+void SendEffects::process(const float *send_delay, const float *send_reverb, float *signal_l, float *signal_r, const int len) {
+    if (lines == NULL) {
+        return;
+    }
+    processDelay(send_delay, signal_l, signal_r, len);
+    processReverb(send_reverb, signal_l, signal_r, len);
+}
+
+// Ping-pong: the send goes into the left line, each side feeds the other
+// through a damped feedback path, so the repeats alternate sides.
+void SendEffects::processDelay(const float *send, float *signal_l, float *signal_r, const int len) {
+    uint32_t length = delayTime.load(std::memory_order_relaxed) * rate / 1000;
+    if (length < 1) {
+        length = 1;
+    }
+    const int32_t feedback = Q15(delayFeedback.load(std::memory_order_relaxed));
+    const int32_t tone = Q15(1.0f - DELAY_DAMPING);
+    const float wet = DELAY_WET / 32768.0f;
+
+    uint32_t read = (delayPos + delayFrames - length) % delayFrames;
+    for (int n = 0; n < len; n++) {
+        const int32_t out_l = delay_l[read];
+        const int32_t out_r = delay_r[read];
+        delayFilter_l += ((out_l - delayFilter_l) * tone) >> 15;
+        delayFilter_r += ((out_r - delayFilter_r) * tone) >> 15;
+        delay_l[delayPos] = saturate16(toQ15(send[n]) + ((delayFilter_r * feedback) >> 15));
+        delay_r[delayPos] = saturate16((delayFilter_l * feedback) >> 15);
+
+        signal_l[n] += out_l * wet;
+        signal_r[n] += out_r * wet;
+        if (++read == delayFrames) {
+            read = 0;
+        }
+        if (++delayPos == delayFrames) {
+            delayPos = 0;
+        }
+    }
+}
+
+// Schroeder/Moorer: damped combs in parallel on the mono send, the sum
+// decorrelated into left and right by allpass chains of different lengths
+void SendEffects::processReverb(const float *send, float *signal_l, float *signal_r, const int len) {
+    const int32_t feedback = Q15(0.7f + 0.28f * reverbSize.load(std::memory_order_relaxed));
+    const int32_t tone = Q15(1.0f - 0.4f * reverbDamping.load(std::memory_order_relaxed));
+    const float wet = REVERB_WET / 32768.0f;
+
+    for (int n = 0; n < len; n++) {
+        // a quarter into each comb, the four tails sum back to about the send level
+        const int32_t in = toQ15(send[n]) >> 2;
+        int32_t sum = 0;
+        for (int c = 0; c < REVERB_COMBS; c++) {
+            Comb &comb = combs[c];
+            const int32_t y = comb.line[comb.pos];
+            comb.filter += ((y - comb.filter) * tone) >> 15;
+            comb.line[comb.pos] = saturate16(in + ((comb.filter * feedback) >> 15));
+            if (++comb.pos == comb.length) {
+                comb.pos = 0;
+            }
+            sum += y;
+        }
+
+        int32_t out_l = saturate16(sum);
+        int32_t out_r = out_l;
+        for (int a = 0; a < REVERB_ALLPASSES; a++) {
+            Allpass &left = allpass_l[a];
+            const int32_t buf_l = left.line[left.pos];
+            left.line[left.pos] = saturate16(out_l + (buf_l >> 1));
+            out_l = buf_l - out_l;
+            if (++left.pos == left.length) {
+                left.pos = 0;
+            }
+
+            Allpass &right = allpass_r[a];
+            const int32_t buf_r = right.line[right.pos];
+            right.line[right.pos] = saturate16(out_r + (buf_r >> 1));
+            out_r = buf_r - out_r;
+            if (++right.pos == right.length) {
+                right.pos = 0;
+            }
+        }
+
+        signal_l[n] += out_l * wet;
+        signal_r[n] += out_r * wet;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef SendEffects_hpp
+#define SendEffects_hpp
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.hpp"
+
+#define REVERB_COMBS     4
+#define REVERB_ALLPASSES 2 // per side
+
+// Shared delay and reverb on the mono send buses the voices feed, see
+// SamplePlayer::processPartition(). They run once per block whatever the
+// polyphony, in Q15 on int16 lines so the lines fit in internal RAM.
+// The delay is a ping-pong, the reverb four damped combs into two allpasses per side.
+class SendEffects {
+public:
+    SendEffects();
+    ~SendEffects();
+    bool begin(uint32_t sampleRate = SAMPLE_RATE); // allocates the lines, see EFFECTS_INTERNAL_RAM
+
+    // Audio thread, adds the wet returns onto the bus
+    void process(const float *send_delay, const float *send_reverb, float *signal_l, float *signal_r, const int len);
+
+    // Any thread, the audio thread picks them up at the next block
+    void setDelay(uint16_t timeMs, float feedback); // timeMs up to DELAY_MAX_MS, feedback 0.0 -> 0.95
+    void setReverb(float size, float damping);      // 0.0 -> 1.0 each
+
+    uint32_t memoryBytes(); // all delay lines
+    bool internalRam();     // lines ended up in internal RAM
+
+private:
+    struct Comb {
+        int16_t *line;
+        uint16_t length;
+        uint16_t pos;
+        int32_t filter; // one pole lowpass state in the feedback path
+    };
+
+    struct Allpass {
+        int16_t *line;
+        uint16_t length;
+        uint16_t pos;
+    };
+
+    int16_t *lines; // one allocation, carved into the lines below
+    uint32_t bytes;
+    bool onChip;
+    uint32_t rate;
+
+    int16_t *delay_l;
+    int16_t *delay_r;
+    uint32_t delayFrames; // capacity of each side
+    uint32_t delayPos;
+    int32_t delayFilter_l;
+    int32_t delayFilter_r;
+
+    Comb combs[REVERB_COMBS];
+    Allpass allpass_l[REVERB_ALLPASSES];
+    Allpass allpass_r[REVERB_ALLPASSES];
+
+    std::atomic<uint16_t> delayTime;
+    std::atomic<float> delayFeedback;
+    std::atomic<float> reverbSize;
+    std::atomic<float> reverbDamping;
+
+    void processDelay(const float *send, float *signal_l, float *signal_r, const int len);
+    void processReverb(const float *send, float *signal_l, float *signal_r, const int len);
+};
+
+#endif /* SendEffects_hpp */
@@ -0,0 +1,193 @@
+#include "sequencer.hpp"
+
+#define SEQ_LOOKAHEAD_FRAMES     ((uint32_t)SEQ_LOOKAHEAD_MS * player->sampleRate() / 1000)
+#define SEQ_CLOCK_TIMEOUT_FRAMES ((uint32_t)SEQ_CLOCK_TIMEOUT_MS * player->sampleRate() / 1000)
+#define SEQ_CLOCK_SMOOTHING      0.05f // period tracking
+#define SEQ_CLOCK_PHASE_GAIN     0.125f // phase correction per tick
+
+Sequencer::Sequencer(SamplePlayer* player, MidiNoteHandler* midi) : player(player), midi(midi) {
+    memset(tracks, 0, sizeof(tracks));
+    for (int t = 0; t < SEQ_TRACKS; t++) {
+        tracks[t].midiChannel = 1;
+        tracks[t].note = NOTE_BEGIN + t;
+    }
+    length = 16;
+    step = 0;
+    running = false;
+    bpm = SEQ_DEFAULT_BPM;
+    nextStepFrame = 0;
+    nextStepFrac = 0.0f;
+    external = false;
+    ticks = 0;
+    ticksSeen = 0;
+    lastTickFrame = 0;
+    smoothedTick = 0;
+    tickPeriod = 0.0f;
+    jitterCount = 0;
+    jitterSum = 0.0f;
+    jitterSqSum = 0.0f;
+    jitterMax = 0.0f;
+    lastReport = millis();
+}
+
+void Sequencer::setTempo(float newBpm) {
+    if (newBpm < 20.0f || newBpm > 300.0f) {
+        Serial.println("Invalid tempo");
+        return;
+    }
+    bpm = newBpm;
+}
+
+bool Sequencer::setTrack(uint8_t track, uint8_t midiChannel, uint8_t note) {
+    if (track >= SEQ_TRACKS || midiChannel < 1 || midiChannel > MIDI_CHANNELS || note > 127) {
+        Serial.println("Invalid sequencer track");
+        return false;
+    }
+    tracks[track].midiChannel = midiChannel;
+    tracks[track].note = note;
+    return true;
+}
+
+bool Sequencer::setStep(uint8_t track, uint8_t stepNum, uint8_t velocity) {
+    if (track >= SEQ_TRACKS || stepNum >= SEQ_MAX_STEPS || velocity > 127) {
+        Serial.println("Invalid sequencer step");
+        return false;
+    }
+    tracks[track].velocity[stepNum] = velocity;
+    return true;
+}
+
+bool Sequencer::setLength(uint8_t steps) {
+    if (steps == 0 || steps > SEQ_MAX_STEPS) {
+        Serial.println("Invalid pattern length");
+        return false;
+    }
+    length = steps;
+    if (step >= length) {
+        step = 0;
+    }
+    return true;
+}
+
+float Sequencer::stepFrames() {
+    return (float)player->sampleRate() * 60.0f / (bpm * SEQ_STEPS_PER_BEAT);
+}
+
+void Sequencer::start() {
+    step = 0;
+    ticks = 0;
+    resume();
+}
+
+void Sequencer::resume() {
+    nextStepFrame = player->currentFrame() + SEQ_LOOKAHEAD_FRAMES;
+    nextStepFrac = 0.0f;
+    running = true;
+}
+
+void Sequencer::stop() {
+    running = false;
+}
+
+void Sequencer::playStep(uint32_t frame) {
+    for (int t = 0; t < SEQ_TRACKS; t++) {
+        uint8_t velocity = tracks[t].velocity[step];
+        if (velocity > 0) {
+            midi->playNote(tracks[t].midiChannel, tracks[t].note, velocity, frame);
+        }
+    }
+    if (++step >= length) {
+        step = 0;
+    }
+}
+
+void Sequencer::clockTick(uint32_t frame) {
+    if (ticksSeen == 0 || (int32_t)(frame - lastTickFrame) > (int32_t)SEQ_CLOCK_TIMEOUT_FRAMES) {
+        // first tick after silence, nothing to measure against yet
+        smoothedTick = frame;
+        tickPeriod = 0.0f;
+    } else {
+        float interval = (float)(int32_t)(frame - lastTickFrame);
+        if (tickPeriod == 0.0f) {
+            tickPeriod = interval;
+        } else {
+            float deviation = interval - tickPeriod;
+            float deviationUs = fabsf(deviation) * 1000000.0f / player->sampleRate();
+            jitterCount++;
+            jitterSum += deviationUs;
+            jitterSqSum += deviationUs * deviationUs;
+            if (deviationUs > jitterMax) {
+                jitterMax = deviationUs;
+            }
+            tickPeriod += deviation * SEQ_CLOCK_SMOOTHING;
+        }
+
+        // advance the smoothed clock by one period and pull it gently towards the arrival
+        uint32_t predicted = smoothedTick + (uint32_t)(tickPeriod + 0.5f);
+        int32_t error = (int32_t)(frame - predicted);
+        smoothedTick = predicted + (int32_t)(error * SEQ_CLOCK_PHASE_GAIN);
+    }
+    lastTickFrame = frame;
+    ticksSeen++;
+
+    if (!external) {
+        external = true;
+        Serial.println("Sequencer: following midi clock");
+    }
+
+    if (running) {
+        if (ticks % SEQ_TICKS_PER_STEP == 0) {
+            playStep(smoothedTick + SEQ_LOOKAHEAD_FRAMES);
+        }
+        ticks++;
+    }
+}
+
+void Sequencer::update() {
+    uint32_t now = player->currentFrame();
+
+    if (external && (int32_t)(now - lastTickFrame) > (int32_t)SEQ_CLOCK_TIMEOUT_FRAMES) {
+        external = false;
+        ticksSeen = 0;
+        Serial.println("Sequencer: midi clock lost, using internal tempo");
+        if (running) {
+            resume();
+        }
+    }
+
+    if (running && !external) {
+        // queue every step that starts before the lookahead horizon
+        while ((int32_t)(nextStepFrame - (now + SEQ_LOOKAHEAD_FRAMES)) < 0) {
+            playStep(nextStepFrame);
+            nextStepFrac += stepFrames();
+            uint32_t frames = (uint32_t)nextStepFrac;
+            nextStepFrac -= frames;
+            nextStepFrame += frames;
+        }
+    }
+
+    if (millis() - lastReport >= SEQ_REPORT_MS) {
+        lastReport = millis();
+        if (running || external) {
+            report();
+        }
+    }
+}
+
+void Sequencer::report() {
+    if (external && tickPeriod > 0.0f) {
+        float clockBpm = (float)player->sampleRate() * 60.0f / (tickPeriod * 24);
+        if (jitterCount > 0) {
+            Serial.printf("Sequencer: midi clock %0.2f bpm, jitter mean %0.0f us, rms %0.0f us, max %0.0f us over %d ticks\n",
+                clockBpm, jitterSum / jitterCount, sqrtf(jitterSqSum / jitterCount), jitterMax, jitterCount);
+        }
+    } else {
+        Serial.printf("Sequencer: internal %0.2f bpm\n", bpm);
+    }
+    Serial.printf("Sequencer: %d late notes\n", player->lateEvents());
+
+    jitterCount = 0;
+    jitterSum = 0.0f;
+    jitterSqSum = 0.0f;
+    jitterMax = 0.0f;
+}
@@ -0,0 +1,67 @@
+#ifndef SEQUENCER_HPP
+#define SEQUENCER_HPP
+
+#include <Arduino.h>
+#include "config.hpp"
+#include "player.hpp"
+#include "midi_note_handler.hpp"
+
+/*
+ * Pattern sequencer for core 0.
+ * Runs from its own tempo or follows incoming midi clock, and schedules every
+ * step a little ahead on the render frame clock so notes start sample accurate
+ * no matter when the core 0 loop gets to run.
+ */
+class Sequencer {
+public:
+    Sequencer(SamplePlayer* player, MidiNoteHandler* midi);
+    void update(); // call from the core 0 loop
+    void start();  // from the first step
+    void resume(); // from where it stopped
+    void stop();
+    void setTempo(float bpm);
+    bool setTrack(uint8_t track, uint8_t midiChannel, uint8_t note);
+    bool setStep(uint8_t track, uint8_t step, uint8_t velocity); // velocity 0 = rest
+    bool setLength(uint8_t steps);
+    void clockTick(uint32_t frame); // midi clock arrival time on the render frame clock
+    void report();
+
+private:
+    struct Track {
+        uint8_t midiChannel;
+        uint8_t note;
+        uint8_t velocity[SEQ_MAX_STEPS];
+    } tracks[SEQ_TRACKS];
+
+    SamplePlayer* player;
+    MidiNoteHandler* midi;
+
+    uint8_t length;
+    uint8_t step;
+    bool running;
+    float bpm;
+
+    // internal tempo
+    uint32_t nextStepFrame;
+    float nextStepFrac;
+
+    // external clock
+    bool external;
+    uint32_t ticks;        // since the last start
+    uint32_t ticksSeen;
+    uint32_t lastTickFrame;
+    uint32_t smoothedTick; // dejittered tick position
+    float tickPeriod;      // smoothed tick interval in frames
+
+    // jitter of the incoming clock against the smoothed period
+    uint32_t jitterCount;
+    float jitterSum;
+    float jitterSqSum;
+    float jitterMax;
+    uint32_t lastReport;
+
+    void playStep(uint32_t frame);
+    float stepFrames();
+};
+
+#endif // SEQUENCER_HPP
@@ -0,0 +1,250 @@
+#include "storage.hpp"
+#include "patch_manager.hpp"
+#include "trace.hpp"
+
+StorageService storage;
+
+StorageService::StorageService() : queue(NULL), ioTaskHnd(NULL), submitted(0), completed(0),
+    stream(NULL), streamContext(NULL), mounted(false) {
+}
+
+bool StorageService::begin() {
+    queue = xQueueCreate(STORAGE_QUEUE_SIZE, sizeof(StorageRequest));
+    if (queue == NULL) {
+        Serial.println("Could not create the storage queue!");
+        return false;
+    }
+    mount();
+
+    // lowest priority on core 0, everything else there has a deadline and the card has none
+    if (xTaskCreatePinnedToCore(ioTask, "Storage", 8192, this, 1, &ioTaskHnd, 0) != pdPASS) {
+        ioTaskHnd = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool StorageService::mount() {
+    if (!mounted) {
+        mounted = PatchManager_PrepareSdCard();
+    }
+    return mounted;
+}
+
+bool StorageService::submit(const StorageRequest &request) {
+    if (ioTaskHnd == NULL) {
+        StorageRequest inline_request = request;
+        submitted.fetch_add(1, std::memory_order_relaxed);
+        execute(inline_request);
+        return true;
+    }
+
+    if (xQueueSend(queue, &request, 0) != pdPASS) {
+        Serial.printf("Storage: queue full, dropped request for %s\n", request.path);
+        return false;
+    }
+    submitted.fetch_add(1, std::memory_order_relaxed);
+    xTaskNotifyGive(ioTaskHnd);
+    return true;
+}
+
+static StorageRequest Storage_NewRequest(StorageOp op, const char *path, StorageCallback done, void *context) {
+    StorageRequest request;
+    memset(&request, 0, sizeof(request));
+    request.op = op;
+    if (path != NULL) {
+        strncpy(request.path, path, sizeof(request.path) - 1);
+    }
+    request.done = done;
+    request.context = context;
+    return request;
+}
+
+bool StorageService::loadWav(const char *path, uint8_t tag, StorageCallback done, void *context) {
+    StorageRequest request = Storage_NewRequest(STORAGE_LOAD_WAV, path, done, context);
+    request.tag = tag;
+    return submit(request);
+}
+
+bool StorageService::saveWav(const char *path, int16_t *data, uint32_t numSamples, StorageCallback done, void *context) {
+    StorageRequest request = Storage_NewRequest(STORAGE_SAVE_WAV, path, done, context);
+    request.data = data;
+    request.numSamples = numSamples;
+    return submit(request);
+}
+
+bool StorageService::list(const char *dir, StorageEntry *entries, uint16_t maxEntries, StorageCallback done, void *context) {
+    StorageRequest request = Storage_NewRequest(STORAGE_LIST, dir, done, context);
+    request.entries = entries;
+    request.maxEntries = maxEntries;
+    return submit(request);
+}
+
+bool StorageService::catalog(const char *dir, StorageEntry *entries, uint16_t maxEntries, StorageCallback done, void *context) {
+    StorageRequest request = Storage_NewRequest(STORAGE_CATALOG, dir, done, context);
+    request.entries = entries;
+    request.maxEntries = maxEntries;
+    return submit(request);
+}
+
+bool StorageService::run(StorageJob job, StorageCallback done, void *context, const char *path, uint8_t tag) {
+    StorageRequest request = Storage_NewRequest(STORAGE_JOB, path, done, context);
+    request.job = job;
+    request.tag = tag;
+    return submit(request);
+}
+
+void StorageService::wait() {
+    const uint32_t target = submitted.load(std::memory_order_relaxed);
+    while ((int32_t)(completed.load(std::memory_order_acquire) - target) < 0) {
+        delay(1);
+    }
+}
+
+uint32_t StorageService::pending() {
+    return submitted.load(std::memory_order_relaxed) - completed.load(std::memory_order_acquire);
+}
+
+void StorageService::setStream(StorageStream stream, void *context) {
+    streamContext = context;
+    this->stream = stream;
+}
+
+void StorageService::wake() {
+    if (ioTaskHnd != NULL) {
+        xTaskNotifyGive(ioTaskHnd);
+    }
+}
+
+TaskHandle_t StorageService::taskHandle() {
+    return ioTaskHnd;
+}
+
+bool StorageService::pollStream() {
+    if (stream == NULL || !mount()) {
+        return false;
+    }
+    return stream(SD_MMC, streamContext);
+}
+
+void StorageService::ioTask(void *parameter) {
+    StorageService *service = (StorageService*)parameter;
+    bool streaming = false;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, streaming ? STORAGE_POLL_MS / portTICK_PERIOD_MS : portMAX_DELAY);
+
+        // everything queued goes in one batch on the mounted card,
+        // the stream gets its turn between requests so a long load can't starve it
+        streaming = service->pollStream();
+        StorageRequest request;
+        while (xQueueReceive(service->queue, &request, 0) == pdPASS) {
+            service->execute(request);
+            streaming = service->pollStream();
+        }
+    }
+}
+
+void StorageService::execute(StorageRequest &request) {
+    request.ok = false;
+    if (mount()) {
+        switch (request.op) {
+        case STORAGE_LOAD_WAV:
+            request.ok = readWav(SD_MMC, request);
+            break;
+        case STORAGE_SAVE_WAV:
+            request.ok = PatchManager_SaveWavefile(SD_MMC, request.path, request.data, request.numSamples);
+            break;
+        case STORAGE_LIST:
+            request.ok = listWavs(SD_MMC, request, false);
+            break;
+        case STORAGE_CATALOG:
+            request.ok = listWavs(SD_MMC, request, true);
+            break;
+        case STORAGE_JOB:
+            request.ok = request.job(SD_MMC, request);
+            break;
+        }
+    }
+
+    if (request.done != NULL) {
+        request.done(request);
+    }
+    completed.fetch_add(1, std::memory_order_release);
+}
+
+bool StorageService::readWav(fs::FS &fs, StorageRequest &request) {
+    request.data = NULL;
+    request.numSamples = 0;
+    request.numMarkers = 0;
+
+    uint32_t dataSize = PatchManager_WaveSize(fs, request.path);
+    if (dataSize == 0) {
+        return false;
+    }
+    if (dataSize > ESP.getFreePsram()) {
+        Serial.println("Not enough PSRAM memory for sample storage!");
+        return false;
+    }
+
+    int16_t *data = (int16_t*)ps_malloc(dataSize);
+    if (data == NULL) {
+        Serial.println("Could not allocate PSRAM!");
+        return false;
+    }
+
+    const uint32_t start = micros();
+    uint32_t numSamples = PatchManager_LoadWavefileMarkers(fs, request.path, data, dataSize, request.stereo,
+                                                            request.markers, request.numMarkers, request.maxMarkers);
+    TRACE_SPAN(TRACE_SD_READ, 0, 0, start);
+    if (numSamples == 0) {
+        Serial.printf("Error reading WAV file %s\n", request.path);
+        free(data);
+        return false;
+    }
+
+    request.data = data;
+    request.numSamples = numSamples;
+    return true;
+}
+
+bool StorageService::listWavs(fs::FS &fs, StorageRequest &request, bool withFormat) {
+    request.numEntries = 0;
+
+    File root = fs.open(request.path);
+    if (!root || !root.isDirectory()) {
+        Serial.printf("Storage: no directory %s\n", request.path);
+        return false;
+    }
+
+    for (File file = root.openNextFile(); file && request.numEntries < request.maxEntries; file = root.openNextFile()) {
+        const char *name = file.name();
+        size_t len = strlen(name);
+        if (file.isDirectory() || len < 4 || strcmp(&name[len - 4], ".wav") != 0) {
+            continue;
+        }
+
+        StorageEntry *entry = &request.entries[request.numEntries];
+        memset(entry, 0, sizeof(*entry));
+        // older cores return the full path, newer ones only the name
+        int pathLen;
+        if (name[0] == '/') {
+            pathLen = snprintf(entry->name, sizeof(entry->name), "%s", name);
+        } else {
+            pathLen = snprintf(entry->name, sizeof(entry->name), "%s/%s", request.path, name);
+        }
+        if (pathLen < 0 || pathLen >= (int)sizeof(entry->name)) {
+            // a cut path would name another file or none, leave it out
+            Serial.printf("Storage: skipped %s, the path is over %d characters\n", name, STORAGE_PATH_LEN - 1);
+            file.close();
+            continue;
+        }
+        file.close();
+
+        if (withFormat && !PatchManager_WaveInfo(fs, entry->name, entry->channels, entry->sampleRate, entry->dataSize)) {
+            continue;
+        }
+        request.numEntries++;
+    }
+    return true;
+}
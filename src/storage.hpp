@@ -0,0 +1,99 @@
+#ifndef Storage_hpp
+#define Storage_hpp
+
+#include <Arduino.h>
+#include <FS.h>
+#include <atomic>
+#include <freertos/queue.h>
+#include "config.hpp"
+
+enum StorageOp : uint8_t {
+    STORAGE_LOAD_WAV, // path -> data, numSamples, stereo. data is ps_malloc'd, the callback owns it
+    STORAGE_SAVE_WAV, // data, numSamples -> path, mono 16 bit
+    STORAGE_LIST,     // .wav files in the path directory -> entries
+    STORAGE_CATALOG,  // like STORAGE_LIST, plus the format from every header
+    STORAGE_JOB       // job() with the card mounted, for work that spans several files
+};
+
+struct StorageEntry {
+    char name[STORAGE_PATH_LEN]; // full path
+    uint32_t dataSize;   // bytes of sample data, catalog only
+    uint32_t sampleRate; // catalog only
+    uint16_t channels;   // catalog only
+};
+
+struct StorageRequest;
+typedef void (*StorageCallback)(StorageRequest &request);
+typedef bool (*StorageJob)(fs::FS &fs, StorageRequest &request);
+typedef bool (*StorageStream)(fs::FS &fs, void *context); // returns true while it wants polling
+
+// A request is copied into the queue, everything it points to has to outlive it
+struct StorageRequest {
+    StorageOp op;
+    bool ok;               // result, set before done() runs
+    char path[STORAGE_PATH_LEN];
+    uint8_t tag;           // free for the caller, the sample slot for loads
+    int16_t *data;
+    uint32_t numSamples;   // int16 values, both channels for stereo
+    bool stereo;
+    uint32_t *markers;     // caller's array for the cue/smpl frames of a load, NULL skips them
+    uint16_t maxMarkers;
+    uint16_t numMarkers;
+    StorageEntry *entries; // caller's array for list and catalog
+    uint16_t maxEntries;
+    uint16_t numEntries;
+    StorageJob job;
+    StorageCallback done;  // runs on the I/O task, keep it short
+    void *context;
+};
+
+// Owns the SD card. One I/O task on core 0 keeps it mounted and works through
+// a request queue, so the audio and MIDI paths never wait on SD latency.
+// Results come back through the request's done() callback on the I/O task.
+// Until begin() has started the task, requests run on the calling thread,
+// which is what the single threaded host tools rely on.
+class StorageService {
+public:
+    StorageService();
+    bool begin();
+
+    // Queue a request, false when the queue is full. They never touch the card on the calling thread.
+    bool submit(const StorageRequest &request);
+    bool loadWav(const char *path, uint8_t tag, StorageCallback done, void *context = nullptr);
+    bool saveWav(const char *path, int16_t *data, uint32_t numSamples, StorageCallback done = nullptr, void *context = nullptr);
+    bool list(const char *dir, StorageEntry *entries, uint16_t maxEntries, StorageCallback done, void *context = nullptr);
+    bool catalog(const char *dir, StorageEntry *entries, uint16_t maxEntries, StorageCallback done, void *context = nullptr);
+    bool run(StorageJob job, StorageCallback done, void *context = nullptr, const char *path = nullptr, uint8_t tag = 0);
+
+    // Blocks until every request queued so far has completed. Setup code only,
+    // never call it from the audio or MIDI paths.
+    void wait();
+    uint32_t pending();
+
+    // A long running writer polled between requests, see Recorder
+    void setStream(StorageStream stream, void *context);
+    void wake(); // have the stream polled now
+    bool pollStream(); // I/O task, for jobs that wait on something other than the card
+    TaskHandle_t taskHandle(); // the I/O task, NULL before begin()
+
+    // The STORAGE_LOAD_WAV work, for jobs that load several files in one go
+    static bool readWav(fs::FS &fs, StorageRequest &request);
+
+private:
+    QueueHandle_t queue;
+    TaskHandle_t ioTaskHnd;
+    std::atomic<uint32_t> submitted;
+    std::atomic<uint32_t> completed;
+    StorageStream stream;
+    void *streamContext;
+    bool mounted;
+
+    static void ioTask(void *parameter);
+    bool mount();
+    void execute(StorageRequest &request);
+    static bool listWavs(fs::FS &fs, StorageRequest &request, bool withFormat);
+};
+
+extern StorageService storage;
+
+#endif /* Storage_hpp */
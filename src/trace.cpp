@@ -0,0 +1,83 @@
+#include "trace.hpp"
+
+Tracer tracer;
+
+Tracer::Tracer() : head(0), filled(false), recording(true), remaining(-1), dumping(false), dumpNext(0), dumpEnd(0) {
+    for (int i = 0; i < TRACE_EVENTS; i++) {
+        ring[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Tracer::record(TraceType type, uint8_t arg0, uint8_t arg1, uint32_t start, uint32_t duration) {
+    if (!recording.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (remaining.load(std::memory_order_relaxed) >= 0 && remaining.fetch_sub(1, std::memory_order_relaxed) <= 0) {
+        recording.store(false, std::memory_order_release);
+        return;
+    }
+
+    const uint32_t index = head.fetch_add(1, std::memory_order_relaxed);
+    if (index == TRACE_EVENTS - 1) {
+        filled.store(true, std::memory_order_relaxed);
+    }
+    Event *event = &ring[index & (TRACE_EVENTS - 1)];
+    event->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event->start = start;
+    event->duration = duration;
+    event->type = type;
+    event->core = (uint8_t)xPortGetCoreID();
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+    event->seq.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::trigger() {
+    int32_t expected = -1;
+    remaining.compare_exchange_strong(expected, TRACE_POST_EVENTS, std::memory_order_relaxed);
+}
+
+bool Tracer::frozen() {
+    return !recording.load(std::memory_order_acquire);
+}
+
+bool Tracer::nextLine(char *line, size_t len) {
+    if (!dumping) {
+        if (!frozen()) {
+            return false;
+        }
+        dumpEnd = head.load(std::memory_order_acquire);
+        dumpNext = filled.load(std::memory_order_relaxed) ? dumpEnd - TRACE_EVENTS : 0;
+        dumping = true;
+        snprintf(line, len, "TRACE BEGIN %u\n", (unsigned)(dumpEnd - dumpNext));
+        return true;
+    }
+
+    while (dumpNext != dumpEnd) {
+        const uint32_t index = dumpNext++;
+        const Event *event = &ring[index & (TRACE_EVENTS - 1)];
+        // a slot a writer never finished, it was overtaken right at the freeze
+        if (event->seq.load(std::memory_order_acquire) != index + 1 || event->type >= TRACE_TYPES) {
+            continue;
+        }
+        snprintf(line, len, "T %u %u %u %s %u %u\n", (unsigned)event->start, (unsigned)event->duration, event->core,
+                 traceNames[event->type], event->arg0, event->arg1);
+        return true;
+    }
+
+    snprintf(line, len, "TRACE END\n");
+    rearm();
+    return true;
+}
+
+void Tracer::rearm() {
+    dumping = false;
+    for (int i = 0; i < TRACE_EVENTS; i++) {
+        ring[i].seq.store(0, std::memory_order_relaxed);
+    }
+    head.store(0, std::memory_order_relaxed);
+    filled.store(false, std::memory_order_relaxed);
+    remaining.store(-1, std::memory_order_relaxed);
+    recording.store(true, std::memory_order_release);
+}
@@ -0,0 +1,91 @@
+#ifndef Trace_hpp
+#define Trace_hpp
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.hpp"
+
+#if (TRACE_EVENTS & (TRACE_EVENTS - 1)) != 0
+#error "TRACE_EVENTS has to be a power of two"
+#endif
+
+// What a trace event records. Spans carry their start and length, instants a length of 0.
+enum TraceType : uint8_t {
+    TRACE_NOTE,      // instant at arrival, note, velocity
+    TRACE_VOICE,     // instant, sample slot, voice
+    TRACE_STEAL,     // instant, slot of the stolen voice, voice
+    TRACE_RENDER,    // span, core 1 block: render, join and send effects, voices in the block
+    TRACE_PARTITION, // span, core 0 share of a dual core block
+    TRACE_I2S_WAIT,  // span, blocked in i2s_write for DMA room
+    TRACE_XRUN,      // span, the DMA buffers ran dry until the next write
+    TRACE_SD_READ,   // span, reading a WAV off the card
+    TRACE_LOADED,    // instant, a slot plays its new buffer
+    TRACE_TYPES
+};
+
+// Names in the dump, the host tool turns them into the trace's event names
+static const char *const traceNames[TRACE_TYPES] = {
+    "note", "voice", "steal", "render", "partition", "i2s_wait", "xrun", "sd_read", "loaded"
+};
+
+// Fixed size ring of the last TRACE_EVENTS events from both cores.
+// record() is lock-free and safe from any task on either core: a writer claims
+// a slot with one atomic add and publishes it through the slot's sequence number.
+// trigger() keeps TRACE_POST_EVENTS more events and then freezes the ring, so
+// what led up to an xrun and what followed it stay together for the dump.
+// Timestamps are micros(), the esp_timer clock both cores share. The cycle
+// counters are per core and drift apart, they can't order events across cores.
+class Tracer {
+public:
+    Tracer();
+
+    void record(TraceType type, uint8_t arg0, uint8_t arg1, uint32_t start, uint32_t duration);
+    void trigger(); // freeze after TRACE_POST_EVENTS more events, later triggers before the dump are ignored
+    bool frozen();
+
+    // Dump of a frozen ring, one line per call so the caller can pace it:
+    //   TRACE BEGIN <events>
+    //   T <start us> <duration us> <core> <name> <arg0> <arg1>
+    //   TRACE END
+    // Returns false once the dump is done, recording starts over from there.
+    bool nextLine(char *line, size_t len);
+
+private:
+    struct Event {
+        std::atomic<uint32_t> seq; // index + 1 once written, 0 while a writer fills it
+        uint32_t start;
+        uint32_t duration;
+        uint8_t type;
+        uint8_t core;
+        uint8_t arg0;
+        uint8_t arg1;
+    };
+
+    Event ring[TRACE_EVENTS];
+    std::atomic<uint32_t> head;      // events claimed since the last dump, wraps
+    std::atomic<bool> filled;        // head went round the ring at least once
+    std::atomic<bool> recording;
+    std::atomic<int32_t> remaining;  // events kept after a trigger, -1 when not triggered
+
+    // dump state, the dumping task's own
+    bool dumping;
+    uint32_t dumpNext;
+    uint32_t dumpEnd;
+
+    void rearm();
+};
+
+extern Tracer tracer;
+
+// Trace points compile away without EVENT_TRACE
+#ifdef EVENT_TRACE
+#define TRACE_SPAN(type, arg0, arg1, start) tracer.record((type), (arg0), (arg1), (start), micros() - (start))
+#define TRACE_INSTANT(type, arg0, arg1) tracer.record((type), (arg0), (arg1), micros(), 0)
+#define TRACE_INSTANT_AT(type, arg0, arg1, time) tracer.record((type), (arg0), (arg1), (time), 0)
+#else
+#define TRACE_SPAN(type, arg0, arg1, start) do {} while (0)
+#define TRACE_INSTANT(type, arg0, arg1) do {} while (0)
+#define TRACE_INSTANT_AT(type, arg0, arg1, time) do {} while (0)
+#endif
+
+#endif /* Trace_hpp */
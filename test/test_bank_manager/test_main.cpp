@@ -0,0 +1,192 @@
+/*
+ * Program change banks: bank 0 at boot with bank 1 prefetched into the
+ * other half of the slots, switches swap the zones, files common to both
+ * banks load once, a missing bank leaves the playing one alone. A prefetch
+ * over slots that keep ringing waits once for all of them, and a take
+ * recording meanwhile keeps being written.
+ *
+ * On the host the storage requests run on the calling thread, so every
+ * prefetch has finished by the time select() looks at it.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <SD_MMC.h>
+#include <unity.h>
+#include "midi_receiver.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "config.hpp"
+#include "player.hpp"
+#include "midi_note_handler.hpp"
+#include "bank_manager.hpp"
+#include "sample_store.hpp"
+#include "recorder.hpp"
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+static SamplePlayer *player;
+static MidiNoteHandler *handler;
+static BankManager *banks;
+
+static bool plays(uint8_t note)
+{
+    return handler->playNote(1, note, 100, player->currentFrame());
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_boots_bank_zero_with_one_prefetched(void)
+{
+    TEST_ASSERT_TRUE(banks->begin());
+    banks->update(); /* the core 0 loop */
+    TEST_ASSERT_EQUAL(0, banks->activeBank());
+    TEST_ASSERT_EQUAL(1, banks->shadowBank());
+    TEST_ASSERT_TRUE(banks->shadowReady());
+    TEST_ASSERT_TRUE(plays(36));
+    TEST_ASSERT_FALSE(plays(38));
+}
+
+void test_switch_swaps_zones_and_shares_files(void)
+{
+    banks->select(1);
+    banks->update();
+    TEST_ASSERT_EQUAL(1, banks->activeBank());
+    TEST_ASSERT_TRUE(plays(36));
+    TEST_ASSERT_TRUE(plays(38));
+    /* mono.wav is in both banks and in the store once */
+    TEST_ASSERT_EQUAL(2, sampleStore.buffers());
+
+    SampleInfo info;
+    TEST_ASSERT_TRUE(player->sampleInfo(BANK_SLOTS, info));
+    TEST_ASSERT_FALSE(info.stereo);
+    TEST_ASSERT_TRUE(player->sampleInfo(BANK_SLOTS + 1, info));
+    TEST_ASSERT_TRUE(info.stereo);
+}
+
+void test_missing_bank_keeps_playing_one(void)
+{
+    /* there is no 2.txt, the prefetch after the switch to 1 already found that */
+    TEST_ASSERT_EQUAL(BANK_NONE, banks->shadowBank());
+    banks->select(2);
+    TEST_ASSERT_EQUAL(1, banks->activeBank());
+    TEST_ASSERT_TRUE(plays(38));
+}
+
+void test_unprefetched_bank_loads_then_switches(void)
+{
+    banks->select(3);
+    banks->update();
+    TEST_ASSERT_EQUAL(3, banks->activeBank());
+    TEST_ASSERT_TRUE(plays(40));
+    TEST_ASSERT_FALSE(plays(36));
+    /* bank 3 went into the half bank 0 had, its unused slot was emptied */
+    SampleInfo info;
+    TEST_ASSERT_TRUE(player->sampleInfo(0, info));
+    TEST_ASSERT_TRUE(info.stereo);
+    TEST_ASSERT_FALSE(player->sampleInfo(1, info));
+}
+
+void test_program_change_from_midi(void)
+{
+    handler->setBanks(banks);
+    uint8_t programChange[] = {0xC0, 0x00};
+    midiIn.receive(programChange, sizeof(programChange), micros());
+    handler->update();
+    banks->update();
+    TEST_ASSERT_EQUAL(0, banks->activeBank());
+    TEST_ASSERT_TRUE(plays(36));
+    TEST_ASSERT_FALSE(plays(40));
+}
+
+void test_prefetch_over_ringing_slots(void)
+{
+    /* two seconds at full level, longer than BANK_RELEASE_MS, in every slot of the other half */
+    static int16_t longSample[2 * SAMPLE_RATE];
+    for (uint32_t i = 0; i < sizeof(longSample) / sizeof(longSample[0]); i++)
+    {
+        longSample[i] = (i & 1) ? 16000 : -16000;
+    }
+    for (int slot = BANK_SLOTS; slot < 2 * BANK_SLOTS; slot++)
+    {
+        TEST_ASSERT_TRUE(player->loadBuffer(slot, longSample, sizeof(longSample) / sizeof(longSample[0]), false));
+    }
+
+    Recorder recorder;
+    TEST_ASSERT_TRUE(recorder.begin());
+
+    /* the audio task, in real time so the slots ring as long as they would on the device */
+    std::atomic<bool> stop(false);
+    std::thread audio([&]() {
+        static float out_l[SAMPLE_BUFFER_SIZE];
+        static float out_r[SAMPLE_BUFFER_SIZE];
+        const auto blockTime = std::chrono::microseconds(1000000LL * SAMPLE_BUFFER_SIZE / SAMPLE_RATE);
+        auto next = std::chrono::steady_clock::now();
+        while (!stop.load())
+        {
+            memset(out_l, 0, sizeof(out_l));
+            memset(out_r, 0, sizeof(out_r));
+            player->process(out_l, out_r, SAMPLE_BUFFER_SIZE);
+            recorder.capture(out_l, out_r);
+            next += blockTime;
+            std::this_thread::sleep_until(next);
+        }
+    });
+    for (int slot = BANK_SLOTS; slot < 2 * BANK_SLOTS; slot++)
+    {
+        TEST_ASSERT_TRUE(player->sampleOn(slot, 127));
+    }
+    recorder.start();
+
+    KitEntry entries[8];
+    const uint32_t start = millis();
+    const uint16_t numEntries = player->loadKit("/banks/1.txt", entries, 8, BANK_SLOTS, BANK_SLOTS);
+    const uint32_t elapsed = millis() - start;
+    const bool recording = recorder.isRecording();
+    stop.store(true);
+    audio.join();
+
+    /* the job polled the stream while it waited, the take started and kept up */
+    TEST_ASSERT_EQUAL(2, numEntries);
+    TEST_ASSERT_TRUE(recording);
+    recorder.stop();
+    storage.pollStream();
+    TEST_ASSERT_FALSE(recorder.isRecording());
+    TEST_ASSERT_EQUAL_UINT32(0, recorder.droppedBlocks());
+
+    /* one deadline for the whole half, not one per slot */
+    TEST_ASSERT_TRUE(elapsed >= BANK_RELEASE_MS);
+    TEST_ASSERT_TRUE(elapsed < BANK_RELEASE_MS + BANK_FADE_MS + 500);
+    TEST_ASSERT_EQUAL_UINT8(0, player->activeVoices());
+
+    SD_MMC.remove("/recordings/rec000.wav");
+    SD_MMC.rmdir("/recordings");
+}
+
+int main(int argc, char **argv)
+{
+    SD_MMC.setRoot(TEST_DATA_DIR "/fixtures");
+    player = new SamplePlayer();
+    handler = new MidiNoteHandler(player);
+    banks = new BankManager(player, handler);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_boots_bank_zero_with_one_prefetched);
+    RUN_TEST(test_switch_swaps_zones_and_shares_files);
+    RUN_TEST(test_missing_bank_keeps_playing_one);
+    RUN_TEST(test_unprefetched_bank_loads_then_switches);
+    RUN_TEST(test_program_change_from_midi);
+    RUN_TEST(test_prefetch_over_ringing_slots);
+    return UNITY_END();
+}
@@ -0,0 +1,188 @@
+/*
+ * Serial console: command parsing, line assembly from single characters,
+ * and the memory accounting it reports, slot footprints adding up to the
+ * sample store and the heap numbers staying consistent, and slot reads
+ * that never mix two buffers while another thread swaps them.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <SD_MMC.h>
+#include <unity.h>
+
+#include <atomic>
+#include <thread>
+
+#include "console.hpp"
+#include "player.hpp"
+#include "sample_store.hpp"
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+static SamplePlayer *player;
+
+/* feeds a whole string, returns how many lines ran as commands */
+static int feed(Console &console, const char *text)
+{
+    int ran = 0;
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        ran += console.input(*c) ? 1 : 0;
+    }
+    return ran;
+}
+
+void setUp(void)
+{
+    SD_MMC.setRoot(TEST_DATA_DIR);
+    if (player == NULL)
+    {
+        player = new SamplePlayer();
+    }
+}
+
+void tearDown(void)
+{
+}
+
+void test_commands(void)
+{
+    Console console(player);
+    console.watchTask("test", NULL);
+    console.addRegion("region", 1234);
+
+    TEST_ASSERT_TRUE(console.run("m"));
+    TEST_ASSERT_TRUE(console.run("  s "));
+    TEST_ASSERT_TRUE(console.run("s 3"));
+    TEST_ASSERT_TRUE(console.run("s 999")); /* answered with the valid range */
+    TEST_ASSERT_TRUE(console.run("k"));
+    TEST_ASSERT_TRUE(console.run("h"));
+
+    TEST_ASSERT_FALSE(console.run(""));
+    TEST_ASSERT_FALSE(console.run("x"));
+    TEST_ASSERT_FALSE(console.run("mx"));
+    TEST_ASSERT_FALSE(console.run("s 3x"));
+}
+
+void test_line_input(void)
+{
+    Console console(player);
+    TEST_ASSERT_EQUAL(1, feed(console, "m\r\n"));      /* CR LF runs once */
+    TEST_ASSERT_EQUAL(2, feed(console, "k\nh\n"));
+    TEST_ASSERT_EQUAL(0, feed(console, "q\n"));        /* unknown */
+    TEST_ASSERT_EQUAL(0, feed(console, "m"));          /* not ended yet */
+    TEST_ASSERT_EQUAL(1, feed(console, "\n"));
+
+    /* an overlong line is dropped whole, not run cut short */
+    char longLine[CONSOLE_LINE_LEN + 8];
+    memset(longLine, ' ', sizeof(longLine) - 3);
+    longLine[sizeof(longLine) - 3] = 'm';
+    longLine[sizeof(longLine) - 2] = '\n';
+    longLine[sizeof(longLine) - 1] = '\0';
+    TEST_ASSERT_EQUAL(0, feed(console, longLine));
+    TEST_ASSERT_EQUAL(1, feed(console, "m\n"));
+}
+
+void test_slot_footprint(void)
+{
+    const uint32_t before = sampleStore.bytes();
+    TEST_ASSERT_TRUE(player->loadWav(0, (char *)"/fixtures/mono.wav"));
+    TEST_ASSERT_TRUE(player->loadWav(1, (char *)"/fixtures/mono.wav"));
+    TEST_ASSERT_TRUE(player->loadWav(2, (char *)"/fixtures/stereo.wav"));
+
+    SampleInfo mono0, mono1, stereo;
+    TEST_ASSERT_TRUE(player->sampleInfo(0, mono0));
+    TEST_ASSERT_TRUE(player->sampleInfo(1, mono1));
+    TEST_ASSERT_TRUE(player->sampleInfo(2, stereo));
+    TEST_ASSERT_EQUAL_STRING("/fixtures/mono.wav", mono0.path);
+    TEST_ASSERT_EQUAL_UINT16(2, mono0.sharedBy);
+    TEST_ASSERT_EQUAL_UINT16(1, stereo.sharedBy);
+    TEST_ASSERT_EQUAL_UINT32(mono0.bytes, mono1.bytes);
+    TEST_ASSERT_TRUE(mono0.bytes >= mono0.frames * sizeof(int16_t));
+    TEST_ASSERT_TRUE(stereo.bytes >= 2 * stereo.frames * sizeof(int16_t));
+
+    /* the shared buffer counts once in the store */
+    TEST_ASSERT_EQUAL_UINT32(before + mono0.bytes + stereo.bytes, sampleStore.bytes());
+    TEST_ASSERT_TRUE(SamplePlayer::sampleBudget() > sampleStore.bytes());
+}
+
+void test_slot_info_during_swaps(void)
+{
+    /* told apart by their shape, a torn read pairs one's channels with the other's length */
+    static int16_t mono[1000];
+    static int16_t stereo[2 * 600];
+    for (int i = 0; i < 1000; i++)
+    {
+        mono[i] = (int16_t)(i * 31 + 100);
+    }
+    for (int i = 0; i < 2 * 600; i++)
+    {
+        stereo[i] = (int16_t)(i * 17 + 100);
+    }
+
+    TEST_ASSERT_TRUE(player->loadBuffer(5, mono, 1000, false));
+    std::atomic<bool> done(false);
+    std::thread swapper([&]() {
+        for (int i = 1; !done.load(); i++)
+        {
+            player->loadBuffer(5, (i & 1) ? stereo : mono, (i & 1) ? 2 * 600 : 1000, (i & 1) != 0);
+        }
+    });
+
+    int torn = 0;
+    int empty = 0;
+    for (int reads = 0; reads < 2000;)
+    {
+        SampleInfo info;
+        bool changing;
+        if (player->sampleInfo(5, info, &changing))
+        {
+            torn += info.frames != (info.stereo ? 600u : 1000u) ? 1 : 0;
+            reads++;
+        }
+        else
+        {
+            /* a slot that never stops changing is busy, not empty */
+            empty += changing ? 0 : 1;
+        }
+    }
+    done.store(true);
+    swapper.join();
+    TEST_ASSERT_EQUAL(0, torn);
+    TEST_ASSERT_EQUAL(0, empty);
+
+    SampleInfo info;
+    bool changing = true;
+    TEST_ASSERT_FALSE(player->sampleInfo(6, info, &changing));
+    TEST_ASSERT_FALSE(changing);
+}
+
+void test_heap_stats(void)
+{
+    HeapStats psram, internal;
+    Console::heapStats(MALLOC_CAP_SPIRAM, psram);
+    Console::heapStats(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, internal);
+
+    TEST_ASSERT_EQUAL_UINT32(HOST_PSRAM_SIZE, psram.total);
+    TEST_ASSERT_EQUAL_UINT32(HOST_INTERNAL_HEAP_SIZE, internal.total);
+    for (const HeapStats *stats : {&psram, &internal})
+    {
+        TEST_ASSERT_TRUE(stats->largestBlock <= stats->free);
+        TEST_ASSERT_TRUE(stats->lowestFree <= stats->total);
+        TEST_ASSERT_TRUE(stats->fragmentation <= 100);
+    }
+    TEST_ASSERT_EQUAL_UINT8(0, psram.fragmentation); /* the host heap is never in pieces */
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_commands);
+    RUN_TEST(test_line_input);
+    RUN_TEST(test_slot_footprint);
+    RUN_TEST(test_slot_info_during_swaps);
+    RUN_TEST(test_heap_stats);
+    return UNITY_END();
+}
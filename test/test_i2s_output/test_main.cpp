@@ -0,0 +1,99 @@
+/*
+ * Float to I2S conversion in i2s_write_stereo_samples_buff,
+ * checked on the bytes that reach i2s_write. Built with the
+ * default 16 bit slots and no OUTPUT_DITHER.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "config.hpp"
+#include "i2s_interface.hpp"
+
+static int16_t written[SAMPLE_BUFFER_SIZE * 2];
+static size_t writtenBytes;
+
+static void captureI2s(const void *data, size_t size)
+{
+    memcpy(written, data, size < sizeof(written) ? size : sizeof(written));
+    writtenBytes = size;
+}
+
+void setUp(void)
+{
+    memset(written, 0, sizeof(written));
+    writtenBytes = 0;
+    HostI2s_SetSink(captureI2s);
+}
+
+void tearDown(void)
+{
+}
+
+void test_interleaves_one_block(void)
+{
+    float fl_sample[SAMPLE_BUFFER_SIZE];
+    float fr_sample[SAMPLE_BUFFER_SIZE];
+    for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+    {
+        fl_sample[n] = (float)n / SAMPLE_BUFFER_SIZE;
+        fr_sample[n] = -(float)n / SAMPLE_BUFFER_SIZE;
+    }
+
+    TEST_ASSERT_TRUE(i2s_write_stereo_samples_buff(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE));
+    TEST_ASSERT_EQUAL(SAMPLE_BUFFER_SIZE * 4, writtenBytes);
+    for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+    {
+        TEST_ASSERT_EQUAL_INT16((int16_t)lroundf(fl_sample[n] * 32767.0f), written[2 * n]);
+        TEST_ASSERT_EQUAL_INT16((int16_t)lroundf(fr_sample[n] * 32767.0f), written[2 * n + 1]);
+    }
+}
+
+void test_full_scale(void)
+{
+    float fl_sample[2] = {1.0f, -1.0f};
+    float fr_sample[2] = {0.5f, 0.0f};
+
+    i2s_write_stereo_samples_buff(fl_sample, fr_sample, 2);
+    TEST_ASSERT_EQUAL_INT16(32767, written[0]);
+    TEST_ASSERT_EQUAL_INT16(16384, written[1]);
+    TEST_ASSERT_EQUAL_INT16(-32767, written[2]);
+    TEST_ASSERT_EQUAL_INT16(0, written[3]);
+}
+
+void test_hot_mix_clips(void)
+{
+    /* past 1.0 the output clips instead of wrapping around */
+    float fl_sample[2] = {1.99f, -1.99f};
+    float fr_sample[2] = {1.0001f, -1.5f};
+
+    i2s_write_stereo_samples_buff(fl_sample, fr_sample, 2);
+    TEST_ASSERT_EQUAL_INT16(32767, written[0]);
+    TEST_ASSERT_EQUAL_INT16(32767, written[1]);
+    TEST_ASSERT_EQUAL_INT16(-32768, written[2]);
+    TEST_ASSERT_EQUAL_INT16(-32768, written[3]);
+}
+
+void test_rounds_symmetrically(void)
+{
+    /* no dead zone around zero, the same step either side */
+    float fl_sample[2] = {0.6f / 32767.0f, -0.6f / 32767.0f};
+    float fr_sample[2] = {0.4f / 32767.0f, -0.4f / 32767.0f};
+
+    i2s_write_stereo_samples_buff(fl_sample, fr_sample, 2);
+    TEST_ASSERT_EQUAL_INT16(1, written[0]);
+    TEST_ASSERT_EQUAL_INT16(0, written[1]);
+    TEST_ASSERT_EQUAL_INT16(-1, written[2]);
+    TEST_ASSERT_EQUAL_INT16(0, written[3]);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_interleaves_one_block);
+    RUN_TEST(test_full_scale);
+    RUN_TEST(test_hot_mix_clips);
+    RUN_TEST(test_rounds_symmetrically);
+    return UNITY_END();
+}
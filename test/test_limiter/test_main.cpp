@@ -0,0 +1,122 @@
+/*
+ * Master limiter: quiet mixes pass untouched after the lookahead delay, hot
+ * mixes never leave it above the ceiling, not even on the first frame of a peak.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "config.hpp"
+#include "limiter.hpp"
+
+#define TEST_BLOCKS 64
+#define TEST_LEN    (TEST_BLOCKS * SAMPLE_BUFFER_SIZE)
+
+static float input_l[TEST_LEN];
+static float input_r[TEST_LEN];
+static float bus_l[TEST_LEN];
+static float bus_r[TEST_LEN];
+
+/* one block at a time, like audio_task() */
+static void runLimiter(Limiter &limiter, int blocks)
+{
+    memcpy(bus_l, input_l, sizeof(bus_l));
+    memcpy(bus_r, input_r, sizeof(bus_r));
+    for (int b = 0; b < blocks; b++)
+    {
+        limiter.process(&bus_l[b * SAMPLE_BUFFER_SIZE], &bus_r[b * SAMPLE_BUFFER_SIZE], SAMPLE_BUFFER_SIZE);
+    }
+}
+
+static void fillSine(float amplitude, int from, int to)
+{
+    for (int n = from; n < to; n++)
+    {
+        input_l[n] = amplitude * sinf(2.0f * (float)M_PI * 440.0f * n / SAMPLE_RATE);
+        input_r[n] = -0.5f * input_l[n];
+    }
+}
+
+void setUp(void)
+{
+    memset(input_l, 0, sizeof(input_l));
+    memset(input_r, 0, sizeof(input_r));
+}
+
+void tearDown(void)
+{
+}
+
+void test_quiet_mix_passes_delayed(void)
+{
+    fillSine(0.9f, 0, TEST_LEN);
+    Limiter limiter;
+    runLimiter(limiter, TEST_BLOCKS);
+
+    for (int n = 0; n < LIMITER_DELAY_FRAMES; n++)
+    {
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, bus_l[n]);
+    }
+    for (int n = LIMITER_DELAY_FRAMES; n < TEST_LEN; n++)
+    {
+        TEST_ASSERT_EQUAL_FLOAT(input_l[n - LIMITER_DELAY_FRAMES], bus_l[n]);
+        TEST_ASSERT_EQUAL_FLOAT(input_r[n - LIMITER_DELAY_FRAMES], bus_r[n]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, limiter.limitedBlocks());
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, limiter.gain());
+}
+
+void test_hot_mix_stays_under_ceiling(void)
+{
+    /* silence, then a burst 12 dB over full scale that starts on a peak */
+    const int onset = 3 * SAMPLE_BUFFER_SIZE + 5;
+    for (int n = onset; n < TEST_LEN; n++)
+    {
+        input_l[n] = (n % 7 == 0) ? 4.0f : 2.0f * sinf(0.05f * (n - onset) + 1.5f);
+        input_r[n] = -input_l[n];
+    }
+    Limiter limiter;
+    runLimiter(limiter, TEST_BLOCKS);
+
+    float peak = 0.0f;
+    for (int n = 0; n < TEST_LEN; n++)
+    {
+        peak = fmaxf(peak, fmaxf(fabsf(bus_l[n]), fabsf(bus_r[n])));
+    }
+    TEST_ASSERT_TRUE(peak <= LIMITER_CEILING * 1.0001f);
+    TEST_ASSERT_TRUE(peak > 0.9f * LIMITER_CEILING);
+    TEST_ASSERT_TRUE(limiter.limitedBlocks() > 0);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, LIMITER_CEILING / 4.0f, limiter.deepestGain());
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, limiter.deepestGain()); /* read resets it */
+}
+
+void test_gain_recovers_after_burst(void)
+{
+    fillSine(3.0f, 0, 4 * SAMPLE_BUFFER_SIZE);
+    Limiter limiter;
+    runLimiter(limiter, 4);
+    TEST_ASSERT_TRUE(limiter.gain() < 0.5f);
+
+    /* then quiet, the gain climbs back with the release time constant */
+    const int recoveryBlocks = 5 * LIMITER_RELEASE_MS * SAMPLE_RATE / 1000 / SAMPLE_BUFFER_SIZE;
+    float last = limiter.gain();
+    for (int b = 0; b < recoveryBlocks; b++)
+    {
+        fillSine(0.5f, 0, SAMPLE_BUFFER_SIZE);
+        limiter.process(input_l, input_r, SAMPLE_BUFFER_SIZE);
+        TEST_ASSERT_TRUE(limiter.gain() >= last);
+        last = limiter.gain();
+    }
+    /* five time constants */
+    TEST_ASSERT_TRUE(limiter.gain() > 0.99f);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_quiet_mix_passes_delayed);
+    RUN_TEST(test_hot_mix_stays_under_ceiling);
+    RUN_TEST(test_gain_recovers_after_burst);
+    return UNITY_END();
+}
@@ -0,0 +1,121 @@
+/*
+ * Zone lookup: a note picks the velocity layer its velocity falls in, the
+ * alternates of a layer take turns, and every alternate plays transposed
+ * from its own root key.
+ *
+ * Which slot a note played is told from the block it renders, compared
+ * with the block a direct sampleOn() of that slot renders.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "config.hpp"
+#include "player.hpp"
+#include "midi_note_handler.hpp"
+
+#define TEST_FRAMES 4096
+#define TEST_SLOTS  3
+
+static SamplePlayer *player;
+static MidiNoteHandler *handler;
+static int16_t samples[TEST_SLOTS][TEST_FRAMES];
+
+/* one block from a silent player with only the given note started */
+static void renderNote(uint8_t note, uint8_t velocity, float *out_l)
+{
+    static float out_r[SAMPLE_BUFFER_SIZE];
+    player->allVoicesOff();
+    TEST_ASSERT_TRUE(handler->playNote(1, note, velocity, player->currentFrame()));
+    memset(out_l, 0, SAMPLE_BUFFER_SIZE * sizeof(float));
+    memset(out_r, 0, sizeof(out_r));
+    player->process(out_l, out_r, SAMPLE_BUFFER_SIZE);
+}
+
+static void renderSlot(uint8_t slot, uint8_t velocity, int8_t transpose, float *out_l)
+{
+    static float out_r[SAMPLE_BUFFER_SIZE];
+    player->allVoicesOff();
+    TEST_ASSERT_TRUE(player->sampleOn(slot, velocity, transpose));
+    memset(out_l, 0, SAMPLE_BUFFER_SIZE * sizeof(float));
+    memset(out_r, 0, sizeof(out_r));
+    player->process(out_l, out_r, SAMPLE_BUFFER_SIZE);
+}
+
+static void assertPlays(uint8_t note, uint8_t velocity, uint8_t slot, int8_t transpose)
+{
+    float played[SAMPLE_BUFFER_SIZE];
+    float expected[SAMPLE_BUFFER_SIZE];
+    renderNote(note, velocity, played);
+    renderSlot(slot, velocity, transpose, expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, played, sizeof(played));
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_slots_render_apart(void)
+{
+    /* the comparison only means something if the slots and the pitches differ */
+    float a[SAMPLE_BUFFER_SIZE], b[SAMPLE_BUFFER_SIZE];
+    renderSlot(0, 100, 0, a);
+    renderSlot(1, 100, 0, b);
+    TEST_ASSERT_TRUE(memcmp(a, b, sizeof(a)) != 0);
+    renderSlot(1, 100, 2, b);
+    renderSlot(1, 100, -2, a);
+    TEST_ASSERT_TRUE(memcmp(a, b, sizeof(a)) != 0);
+}
+
+void test_velocity_picks_the_layer(void)
+{
+    TEST_ASSERT_EQUAL_UINT8(0, handler->addZone(1, 0, 60, 72, 60, 1, 63));
+    TEST_ASSERT_EQUAL_UINT8(0, handler->addZone(1, 1, 60, 72, 60, 64, 127));
+
+    assertPlays(62, 1, 0, 2);
+    assertPlays(62, 63, 0, 2);
+    assertPlays(62, 64, 1, 2);
+    assertPlays(62, 127, 1, 2);
+    /* a layer with one sample plays it every time */
+    assertPlays(60, 40, 0, 0);
+    assertPlays(60, 40, 0, 0);
+    TEST_ASSERT_FALSE(handler->playNote(1, 59, 100, player->currentFrame()));
+}
+
+void test_alternates_take_turns_with_their_own_root(void)
+{
+    /* a second sample on the loud layer's range, recorded a major third higher */
+    TEST_ASSERT_EQUAL_UINT8(0, handler->addZone(1, 2, 60, 72, 64, 64, 127));
+
+    assertPlays(62, 100, 1, 2);
+    assertPlays(62, 100, 2, -2);
+    assertPlays(66, 100, 1, 6);
+    assertPlays(66, 100, 2, 2);
+    /* the soft layer keeps its own turn */
+    assertPlays(62, 40, 0, 2);
+}
+
+int main(int argc, char **argv)
+{
+    player = new SamplePlayer();
+    handler = new MidiNoteHandler(player);
+    for (int slot = 0; slot < TEST_SLOTS; slot++)
+    {
+        for (int i = 0; i < TEST_FRAMES; i++)
+        {
+            samples[slot][i] = (int16_t)((i * (slot + 3) * 97) % 20000 - 10000);
+        }
+        player->loadBuffer(slot, samples[slot], TEST_FRAMES, false);
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_slots_render_apart);
+    RUN_TEST(test_velocity_picks_the_layer);
+    RUN_TEST(test_alternates_take_turns_with_their_own_root);
+    return UNITY_END();
+}
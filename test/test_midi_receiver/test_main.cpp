@@ -0,0 +1,137 @@
+/*
+ * MidiReceiver byte ring and running status parser
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "midi_receiver.hpp"
+
+static MidiReceiver *receiver;
+
+static void feed(const uint8_t *data, size_t len, uint32_t lastByteMicros)
+{
+    receiver->receive(data, len, lastByteMicros);
+}
+
+void setUp(void)
+{
+    receiver = new MidiReceiver();
+}
+
+void tearDown(void)
+{
+    delete receiver;
+}
+
+void test_note_on_with_timestamp(void)
+{
+    const uint8_t bytes[] = {0x92, 60, 100};
+    feed(bytes, sizeof(bytes), 10000);
+
+    MidiEvent event;
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0x92, event.status);
+    TEST_ASSERT_EQUAL_UINT8(60, event.data1);
+    TEST_ASSERT_EQUAL_UINT8(100, event.data2);
+    TEST_ASSERT_EQUAL_UINT32(10000, event.micros);
+    TEST_ASSERT_FALSE(receiver->read(event));
+}
+
+void test_running_status(void)
+{
+    const uint8_t bytes[] = {0x90, 60, 100, 62, 90, 60, 0};
+    feed(bytes, sizeof(bytes), 20000);
+
+    MidiEvent event;
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(60, event.data1);
+    TEST_ASSERT_EQUAL_UINT32(20000 - 4 * MIDI_BYTE_MICROS, event.micros);
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0x90, event.status);
+    TEST_ASSERT_EQUAL_UINT8(62, event.data1);
+    TEST_ASSERT_EQUAL_UINT8(90, event.data2);
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0x80, event.status); // velocity 0 is a note off
+    TEST_ASSERT_EQUAL_UINT32(20000, event.micros);
+    TEST_ASSERT_FALSE(receiver->read(event));
+}
+
+void test_realtime_inside_message(void)
+{
+    const uint8_t bytes[] = {0xB0, 7, 0xF8, 100, 10, 0xFA, 64};
+    feed(bytes, sizeof(bytes), 5000);
+
+    MidiEvent event;
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0xF8, event.status);
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0xB0, event.status);
+    TEST_ASSERT_EQUAL_UINT8(7, event.data1);
+    TEST_ASSERT_EQUAL_UINT8(100, event.data2);
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0xFA, event.status);
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0xB0, event.status); // running status survived both realtime bytes
+    TEST_ASSERT_EQUAL_UINT8(10, event.data1);
+    TEST_ASSERT_EQUAL_UINT8(64, event.data2);
+}
+
+void test_partial_message_waits(void)
+{
+    const uint8_t first[] = {0xE1, 0x00};
+    const uint8_t second[] = {0x40};
+    MidiEvent event;
+
+    feed(first, sizeof(first), 1000);
+    TEST_ASSERT_FALSE(receiver->read(event));
+    feed(second, sizeof(second), 1320);
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0xE1, event.status);
+    TEST_ASSERT_EQUAL_UINT8(0x00, event.data1);
+    TEST_ASSERT_EQUAL_UINT8(0x40, event.data2);
+    TEST_ASSERT_EQUAL_UINT32(1320, event.micros);
+}
+
+void test_sysex_and_program_change(void)
+{
+    const uint8_t bytes[] = {0xF0, 0x7E, 0x01, 0x02, 0xF7, 0x33, 0xC5, 12, 13};
+    feed(bytes, sizeof(bytes), 0);
+
+    MidiEvent event;
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(0xC5, event.status);
+    TEST_ASSERT_EQUAL_UINT8(12, event.data1);
+    TEST_ASSERT_TRUE(receiver->read(event));
+    TEST_ASSERT_EQUAL_UINT8(13, event.data1); // one data byte per program change
+    TEST_ASSERT_FALSE(receiver->read(event));
+}
+
+void test_overrun_counts_lost_bytes(void)
+{
+    uint8_t bytes[MIDI_RX_RING_SIZE + 10];
+    memset(bytes, 0xF8, sizeof(bytes));
+    feed(bytes, sizeof(bytes), 0);
+
+    TEST_ASSERT_EQUAL_UINT32(11, receiver->overruns()); // one slot stays free
+    MidiEvent event;
+    int events = 0;
+    while (receiver->read(event))
+    {
+        events++;
+    }
+    TEST_ASSERT_EQUAL(MIDI_RX_RING_SIZE - 1, events);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_note_on_with_timestamp);
+    RUN_TEST(test_running_status);
+    RUN_TEST(test_realtime_inside_message);
+    RUN_TEST(test_partial_message_waits);
+    RUN_TEST(test_sysex_and_program_change);
+    RUN_TEST(test_overrun_counts_lost_bytes);
+    return UNITY_END();
+}
@@ -0,0 +1,182 @@
+/*
+ * Mix kernels: the ESP-DSP backend against the scalar reference, on the host
+ * through the esp_dsp.h stand-in, on the target through the library.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "config.hpp"
+#include "mix_kernels.hpp"
+
+/* longer than a block, the DSP backend works through a block sized scratch */
+#define KERNEL_LEN (2 * SAMPLE_BUFFER_SIZE + 5)
+
+static const int lengths[] = {1, 7, SAMPLE_BUFFER_SIZE, KERNEL_LEN};
+static const float ramps[] = {0.0f, 0.5f / SAMPLE_BUFFER_SIZE, -0.25f / SAMPLE_BUFFER_SIZE};
+
+static float left[KERNEL_LEN];
+static float right[KERNEL_LEN];
+static float scalarOut[KERNEL_LEN];
+static float dspOut[KERNEL_LEN];
+
+void setUp(void)
+{
+    srand(42);
+    for (int n = 0; n < KERNEL_LEN; n++)
+    {
+        left[n] = (float)(rand() % 20001 - 10000) / 5000.0f; /* -2.0 -> 2.0, past full scale */
+        right[n] = (float)(rand() % 20001 - 10000) / 5000.0f;
+        scalarOut[n] = dspOut[n] = (float)(rand() % 2001 - 1000) / 1000.0f;
+    }
+}
+
+void tearDown(void)
+{
+}
+
+void test_clear(void)
+{
+    MixScalar_Clear(scalarOut, 7);
+    for (int n = 0; n < 7; n++)
+    {
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, scalarOut[n]);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(dspOut[7], scalarOut[7]);
+}
+
+void test_int16_to_float(void)
+{
+    int16_t interleaved[2 * KERNEL_LEN];
+    for (int n = 0; n < 2 * KERNEL_LEN; n++)
+    {
+        interleaved[n] = (int16_t)(n * 517 - 32768);
+    }
+
+    MixScalar_Int16ToFloat(scalarOut, &interleaved[1], 2, 1.0f / 0x8000, KERNEL_LEN);
+    for (int n = 0; n < KERNEL_LEN; n++)
+    {
+        /* the scale is a power of two, exact like the division it replaces */
+        TEST_ASSERT_EQUAL_FLOAT((float)interleaved[2 * n + 1] / (float)0x8000, scalarOut[n]);
+    }
+}
+
+void test_mac_gain_backends_match(void)
+{
+    for (int len : lengths)
+    {
+        for (float inc : ramps)
+        {
+            setUp();
+            MixScalar_MacGain(scalarOut, left, 0.7f, inc, len);
+            MixDsp_MacGain(dspOut, left, 0.7f, inc, len);
+            for (int n = 0; n < KERNEL_LEN; n++)
+            {
+                TEST_ASSERT_FLOAT_WITHIN(1e-6f, scalarOut[n], dspOut[n]);
+            }
+        }
+    }
+}
+
+void test_mac_gain_ramps_before_each_frame(void)
+{
+    float dst[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    const float src[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    MixScalar_MacGain(dst, src, 0.0f, 0.25f, 4);
+    TEST_ASSERT_EQUAL_FLOAT(0.25f, dst[0]);
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, dst[3]);
+}
+
+void test_interleave_backends_match(void)
+{
+    int16_t scalarPcm[2 * KERNEL_LEN];
+    int16_t dspPcm[2 * KERNEL_LEN];
+    for (int len : lengths)
+    {
+        memset(scalarPcm, 0x55, sizeof(scalarPcm));
+        memset(dspPcm, 0x55, sizeof(dspPcm));
+        MixScalar_InterleaveSat16(scalarPcm, left, right, 32767.0f, len);
+        MixDsp_InterleaveSat16(dspPcm, left, right, 32767.0f, len);
+        TEST_ASSERT_EQUAL_INT16_ARRAY(scalarPcm, dspPcm, 2 * KERNEL_LEN);
+    }
+}
+
+void test_interleave_saturates(void)
+{
+    const float l[3] = {0.5f, 2.0f, -2.0f};
+    const float r[3] = {-0.5f, 1.0f, -1.0f};
+    int16_t pcm[6];
+    MixScalar_InterleaveSat16(pcm, l, r, 32767.0f, 3);
+    TEST_ASSERT_EQUAL_INT16(16384, pcm[0]);
+    TEST_ASSERT_EQUAL_INT16(-16384, pcm[1]);
+    TEST_ASSERT_EQUAL_INT16(32767, pcm[2]);
+    TEST_ASSERT_EQUAL_INT16(32767, pcm[3]);
+    TEST_ASSERT_EQUAL_INT16(-32768, pcm[4]);
+    TEST_ASSERT_EQUAL_INT16(-32767, pcm[5]);
+}
+
+void test_interleave32_backends_match(void)
+{
+    int32_t scalarPcm[2 * KERNEL_LEN];
+    int32_t dspPcm[2 * KERNEL_LEN];
+    for (int len : lengths)
+    {
+        memset(scalarPcm, 0x55, sizeof(scalarPcm));
+        memset(dspPcm, 0x55, sizeof(dspPcm));
+        MixScalar_InterleaveSat32(scalarPcm, left, right, OUTPUT_SCALE_32, len);
+        MixDsp_InterleaveSat32(dspPcm, left, right, OUTPUT_SCALE_32, len);
+        TEST_ASSERT_EQUAL_MEMORY(scalarPcm, dspPcm, sizeof(scalarPcm));
+    }
+
+    const float l[2] = {2.0f, -0.5f};
+    const float r[2] = {-2.0f, 1.0f};
+    int32_t pcm[4];
+    MixScalar_InterleaveSat32(pcm, l, r, OUTPUT_SCALE_32, 2);
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, pcm[0]);
+    TEST_ASSERT_EQUAL_INT32(INT32_MIN, pcm[1]);
+    TEST_ASSERT_EQUAL_INT32(-1073741824, pcm[2]);
+    TEST_ASSERT_EQUAL_INT32(INT32_MAX, pcm[3]);
+}
+
+void test_dither_is_triangular_and_unbiased(void)
+{
+    /* a constant a third of an LSB above zero, dither spreads it over -1, 0, 1, 2 */
+    float l[SAMPLE_BUFFER_SIZE];
+    float r[SAMPLE_BUFFER_SIZE];
+    for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+    {
+        l[n] = r[n] = (1.0f / 3.0f) / 32767.0f;
+    }
+
+    uint32_t state = 0;
+    int16_t pcm[2 * SAMPLE_BUFFER_SIZE];
+    int64_t sum = 0;
+    int count = 0;
+    for (int b = 0; b < 512; b++)
+    {
+        MixScalar_InterleaveDither16(pcm, l, r, 32767.0f, &state, SAMPLE_BUFFER_SIZE);
+        for (int n = 0; n < 2 * SAMPLE_BUFFER_SIZE; n++)
+        {
+            TEST_ASSERT_TRUE(pcm[n] >= -1 && pcm[n] <= 2);
+            sum += pcm[n];
+            count++;
+        }
+    }
+    /* the average keeps the sub-LSB level that plain rounding loses */
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, 1.0f / 3.0f, (float)sum / count);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_clear);
+    RUN_TEST(test_int16_to_float);
+    RUN_TEST(test_mac_gain_backends_match);
+    RUN_TEST(test_mac_gain_ramps_before_each_frame);
+    RUN_TEST(test_interleave_backends_match);
+    RUN_TEST(test_interleave_saturates);
+    RUN_TEST(test_interleave32_backends_match);
+    RUN_TEST(test_dither_is_triangular_and_unbiased);
+    return UNITY_END();
+}
@@ -0,0 +1,483 @@
+/*
+ * SamplePlayer mix output against golden renders in test/golden.
+ * Plain playback paths must match bit for bit, interpolated and
+ * re-partitioned paths within a tolerance.
+ *
+ * run with: pio test -e native
+ * after an intended change to the sound: pio test -e native_golden
+ */
+#include <Arduino.h>
+#include <SD_MMC.h>
+#include <unity.h>
+
+#include "config.hpp"
+#include "player.hpp"
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+#define MAX_BLOCKS 48
+#define EXACT 0.0f
+
+static SamplePlayer *player;
+static float mix[MAX_BLOCKS * SAMPLE_BUFFER_SIZE * 2];
+static float reference[MAX_BLOCKS * SAMPLE_BUFFER_SIZE * 2];
+
+/* renders interleaved L/R into out, starting at block offset */
+static void render(float *out, int firstBlock, int blocks)
+{
+    float fl_sample[SAMPLE_BUFFER_SIZE];
+    float fr_sample[SAMPLE_BUFFER_SIZE];
+
+    for (int b = firstBlock; b < firstBlock + blocks; b++)
+    {
+        memset(fl_sample, 0, sizeof(fl_sample));
+        memset(fr_sample, 0, sizeof(fr_sample));
+        player->process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE);
+        for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+        {
+            out[(b * SAMPLE_BUFFER_SIZE + n) * 2] = fl_sample[n];
+            out[(b * SAMPLE_BUFFER_SIZE + n) * 2 + 1] = fr_sample[n];
+        }
+    }
+}
+
+static void assertMixEqual(const float *expected, const float *actual, int blocks, float tolerance)
+{
+    for (int i = 0; i < blocks * SAMPLE_BUFFER_SIZE * 2; i++)
+    {
+        if (tolerance == EXACT)
+        {
+            uint32_t e, a;
+            memcpy(&e, &expected[i], sizeof(e));
+            memcpy(&a, &actual[i], sizeof(a));
+            TEST_ASSERT_EQUAL_HEX32_MESSAGE(e, a, "mix differs from reference");
+        }
+        else
+        {
+            TEST_ASSERT_FLOAT_WITHIN_MESSAGE(tolerance, expected[i], actual[i], "mix differs from reference");
+        }
+    }
+}
+
+/* compares mix against test/golden/<name>.f32, or rewrites it with UPDATE_GOLDEN */
+static void checkGolden(const char *name, int blocks, float tolerance)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "%s/golden/%s.f32", TEST_DATA_DIR, name);
+    const size_t count = blocks * SAMPLE_BUFFER_SIZE * 2;
+
+#ifdef UPDATE_GOLDEN
+    FILE *f = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL_MESSAGE(f, path);
+    fwrite(mix, sizeof(float), count, f);
+    fclose(f);
+    TEST_IGNORE_MESSAGE("golden updated");
+#else
+    FILE *f = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL_MESSAGE(f, path);
+    size_t read = fread(reference, sizeof(float), count, f);
+    fclose(f);
+    TEST_ASSERT_EQUAL_MESSAGE(count, read, "golden render has a different length");
+    assertMixEqual(reference, mix, blocks, tolerance);
+#endif
+}
+
+void setUp(void)
+{
+    player->allVoicesOff();
+    SamplePlayer::init();
+    for (int i = 0; i < 2; i++)
+    {
+        player->setVol(i, 127);
+        player->setPan(i, PAN_CENTER);
+    }
+    memset(mix, 0, sizeof(mix));
+    memset(reference, 0, sizeof(reference));
+}
+
+void tearDown(void)
+{
+}
+
+void test_mono_playback(void)
+{
+    TEST_ASSERT_TRUE(player->sampleOn(0, 127));
+    render(mix, 0, 36);
+    checkGolden("mono", 36, EXACT);
+}
+
+void test_stereo_playback(void)
+{
+    TEST_ASSERT_TRUE(player->sampleOn(1, 100));
+    render(mix, 0, 28);
+    checkGolden("stereo", 28, EXACT);
+}
+
+void test_retrigger_tail(void)
+{
+    player->sampleOn(0, 127);
+    render(mix, 0, 10);
+    player->sampleOn(0, 90);
+    render(mix, 10, 36);
+    checkGolden("retrigger", 46, EXACT);
+}
+
+void test_transposed_playback(void)
+{
+    player->sampleOn(0, 127, 7);
+    render(mix, 0, 30);
+    checkGolden("transposed", 30, 1e-6f);
+}
+
+void test_voices_sum(void)
+{
+    player->sampleOn(0, 127);
+    render(reference, 0, 30);
+    player->allVoicesOff();
+    player->sampleOn(1, 127);
+    render(mix, 0, 30);
+    for (int i = 0; i < 30 * SAMPLE_BUFFER_SIZE * 2; i++)
+    {
+        reference[i] += mix[i];
+    }
+
+    player->allVoicesOff();
+    player->sampleOn(0, 127);
+    player->sampleOn(1, 127);
+    render(mix, 0, 30);
+    assertMixEqual(reference, mix, 30, EXACT);
+}
+
+void test_pan_and_volume(void)
+{
+    player->sampleOn(0, 127);
+    render(reference, 0, 20);
+
+    player->allVoicesOff();
+    player->setPan(0, 0);
+    player->sampleOn(0, 127);
+    render(mix, 0, 20);
+    for (int i = 0; i < 20 * SAMPLE_BUFFER_SIZE; i++)
+    {
+        /* hard left is the centre level without the -3dB pan law */
+        TEST_ASSERT_FLOAT_WITHIN(1e-6f, reference[2 * i] * (float)M_SQRT2, mix[2 * i]);
+        TEST_ASSERT_FLOAT_WITHIN(1e-9f, 0.0f, mix[2 * i + 1]);
+    }
+
+    player->allVoicesOff();
+    player->setPan(0, PAN_CENTER);
+    player->setVol(0, 64);
+    player->sampleOn(0, 127);
+    render(mix, 0, 20);
+    for (int i = 0; i < 20 * SAMPLE_BUFFER_SIZE * 2; i++)
+    {
+        TEST_ASSERT_FLOAT_WITHIN(1e-6f, reference[i] * 64.0f / 127.0f, mix[i]);
+    }
+}
+
+void test_dual_partition_matches_single(void)
+{
+    player->sampleOn(0, 127);
+    player->sampleOn(1, 110);
+    player->voiceOn(0, 80, 5);
+    render(reference, 0, 30);
+
+    player->allVoicesOff();
+    player->sampleOn(0, 127);
+    player->sampleOn(1, 110);
+    player->voiceOn(0, 80, 5);
+
+    float fl_core0[SAMPLE_BUFFER_SIZE], fr_core0[SAMPLE_BUFFER_SIZE];
+    float fl_core1[SAMPLE_BUFFER_SIZE], fr_core1[SAMPLE_BUFFER_SIZE];
+    for (int b = 0; b < 30; b++)
+    {
+        memset(fl_core0, 0, sizeof(fl_core0));
+        memset(fr_core0, 0, sizeof(fr_core0));
+        memset(fl_core1, 0, sizeof(fl_core1));
+        memset(fr_core1, 0, sizeof(fr_core1));
+        player->beginBlock();
+        player->processPartition(0, RENDER_PARTITIONS, fl_core1, fr_core1, SAMPLE_BUFFER_SIZE);
+        player->processPartition(1, RENDER_PARTITIONS, fl_core0, fr_core0, SAMPLE_BUFFER_SIZE);
+        for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+        {
+            mix[(b * SAMPLE_BUFFER_SIZE + n) * 2] = fl_core1[n] + fl_core0[n];
+            mix[(b * SAMPLE_BUFFER_SIZE + n) * 2 + 1] = fr_core1[n] + fr_core0[n];
+        }
+    }
+    /* summing order differs from the single bus */
+    assertMixEqual(reference, mix, 30, 1e-6f);
+}
+
+void test_sends_follow_cc(void)
+{
+    player->sampleOn(0, 127);
+    render(reference, 0, 20);
+
+    /* the reverb send is the voice level before the pan, the main bus does not change */
+    player->allVoicesOff();
+    player->controlChange(1, MIDI_CC_REVERB, 127);
+    player->sampleOn(0, 127);
+    float fl_sample[SAMPLE_BUFFER_SIZE], fr_sample[SAMPLE_BUFFER_SIZE];
+    float delay_send[SAMPLE_BUFFER_SIZE], reverb_send[SAMPLE_BUFFER_SIZE];
+    for (int b = 0; b < 20; b++)
+    {
+        memset(fl_sample, 0, sizeof(fl_sample));
+        memset(fr_sample, 0, sizeof(fr_sample));
+        memset(delay_send, 0, sizeof(delay_send));
+        memset(reverb_send, 0, sizeof(reverb_send));
+        player->process(fl_sample, fr_sample, SAMPLE_BUFFER_SIZE, delay_send, reverb_send);
+        for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+        {
+            const int i = b * SAMPLE_BUFFER_SIZE + n;
+            mix[2 * i] = fl_sample[n];
+            mix[2 * i + 1] = fr_sample[n];
+            TEST_ASSERT_FLOAT_WITHIN(1e-6f, fl_sample[n] / pan_lut[0][PAN_CENTER], reverb_send[n]);
+            TEST_ASSERT_EQUAL_FLOAT(0.0f, delay_send[n]);
+        }
+    }
+    assertMixEqual(reference, mix, 20, EXACT);
+}
+
+/* loud for TAIL_LOUD_BLOCKS, then a tail that is audible only at high velocity */
+#define TAIL_LOUD_BLOCKS 4
+#define TAIL_FRAMES (40 * SAMPLE_BUFFER_SIZE)
+static int16_t tailSample[TAIL_FRAMES];
+static int16_t quietSample[TAIL_FRAMES];
+
+/* a tone at half the output rate, all of it above any low pass cutoff */
+#define NYQUIST_FRAMES (40 * SAMPLE_BUFFER_SIZE)
+static int16_t nyquistSample[NYQUIST_FRAMES];
+
+static float mixEnergy(const float *signal, int blocks)
+{
+    float energy = 0.0f;
+    for (int i = 0; i < blocks * SAMPLE_BUFFER_SIZE * 2; i++)
+    {
+        energy += signal[i] * signal[i];
+    }
+    return energy;
+}
+
+void test_filter_bypassed_is_exact(void)
+{
+    /* cutoff and resonance without a mode leave the voice untouched */
+    player->controlChange(1, MIDI_CC_CUTOFF, 20);
+    player->controlChange(1, MIDI_CC_RESONANCE, 100);
+    TEST_ASSERT_TRUE(player->sampleOn(0, 127));
+    render(mix, 0, 36);
+    checkGolden("mono", 36, EXACT);
+
+    /* wide open the low pass keeps the level of a low tone, here the first loud blocks of the tail sample */
+    player->allVoicesOff();
+    player->controlChange(1, MIDI_CC_CUTOFF, 127);
+    player->controlChange(1, MIDI_CC_RESONANCE, 0);
+    player->sampleOn(2, 127);
+    render(reference, 0, TAIL_LOUD_BLOCKS);
+    player->allVoicesOff();
+    player->controlChange(1, MIDI_CC_FILTER, 1);
+    player->sampleOn(2, 127);
+    render(mix, 0, TAIL_LOUD_BLOCKS);
+    TEST_ASSERT_FLOAT_WITHIN(0.02f * mixEnergy(reference, TAIL_LOUD_BLOCKS), mixEnergy(reference, TAIL_LOUD_BLOCKS), mixEnergy(mix, TAIL_LOUD_BLOCKS));
+}
+
+void test_filter_modes_and_velocity(void)
+{
+    player->sampleOn(4, 127);
+    render(reference, 0, 8);
+    const float dry = mixEnergy(reference, 8);
+
+    /* low pass two octaves under middle C keeps next to nothing of it */
+    player->allVoicesOff();
+    player->controlChange(1, MIDI_CC_FILTER, 1);
+    player->controlChange(1, MIDI_CC_CUTOFF, 36);
+    player->sampleOn(4, 127);
+    render(mix, 0, 8);
+    TEST_ASSERT_TRUE(mixEnergy(mix, 8) < dry * 1e-4f);
+
+    /* high pass lets it through */
+    player->allVoicesOff();
+    player->controlChange(1, MIDI_CC_FILTER, 127);
+    player->sampleOn(4, 127);
+    render(mix, 0, 8);
+    TEST_ASSERT_TRUE(mixEnergy(mix, 8) > dry * 0.9f);
+
+    /* band pass has nothing to give at either end, not even with resonance */
+    player->allVoicesOff();
+    player->controlChange(1, MIDI_CC_FILTER, 64);
+    player->controlChange(1, MIDI_CC_CUTOFF, 69);
+    player->controlChange(1, MIDI_CC_RESONANCE, 127);
+    player->sampleOn(4, 127);
+    render(mix, 0, 8);
+    TEST_ASSERT_TRUE(mixEnergy(mix, 8) < dry * 0.01f);
+
+    /* velocity to brightness: the softer note comes out darker relative to its level */
+    player->allVoicesOff();
+    player->controlChange(1, MIDI_CC_RESONANCE, 0);
+    player->controlChange(1, MIDI_CC_FILTER, 1);
+    player->controlChange(1, MIDI_CC_CUTOFF, 120);
+    player->sampleOn(4, 127);
+    render(mix, 0, 8);
+    const float loud = mixEnergy(mix, 8);
+    player->allVoicesOff();
+    player->sampleOn(4, 64);
+    render(mix, 0, 8);
+    const float soft = mixEnergy(mix, 8) * (127.0f / 64.0f) * (127.0f / 64.0f);
+    TEST_ASSERT_TRUE(loud > 0.0f);
+    TEST_ASSERT_TRUE(soft < loud * 0.5f);
+}
+
+void test_retires_inaudible_tail(void)
+{
+    VoiceStats before = player->voiceStats();
+    player->sampleOn(2, 127);
+    render(mix, 0, TAIL_LOUD_BLOCKS + 2);
+    TEST_ASSERT_EQUAL(1, player->activeVoices());
+
+    /* the 6 LSB tail still counts at velocity 100, 4.7 LSB out */
+    player->allVoicesOff();
+    player->sampleOn(2, 100);
+    render(mix, 0, TAIL_LOUD_BLOCKS + 2);
+    TEST_ASSERT_EQUAL(1, player->activeVoices());
+
+    /* at an ordinary velocity 80 it comes out at 3.8 LSB, under RETIRE_LEVEL, the voice stops right after the loud part */
+    player->allVoicesOff();
+    player->sampleOn(2, 80);
+    render(mix, 0, TAIL_LOUD_BLOCKS + 2);
+    TEST_ASSERT_EQUAL(0, player->activeVoices());
+    TEST_ASSERT_EQUAL_UINT32(before.retired + 1, player->voiceStats().retired);
+}
+
+void test_steals_quietest_voice(void)
+{
+    /* reference: all but one voice busy with loud notes, the new note takes the free one */
+    for (int v = 0; v < NUM_VOICES - 1; v++)
+    {
+        player->voiceOn(0, 127);
+    }
+    render(reference, 0, 1);
+    player->voiceOn(1, 127);
+    render(reference, 1, 1);
+
+    /* the same with a quiet note in the last voice, it is the one to go, not the oldest */
+    player->allVoicesOff();
+    for (int v = 0; v < NUM_VOICES - 1; v++)
+    {
+        player->voiceOn(0, 127);
+    }
+    player->voiceOn(3, 20);
+    render(mix, 0, 1);
+    VoiceStats before = player->voiceStats();
+    player->voiceOn(1, 127);
+    TEST_ASSERT_EQUAL_UINT32(before.stolen + 1, player->voiceStats().stolen);
+    render(mix, 1, 1);
+
+    /* only the quiet voice's fade out differs */
+    for (int i = SAMPLE_BUFFER_SIZE * 2; i < 2 * SAMPLE_BUFFER_SIZE * 2; i++)
+    {
+        TEST_ASSERT_FLOAT_WITHIN(1e-3f, reference[i], mix[i]);
+    }
+}
+
+#define DEADLINE_US (1000000 * SAMPLE_BUFFER_SIZE / SAMPLE_RATE)
+
+void test_governor_sheds_quietest_and_recovers(void)
+{
+    /* reference: only the four loud voices */
+    for (int v = 0; v < 4; v++)
+    {
+        player->voiceOn(3, 127);
+    }
+    render(reference, 0, 12);
+
+    player->allVoicesOff();
+    for (int v = 0; v < 4; v++)
+    {
+        player->voiceOn(3, 127);
+    }
+    player->voiceOn(3, 30);
+    player->voiceOn(3, 20);
+    render(mix, 0, 1);
+
+    /* first overloaded block only drops the interpolation, the second caps the voices */
+    VoiceStats before = player->voiceStats();
+    player->endBlock(DEADLINE_US + 1);
+    TEST_ASSERT_TRUE(player->voiceStats().fastInterpolation);
+    TEST_ASSERT_EQUAL(NUM_VOICES, player->voiceStats().voiceCap);
+    player->endBlock(DEADLINE_US + 1);
+    TEST_ASSERT_EQUAL(GOVERNOR_MIN_VOICES, player->voiceStats().voiceCap);
+
+    /* the two quiet voices fade out, the loud ones play on untouched */
+    render(mix, 1, 11);
+    TEST_ASSERT_EQUAL_UINT32(before.shed + 2, player->voiceStats().shed);
+    TEST_ASSERT_EQUAL(4, player->activeVoices());
+    assertMixEqual(&reference[11 * SAMPLE_BUFFER_SIZE * 2], &mix[11 * SAMPLE_BUFFER_SIZE * 2], 1, 1e-6f);
+
+    /* inside the hysteresis band nothing changes */
+    for (int b = 0; b < 4 * GOVERNOR_HOLD_BLOCKS; b++)
+    {
+        player->endBlock(DEADLINE_US * 7 / 10);
+    }
+    TEST_ASSERT_EQUAL(GOVERNOR_MIN_VOICES, player->voiceStats().voiceCap);
+
+    /* below it, one voice back per hold period, then the interpolation */
+    for (int b = 0; b < GOVERNOR_HOLD_BLOCKS - 1; b++)
+    {
+        player->endBlock(DEADLINE_US / 4);
+    }
+    TEST_ASSERT_EQUAL(GOVERNOR_MIN_VOICES, player->voiceStats().voiceCap);
+    player->endBlock(DEADLINE_US / 4);
+    TEST_ASSERT_EQUAL(GOVERNOR_MIN_VOICES + 1, player->voiceStats().voiceCap);
+    for (int b = 0; b < (NUM_VOICES - GOVERNOR_MIN_VOICES - 1) * GOVERNOR_HOLD_BLOCKS; b++)
+    {
+        player->endBlock(DEADLINE_US / 4);
+    }
+    TEST_ASSERT_EQUAL(NUM_VOICES, player->voiceStats().voiceCap);
+    TEST_ASSERT_TRUE(player->voiceStats().fastInterpolation);
+    for (int b = 0; b < GOVERNOR_HOLD_BLOCKS; b++)
+    {
+        player->endBlock(DEADLINE_US / 4);
+    }
+    TEST_ASSERT_FALSE(player->voiceStats().fastInterpolation);
+    TEST_ASSERT_EQUAL(GOVERNOR_MIN_VOICES, player->voiceStats().lowestCap);
+}
+
+int main(int argc, char **argv)
+{
+    SD_MMC.setRoot(TEST_DATA_DIR);
+    player = new SamplePlayer();
+    if (!player->loadWav(0, (char *)"/fixtures/mono.wav") || !player->loadWav(1, (char *)"/fixtures/stereo.wav"))
+    {
+        fprintf(stderr, "could not load fixtures from %s\n", TEST_DATA_DIR);
+        return 1;
+    }
+    for (int i = 0; i < TAIL_FRAMES; i++)
+    {
+        tailSample[i] = i < TAIL_LOUD_BLOCKS * SAMPLE_BUFFER_SIZE ? 16000 : 6;
+        quietSample[i] = 100;
+    }
+    player->loadBuffer(2, tailSample, TAIL_FRAMES, false);
+    player->loadBuffer(3, quietSample, TAIL_FRAMES, false);
+    for (int i = 0; i < NYQUIST_FRAMES; i++)
+    {
+        nyquistSample[i] = (i & 1) ? -8000 : 8000;
+    }
+    player->loadBuffer(4, nyquistSample, NYQUIST_FRAMES, false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_mono_playback);
+    RUN_TEST(test_stereo_playback);
+    RUN_TEST(test_retrigger_tail);
+    RUN_TEST(test_transposed_playback);
+    RUN_TEST(test_voices_sum);
+    RUN_TEST(test_pan_and_volume);
+    RUN_TEST(test_dual_partition_matches_single);
+    RUN_TEST(test_sends_follow_cc);
+    RUN_TEST(test_filter_bypassed_is_exact);
+    RUN_TEST(test_filter_modes_and_velocity);
+    RUN_TEST(test_retires_inaudible_tail);
+    RUN_TEST(test_steals_quietest_voice);
+    RUN_TEST(test_governor_sheds_quietest_and_recovers);
+    return UNITY_END();
+}
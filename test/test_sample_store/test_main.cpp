@@ -0,0 +1,145 @@
+/*
+ * SampleStore sharing and reference counting, plus slots sharing
+ * buffers through SamplePlayer::loadWav.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <SD_MMC.h>
+#include <unity.h>
+
+#include "player.hpp"
+#include "sample_store.hpp"
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+#define FRAMES 500
+
+static int16_t *newData(int seed)
+{
+    int16_t *data = (int16_t *)ps_malloc(FRAMES * sizeof(int16_t));
+    for (int i = 0; i < FRAMES; i++)
+    {
+        data[i] = (int16_t)((i * 31 + seed) % 2000 + TRIM_SILENCE + 1); /* nothing to trim */
+    }
+    return data;
+}
+
+void setUp(void)
+{
+    SD_MMC.setRoot(TEST_DATA_DIR);
+}
+
+void tearDown(void)
+{
+}
+
+void test_find_by_file_identity(void)
+{
+    SampleStore store;
+    SampleBuffer *a = store.add("/a.wav", 1044, newData(0), FRAMES, false, true);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_EQUAL_UINT16(1, a->refs);
+
+    TEST_ASSERT_TRUE(store.find("/a.wav", 1044) == a);
+    TEST_ASSERT_EQUAL_UINT16(2, a->refs);
+    TEST_ASSERT_NULL(store.find("/a.wav", 2000)); /* the file changed size, load it again */
+    TEST_ASSERT_NULL(store.find("/b.wav", 1044));
+
+    store.release(a);
+    store.release(a);
+    TEST_ASSERT_EQUAL_UINT16(0, store.buffers());
+    TEST_ASSERT_NULL(store.find("/a.wav", 1044));
+}
+
+void test_shares_identical_content(void)
+{
+    SampleStore store;
+    SampleBuffer *a = store.add("/a.wav", 1044, newData(0), FRAMES, false, true);
+    SampleBuffer *copy = store.add("/copy.wav", 1044, newData(0), FRAMES, false, true);
+    SampleBuffer *other = store.add("/other.wav", 1044, newData(7), FRAMES, false, true);
+
+    TEST_ASSERT_TRUE(copy == a);
+    TEST_ASSERT_EQUAL_UINT16(2, a->refs);
+    TEST_ASSERT_TRUE(other != a);
+    TEST_ASSERT_EQUAL_UINT16(2, store.buffers());
+    TEST_ASSERT_EQUAL_UINT32(2 * FRAMES * sizeof(int16_t) + 4 * a->envelopeBlocks * sizeof(uint16_t), store.bytes());
+
+    store.release(a);
+    store.release(copy);
+    store.release(other);
+    TEST_ASSERT_EQUAL_UINT16(0, store.buffers());
+    TEST_ASSERT_EQUAL_UINT32(0, store.bytes());
+}
+
+void test_caller_buffers_are_not_shared(void)
+{
+    static int16_t data[FRAMES];
+    int16_t *same = newData(0);
+    memcpy(data, same, sizeof(data));
+
+    SampleStore store;
+    SampleBuffer *owned = store.add("/a.wav", 1044, same, FRAMES, false, true);
+    SampleBuffer *caller = store.add(NULL, 0, data, FRAMES, false, false);
+    TEST_ASSERT_TRUE(caller != owned);
+    TEST_ASSERT_TRUE(caller->data == data);
+    TEST_ASSERT_NULL(store.find("", 0));
+
+    store.release(caller); /* must not free the static array */
+    store.release(owned);
+}
+
+void test_slots_share_a_file(void)
+{
+    static SamplePlayer player;
+    const uint16_t before = sampleStore.buffers();
+
+    TEST_ASSERT_TRUE(player.loadWav(0, (char *)"/fixtures/mono.wav"));
+    TEST_ASSERT_TRUE(player.loadWav(1, (char *)"/fixtures/mono.wav"));
+    TEST_ASSERT_TRUE(player.loadWav(2, (char *)"/fixtures/stereo.wav"));
+    TEST_ASSERT_EQUAL_UINT16(before + 2, sampleStore.buffers());
+
+    SampleInfo info0, info1;
+    TEST_ASSERT_TRUE(player.sampleInfo(0, info0));
+    TEST_ASSERT_TRUE(player.sampleInfo(1, info1));
+    TEST_ASSERT_TRUE(info0.envelope == info1.envelope);
+
+    /* replacing both slots lets the mono buffer go */
+    TEST_ASSERT_TRUE(player.loadWav(0, (char *)"/fixtures/stereo.wav"));
+    TEST_ASSERT_EQUAL_UINT16(before + 2, sampleStore.buffers());
+    TEST_ASSERT_TRUE(player.loadWav(1, (char *)"/fixtures/stereo.wav"));
+    TEST_ASSERT_EQUAL_UINT16(before + 1, sampleStore.buffers());
+    TEST_ASSERT_TRUE(player.sampleOn(1, 127));
+}
+
+void test_stalled_swap_holds_buffer(void)
+{
+    static SamplePlayer player;
+    static int16_t first[FRAMES], second[FRAMES], third[FRAMES];
+    TEST_ASSERT_TRUE(player.loadBuffer(3, first, FRAMES, false));
+    const uint16_t before = sampleStore.buffers();
+
+    /* the render loop has started but makes no progress while we swap, as if stalled */
+    player.beginBlock();
+    TEST_ASSERT_TRUE(player.loadBuffer(3, second, FRAMES, false));
+    TEST_ASSERT_EQUAL_UINT16(before + 1, sampleStore.buffers()); /* the first buffer is held, not freed */
+
+    /* once two blocks have started the next load lets it go */
+    player.beginBlock();
+    player.beginBlock();
+    TEST_ASSERT_TRUE(player.loadBuffer(4, third, FRAMES, false));
+    TEST_ASSERT_EQUAL_UINT16(before + 1, sampleStore.buffers());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_find_by_file_identity);
+    RUN_TEST(test_shares_identical_content);
+    RUN_TEST(test_caller_buffers_are_not_shared);
+    RUN_TEST(test_slots_share_a_file);
+    RUN_TEST(test_stalled_swap_holds_buffer);
+    return UNITY_END();
+}
@@ -0,0 +1,154 @@
+/*
+ * Send effects: the delay repeats the send at the delay time and ping-pongs,
+ * the reverb tail stays bounded and dies away, silence stays silent, and
+ * the effect controllers reach it through the MIDI handler.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "config.hpp"
+#include "send_effects.hpp"
+#include "midi_note_handler.hpp"
+
+#define TEST_BLOCKS ((2 * SAMPLE_RATE) / SAMPLE_BUFFER_SIZE) /* two seconds */
+#define TEST_LEN    (TEST_BLOCKS * SAMPLE_BUFFER_SIZE)
+#define DELAY_FRAMES (DELAY_TIME_MS * SAMPLE_RATE / 1000)
+
+static float delaySend[TEST_LEN];
+static float reverbSend[TEST_LEN];
+static float out_l[TEST_LEN];
+static float out_r[TEST_LEN];
+
+/* one block at a time, like audio_task() */
+static void runEffects(SendEffects &effects)
+{
+    memset(out_l, 0, sizeof(out_l));
+    memset(out_r, 0, sizeof(out_r));
+    for (int b = 0; b < TEST_BLOCKS; b++)
+    {
+        const int n = b * SAMPLE_BUFFER_SIZE;
+        effects.process(&delaySend[n], &reverbSend[n], &out_l[n], &out_r[n], SAMPLE_BUFFER_SIZE);
+    }
+}
+
+static float peakBetween(const float *signal, int from, int to)
+{
+    float peak = 0.0f;
+    for (int n = from; n < to; n++)
+    {
+        peak = fmaxf(peak, fabsf(signal[n]));
+    }
+    return peak;
+}
+
+void setUp(void)
+{
+    memset(delaySend, 0, sizeof(delaySend));
+    memset(reverbSend, 0, sizeof(reverbSend));
+}
+
+void tearDown(void)
+{
+}
+
+void test_silence_stays_silent(void)
+{
+    SendEffects effects;
+    TEST_ASSERT_TRUE(effects.begin());
+    runEffects(effects);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_l, 0, TEST_LEN));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_r, 0, TEST_LEN));
+    TEST_ASSERT_TRUE(effects.memoryBytes() >= 2 * DELAY_MAX_MS * SAMPLE_RATE / 1000 * sizeof(int16_t));
+}
+
+void test_delay_ping_pongs(void)
+{
+    SendEffects effects;
+    effects.begin();
+    effects.setReverb(0.0f, 0.0f);
+    delaySend[5] = 0.5f;
+    runEffects(effects);
+
+    /* first repeat on the left at the delay time, Q15 away from the send */
+    TEST_ASSERT_FLOAT_WITHIN(2.0f / 32768.0f, 0.5f * DELAY_WET, out_l[5 + DELAY_FRAMES]);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_l, 0, 5 + DELAY_FRAMES));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_l, 6 + DELAY_FRAMES, 5 + 2 * DELAY_FRAMES));
+
+    /* the second on the right, quieter by the feedback */
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_r, 0, 5 + 2 * DELAY_FRAMES));
+    float second = peakBetween(out_r, 5 + 2 * DELAY_FRAMES, 5 + 3 * DELAY_FRAMES);
+    TEST_ASSERT_TRUE(second > 0.0f);
+    TEST_ASSERT_TRUE(second < 0.5f * DELAY_WET * DELAY_FEEDBACK);
+}
+
+void test_delay_time_change(void)
+{
+    SendEffects effects;
+    effects.begin();
+    effects.setDelay(100, 0.0f);
+    delaySend[0] = 0.5f;
+    runEffects(effects);
+
+    const int frames = 100 * SAMPLE_RATE / 1000;
+    TEST_ASSERT_FLOAT_WITHIN(2.0f / 32768.0f, 0.5f * DELAY_WET, out_l[frames]);
+    /* no feedback, nothing after the first repeat */
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_l, frames + 1, TEST_LEN));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_r, 0, TEST_LEN));
+}
+
+void test_delay_from_midi(void)
+{
+    SendEffects effects;
+    effects.begin();
+    SamplePlayer player;
+    MidiNoteHandler handler(&player);
+    handler.setEffects(&effects);
+
+    /* longest time, then no feedback, the time has to survive the second controller */
+    uint8_t controls[] = {0xB0, MIDI_CC_DELAY_TIME, 127, 0xB0, MIDI_CC_DELAY_FEEDBACK, 0};
+    midiIn.receive(controls, sizeof(controls), micros());
+    handler.update();
+
+    delaySend[0] = 0.5f;
+    runEffects(effects);
+    const int frames = DELAY_MAX_MS * SAMPLE_RATE / 1000;
+    TEST_ASSERT_FLOAT_WITHIN(2.0f / 32768.0f, 0.5f * DELAY_WET, out_l[frames]);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_l, 0, frames));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_l, frames + 1, TEST_LEN));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, peakBetween(out_r, 0, TEST_LEN));
+}
+
+void test_reverb_tail_decays(void)
+{
+    SendEffects effects;
+    effects.begin();
+    /* a short full scale burst, the loudest the send bus gets with headroom left */
+    for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+    {
+        reverbSend[n] = (n & 1) ? 1.0f : -1.0f;
+    }
+    runEffects(effects);
+
+    const int window = SAMPLE_RATE / 4;
+    float early = peakBetween(out_l, 0, window);
+    float late = peakBetween(out_l, TEST_LEN - window, TEST_LEN);
+    TEST_ASSERT_TRUE(early > 0.01f);
+    TEST_ASSERT_TRUE(early <= 2.0f * REVERB_WET);
+    TEST_ASSERT_TRUE(late < early / 8);
+    /* the two sides come out of different allpass chains */
+    TEST_ASSERT_TRUE(memcmp(out_l, out_r, sizeof(out_l)) != 0);
+    TEST_ASSERT_TRUE(peakBetween(out_r, 0, window) > 0.01f);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_silence_stays_silent);
+    RUN_TEST(test_delay_ping_pongs);
+    RUN_TEST(test_delay_time_change);
+    RUN_TEST(test_delay_from_midi);
+    RUN_TEST(test_reverb_tail_decays);
+    return UNITY_END();
+}
@@ -0,0 +1,161 @@
+/*
+ * StorageService requests against test/fixtures. No I/O task on the host,
+ * so every request completes before submit() returns.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include <SD_MMC.h>
+
+#include "storage.hpp"
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+#define MONO_FRAMES   2000
+#define STEREO_FRAMES 1500
+
+static StorageRequest last;
+static int completions;
+
+static void captureRequest(StorageRequest &request)
+{
+    last = request;
+    completions++;
+}
+
+static const StorageEntry *findEntry(const StorageEntry *entries, uint16_t numEntries, const char *name)
+{
+    for (int i = 0; i < numEntries; i++)
+    {
+        if (strcmp(entries[i].name, name) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+void setUp(void)
+{
+    SD_MMC.setRoot(TEST_DATA_DIR);
+    memset(&last, 0, sizeof(last));
+    completions = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_load_wav(void)
+{
+    TEST_ASSERT_TRUE(storage.loadWav("/fixtures/stereo.wav", 5, captureRequest));
+    TEST_ASSERT_EQUAL(1, completions);
+    TEST_ASSERT_TRUE(last.ok);
+    TEST_ASSERT_EQUAL_UINT8(5, last.tag);
+    TEST_ASSERT_TRUE(last.stereo);
+    TEST_ASSERT_EQUAL_UINT32(STEREO_FRAMES * 2, last.numSamples);
+    TEST_ASSERT_NOT_NULL(last.data);
+    free(last.data);
+}
+
+void test_load_missing_wav(void)
+{
+    TEST_ASSERT_TRUE(storage.loadWav("/fixtures/missing.wav", 0, captureRequest));
+    TEST_ASSERT_EQUAL(1, completions);
+    TEST_ASSERT_FALSE(last.ok);
+    TEST_ASSERT_NULL(last.data);
+}
+
+void test_list_and_catalog(void)
+{
+    StorageEntry entries[8];
+
+    TEST_ASSERT_TRUE(storage.list("/fixtures", entries, 8, captureRequest));
+    TEST_ASSERT_TRUE(last.ok);
+    TEST_ASSERT_EQUAL_UINT16(2, last.numEntries);
+    TEST_ASSERT_NOT_NULL(findEntry(entries, last.numEntries, "/fixtures/mono.wav"));
+    TEST_ASSERT_NOT_NULL(findEntry(entries, last.numEntries, "/fixtures/stereo.wav"));
+
+    TEST_ASSERT_TRUE(storage.catalog("/fixtures", entries, 8, captureRequest));
+    TEST_ASSERT_TRUE(last.ok);
+    const StorageEntry *mono = findEntry(entries, last.numEntries, "/fixtures/mono.wav");
+    const StorageEntry *stereo = findEntry(entries, last.numEntries, "/fixtures/stereo.wav");
+    TEST_ASSERT_NOT_NULL(mono);
+    TEST_ASSERT_NOT_NULL(stereo);
+    TEST_ASSERT_EQUAL_UINT16(1, mono->channels);
+    TEST_ASSERT_EQUAL_UINT32(MONO_FRAMES * 2, mono->dataSize);
+    TEST_ASSERT_EQUAL_UINT16(2, stereo->channels);
+    TEST_ASSERT_EQUAL_UINT32(44100, stereo->sampleRate);
+    TEST_ASSERT_EQUAL_UINT32(STEREO_FRAMES * 4, stereo->dataSize);
+
+    /* the caller's array bounds the listing */
+    TEST_ASSERT_TRUE(storage.list("/fixtures", entries, 1, captureRequest));
+    TEST_ASSERT_EQUAL_UINT16(1, last.numEntries);
+
+    TEST_ASSERT_TRUE(storage.list("/fixtures/none", entries, 8, captureRequest));
+    TEST_ASSERT_FALSE(last.ok);
+
+    /* a path that doesn't fit an entry is skipped, not listed cut short */
+    const char *longName = "/fixtures/a_sample_name_that_runs_past_the_storage_path_length.wav";
+    File f = SD_MMC.open(longName, FILE_WRITE);
+    TEST_ASSERT_TRUE((bool)f);
+    f.close();
+    TEST_ASSERT_TRUE(storage.list("/fixtures", entries, 8, captureRequest));
+    SD_MMC.remove(longName);
+    TEST_ASSERT_TRUE(last.ok);
+    TEST_ASSERT_EQUAL_UINT16(2, last.numEntries);
+}
+
+void test_save_and_reload(void)
+{
+    static int16_t data[300];
+    for (int i = 0; i < 300; i++)
+    {
+        data[i] = (int16_t)(i * 97 - 15000);
+    }
+
+    SD_MMC.remove("/saved.wav");
+    TEST_ASSERT_TRUE(storage.saveWav("/saved.wav", data, 300, captureRequest));
+    TEST_ASSERT_TRUE(last.ok);
+
+    TEST_ASSERT_TRUE(storage.loadWav("/saved.wav", 0, captureRequest));
+    TEST_ASSERT_TRUE(last.ok);
+    TEST_ASSERT_FALSE(last.stereo);
+    TEST_ASSERT_EQUAL_UINT32(300, last.numSamples);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(data, last.data, 300);
+    free(last.data);
+    SD_MMC.remove("/saved.wav");
+
+    /* something already at the path doesn't make a failed save a success */
+    TEST_ASSERT_TRUE(storage.saveWav("/fixtures", data, 300, captureRequest));
+    TEST_ASSERT_FALSE(last.ok);
+}
+
+static bool countingJob(fs::FS &fs, StorageRequest &request)
+{
+    request.numEntries = fs.exists("/fixtures/mono.wav") ? 1 : 0;
+    return request.numEntries == 1;
+}
+
+void test_job(void)
+{
+    TEST_ASSERT_TRUE(storage.run(countingJob, captureRequest));
+    TEST_ASSERT_TRUE(last.ok);
+    TEST_ASSERT_EQUAL_UINT16(1, last.numEntries);
+    TEST_ASSERT_EQUAL_UINT32(0, storage.pending());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_load_wav);
+    RUN_TEST(test_load_missing_wav);
+    RUN_TEST(test_list_and_catalog);
+    RUN_TEST(test_save_and_reload);
+    RUN_TEST(test_job);
+    return UNITY_END();
+}
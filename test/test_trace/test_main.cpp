@@ -0,0 +1,179 @@
+/*
+ * Event trace ring: events come out of the dump in order and well formed,
+ * a trigger keeps TRACE_POST_EVENTS more and freezes the rest, concurrent
+ * writers never lose or tear an event, and the ring records again after
+ * a dump.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include <thread>
+
+#include "config.hpp"
+#include "trace.hpp"
+
+#define LINE_LEN 64
+
+static Tracer *trace;
+
+struct DumpedEvent {
+    unsigned start;
+    unsigned duration;
+    unsigned core;
+    char name[16];
+    unsigned arg0;
+    unsigned arg1;
+};
+
+static DumpedEvent dumped[TRACE_EVENTS];
+
+/* runs a whole dump, returns the event count, -1 when a line is malformed */
+static int dump()
+{
+    char line[LINE_LEN];
+    unsigned announced = 0;
+    int count = 0;
+    TEST_ASSERT_TRUE(trace->nextLine(line, sizeof(line)));
+    TEST_ASSERT_EQUAL(1, sscanf(line, "TRACE BEGIN %u", &announced));
+    while (trace->nextLine(line, sizeof(line)))
+    {
+        if (strcmp(line, "TRACE END\n") == 0)
+        {
+            TEST_ASSERT_EQUAL(announced, count);
+            return count;
+        }
+        DumpedEvent *e = &dumped[count];
+        if (count >= TRACE_EVENTS ||
+            sscanf(line, "T %u %u %u %15s %u %u", &e->start, &e->duration, &e->core, e->name, &e->arg0, &e->arg1) != 6)
+        {
+            return -1;
+        }
+        count++;
+    }
+    return -1;
+}
+
+void setUp(void)
+{
+    trace = new Tracer();
+}
+
+void tearDown(void)
+{
+    delete trace;
+}
+
+void test_dump_only_when_frozen(void)
+{
+    char line[LINE_LEN];
+    trace->record(TRACE_NOTE, 36, 100, 1000, 0);
+    TEST_ASSERT_FALSE(trace->frozen());
+    TEST_ASSERT_FALSE(trace->nextLine(line, sizeof(line)));
+}
+
+void test_trigger_keeps_post_events(void)
+{
+    for (int i = 0; i < 10; i++)
+    {
+        trace->record(TRACE_RENDER, i, 0, 100 * i, 50);
+    }
+    trace->trigger();
+    trace->trigger(); /* ignored, the first one counts */
+    for (int i = 0; i < TRACE_POST_EVENTS + 10; i++)
+    {
+        trace->record(TRACE_VOICE, i & 0xFF, 1, 5000 + i, 0);
+    }
+    TEST_ASSERT_TRUE(trace->frozen());
+
+    TEST_ASSERT_EQUAL(10 + TRACE_POST_EVENTS, dump());
+    TEST_ASSERT_EQUAL_STRING("render", dumped[0].name);
+    TEST_ASSERT_EQUAL(0, dumped[0].start);
+    TEST_ASSERT_EQUAL(50, dumped[0].duration);
+    TEST_ASSERT_EQUAL(1, dumped[0].core); /* the host runs on the loop task's core */
+    TEST_ASSERT_EQUAL(9, dumped[9].arg0);
+    TEST_ASSERT_EQUAL_STRING("voice", dumped[10].name);
+    TEST_ASSERT_EQUAL(5000 + TRACE_POST_EVENTS - 1, dumped[9 + TRACE_POST_EVENTS].start);
+
+    /* the dump rearms the ring */
+    TEST_ASSERT_FALSE(trace->frozen());
+    trace->record(TRACE_XRUN, 0, 0, 7, 3);
+    trace->trigger();
+    for (int i = 0; i < TRACE_POST_EVENTS + 1; i++)
+    {
+        trace->record(TRACE_I2S_WAIT, 0, 0, 8, 1);
+    }
+    TEST_ASSERT_EQUAL(1 + TRACE_POST_EVENTS, dump());
+    TEST_ASSERT_EQUAL_STRING("xrun", dumped[0].name);
+}
+
+void test_ring_keeps_the_newest(void)
+{
+    for (int i = 0; i < 3 * TRACE_EVENTS; i++)
+    {
+        trace->record(TRACE_PARTITION, 0, 0, i, 1);
+    }
+    trace->trigger();
+    for (int i = 0; i <= TRACE_POST_EVENTS; i++)
+    {
+        trace->record(TRACE_PARTITION, 0, 0, 3 * TRACE_EVENTS + i, 1);
+    }
+
+    TEST_ASSERT_EQUAL(TRACE_EVENTS, dump());
+    for (int i = 0; i < TRACE_EVENTS; i++)
+    {
+        TEST_ASSERT_EQUAL(3 * TRACE_EVENTS + TRACE_POST_EVENTS - TRACE_EVENTS + i, dumped[i].start);
+    }
+}
+
+void test_concurrent_writers(void)
+{
+    /* each writer numbers its events, none may go missing or come out torn */
+    const int perWriter = (TRACE_EVENTS - TRACE_POST_EVENTS) / 2 - 1; /* all of it fits in the ring */
+    auto writer = [](uint8_t id, int events)
+    {
+        for (int i = 0; i < events; i++)
+        {
+            trace->record(TRACE_VOICE, id, (uint8_t)i, (uint32_t)i, (uint32_t)(id * 100000 + i));
+        }
+    };
+    std::thread a(writer, 1, perWriter);
+    std::thread b(writer, 2, perWriter);
+    a.join();
+    b.join();
+    trace->trigger();
+    for (int i = 0; i <= TRACE_POST_EVENTS; i++)
+    {
+        trace->record(TRACE_NOTE, 0, 0, 0, 0);
+    }
+
+    const int count = dump();
+    TEST_ASSERT_EQUAL(2 * perWriter + TRACE_POST_EVENTS, count);
+    int next[3] = {0, 0, 0};
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(dumped[i].name, "voice") != 0)
+        {
+            continue;
+        }
+        const unsigned id = dumped[i].arg0;
+        TEST_ASSERT_TRUE(id == 1 || id == 2);
+        TEST_ASSERT_EQUAL(next[id], dumped[i].start);
+        TEST_ASSERT_EQUAL(id * 100000 + next[id], dumped[i].duration);
+        TEST_ASSERT_EQUAL(next[id] & 0xFF, dumped[i].arg1);
+        next[id]++;
+    }
+    TEST_ASSERT_EQUAL(perWriter, next[1]);
+    TEST_ASSERT_EQUAL(perWriter, next[2]);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_dump_only_when_frozen);
+    RUN_TEST(test_trigger_keeps_post_events);
+    RUN_TEST(test_ring_keeps_the_newest);
+    RUN_TEST(test_concurrent_writers);
+    return UNITY_END();
+}
@@ -0,0 +1,356 @@
+/*
+ * WAV loading through PatchManager_LoadWavefile and SamplePlayer::loadWav
+ * against the fixtures in test/fixtures, plus the load-time analysis and
+ * slice markers mapped onto keys by a kit file.
+ *
+ * run with: pio test -e native
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "patch_manager.hpp"
+#include "player.hpp"
+
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "test"
+#endif
+
+#define MONO_FRAMES   2000
+#define STEREO_FRAMES 1500
+
+/* the fixture pattern, see test/fixtures */
+static int16_t fixtureValue(int i)
+{
+    return (int16_t)(((i * 1237) % 40001) - 20000);
+}
+
+static int16_t buffer[STEREO_FRAMES * 2 + 64];
+
+void setUp(void)
+{
+    SD_MMC.setRoot(TEST_DATA_DIR);
+    memset(buffer, 0, sizeof(buffer));
+}
+
+void tearDown(void)
+{
+}
+
+void test_wave_size(void)
+{
+    TEST_ASSERT_EQUAL_UINT32(44 + MONO_FRAMES * 2, PatchManager_WaveSize(SD_MMC, "/fixtures/mono.wav"));
+    TEST_ASSERT_EQUAL_UINT32(44 + STEREO_FRAMES * 4, PatchManager_WaveSize(SD_MMC, "/fixtures/stereo.wav"));
+}
+
+void test_load_mono(void)
+{
+    bool stereo = true;
+    uint32_t samples = PatchManager_LoadWavefile(SD_MMC, (char *)"/fixtures/mono.wav", buffer, sizeof(buffer), stereo);
+
+    TEST_ASSERT_EQUAL_UINT32(MONO_FRAMES, samples);
+    TEST_ASSERT_FALSE(stereo);
+    for (int i = 0; i < MONO_FRAMES; i++)
+    {
+        TEST_ASSERT_EQUAL_INT16(fixtureValue(i), buffer[i]);
+    }
+}
+
+void test_load_stereo(void)
+{
+    bool stereo = false;
+    uint32_t samples = PatchManager_LoadWavefile(SD_MMC, (char *)"/fixtures/stereo.wav", buffer, sizeof(buffer), stereo);
+
+    TEST_ASSERT_EQUAL_UINT32(STEREO_FRAMES * 2, samples);
+    TEST_ASSERT_TRUE(stereo);
+    for (int i = 0; i < STEREO_FRAMES; i++)
+    {
+        TEST_ASSERT_EQUAL_INT16(fixtureValue(i), buffer[2 * i]);
+        TEST_ASSERT_EQUAL_INT16(-(fixtureValue(i) >> 1), buffer[2 * i + 1]);
+    }
+}
+
+void test_load_missing_file(void)
+{
+    bool stereo;
+    TEST_ASSERT_EQUAL_UINT32(0, PatchManager_LoadWavefile(SD_MMC, (char *)"/fixtures/missing.wav", buffer, sizeof(buffer), stereo));
+    TEST_ASSERT_EQUAL_UINT32(0, PatchManager_WaveSize(SD_MMC, "/fixtures/missing.wav"));
+}
+
+void test_player_load_wav(void)
+{
+    static SamplePlayer player;
+
+    TEST_ASSERT_TRUE(player.loadWav(0, (char *)"/fixtures/mono.wav"));
+    TEST_ASSERT_TRUE(player.loadWav(1, (char *)"/fixtures/stereo.wav"));
+    TEST_ASSERT_FALSE(player.loadWav(2, (char *)"/fixtures/missing.wav"));
+    TEST_ASSERT_FALSE(player.loadWav(NUM_PLAYERS, (char *)"/fixtures/mono.wav"));
+
+    TEST_ASSERT_TRUE(player.sampleOn(0, 127));
+    TEST_ASSERT_TRUE(player.sampleOn(1, 127));
+    TEST_ASSERT_FALSE(player.sampleOn(2, 127));
+}
+
+void test_player_trims_and_measures(void)
+{
+    /* 100 frames of 1 LSB noise, a 1000 frame square wave at half scale, 300 frames of noise */
+    static int16_t padded[1400];
+    for (int i = 0; i < 1400; i++)
+    {
+        padded[i] = i % 3 - 1;
+    }
+    for (int i = 100; i < 1100; i++)
+    {
+        padded[i] = (i / 10) % 2 ? 16384 : -16384;
+    }
+    padded[1099] = 32767; /* one louder frame in the last kept block */
+    PatchManager_SaveWavefile(SD_MMC, (char *)"/padded.wav", padded, 1400);
+
+    static SamplePlayer player;
+    SampleInfo info;
+    TEST_ASSERT_TRUE(player.loadWav(3, (char *)"/padded.wav"));
+    SD_MMC.remove("/padded.wav");
+    TEST_ASSERT_TRUE(player.sampleInfo(3, info));
+
+    TEST_ASSERT_EQUAL_UINT32(1000, info.frames);
+    TEST_ASSERT_EQUAL_UINT32(400, info.trimmedFrames);
+    TEST_ASSERT_FALSE(info.stereo);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 32767.0f / 32768.0f, info.peak);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 0.5f, info.rms);
+
+    TEST_ASSERT_EQUAL_UINT32((1000 + ENVELOPE_BLOCK_FRAMES - 1) / ENVELOPE_BLOCK_FRAMES, info.envelopeBlocks);
+    TEST_ASSERT_NOT_NULL(info.envelope);
+    TEST_ASSERT_EQUAL_UINT32(16384, info.envelope[0]);
+    TEST_ASSERT_EQUAL_UINT32(32767, info.envelope[info.envelopeBlocks - 1]);
+
+    /* a buffer handed in by the caller is measured but never trimmed */
+    TEST_ASSERT_TRUE(player.loadBuffer(4, padded, 1400, false));
+    TEST_ASSERT_TRUE(player.sampleInfo(4, info));
+    TEST_ASSERT_EQUAL_UINT32(1400, info.frames);
+    TEST_ASSERT_EQUAL_UINT32(0, info.trimmedFrames);
+    TEST_ASSERT_EQUAL_UINT32(1, info.envelope[0]);
+}
+
+/* 1000 mono frames, the first 50 silent, with chunks around the data the loader has to walk past */
+#define SLICED_FRAMES  1000
+#define SLICED_SILENCE 50
+
+static void writeChunk(File &f, const char *id, const void *data, uint32_t size)
+{
+    f.write((const uint8_t *)id, 4);
+    f.write((const uint8_t *)&size, 4);
+    f.write((const uint8_t *)data, size);
+    if (size & 1)
+    {
+        f.write((uint8_t)0);
+    }
+}
+
+static void writeSlicedWav(const char *path)
+{
+    static int16_t pcm[SLICED_FRAMES];
+    for (int i = 0; i < SLICED_FRAMES; i++)
+    {
+        pcm[i] = i < SLICED_SILENCE ? 0 : fixtureValue(i) | 1;
+    }
+
+    struct wavFormat_s format = {1, 1, 44100, 88200, 2, 16};
+
+    /* out of order with a duplicate, the loader sorts them */
+    const uint32_t offsets[] = {600, 0, 300, 300};
+    uint8_t cue[4 + 4 * sizeof(struct wavCuePoint_s)];
+    memset(cue, 0, sizeof(cue));
+    const uint32_t points = 4;
+    memcpy(cue, &points, 4);
+    for (int i = 0; i < 4; i++)
+    {
+        struct wavCuePoint_s point = {(uint32_t)i, 0, {'d', 'a', 't', 'a'}, 0, 0, offsets[i]};
+        memcpy(&cue[4 + i * sizeof(point)], &point, sizeof(point));
+    }
+
+    uint8_t smpl[sizeof(struct wavSampler_s) + sizeof(struct wavSampleLoop_s)];
+    struct wavSampler_s sampler = {0, 0, 22675, 60, 0, 0, 0, 1, 0};
+    struct wavSampleLoop_s loop = {0, 0, 800, 999, 0, 0};
+    memcpy(smpl, &sampler, sizeof(sampler));
+    memcpy(&smpl[sizeof(sampler)], &loop, sizeof(loop));
+
+    File f = SD_MMC.open(path, FILE_WRITE);
+    const uint32_t riffSize = 4 + (8 + sizeof(format)) + (8 + 6) + (8 + sizeof(pcm)) + (8 + sizeof(cue)) + (8 + sizeof(smpl));
+    f.write((const uint8_t *)"RIFF", 4);
+    f.write((const uint8_t *)&riffSize, 4);
+    f.write((const uint8_t *)"WAVE", 4);
+    writeChunk(f, "fmt ", &format, sizeof(format));
+    writeChunk(f, "LIST", "INFOx", 5); /* odd sized, padded */
+    writeChunk(f, "data", pcm, sizeof(pcm));
+    writeChunk(f, "cue ", cue, sizeof(cue));
+    writeChunk(f, "smpl", smpl, sizeof(smpl));
+    f.close();
+}
+
+void test_load_markers(void)
+{
+    writeSlicedWav("/sliced.wav");
+
+    static int16_t pcm[SLICED_FRAMES + 64];
+    uint32_t markers[8];
+    uint16_t numMarkers = 0;
+    bool stereo = true;
+    uint32_t samples = PatchManager_LoadWavefileMarkers(SD_MMC, "/sliced.wav", pcm, sizeof(pcm), stereo, markers, numMarkers, 8);
+
+    /* the catalog walks the same chunks, the LIST chunk in front of data must not pass for it */
+    uint16_t channels = 0;
+    uint32_t sampleRate = 0;
+    uint32_t dataSize = 0;
+    TEST_ASSERT_TRUE(PatchManager_WaveInfo(SD_MMC, "/sliced.wav", channels, sampleRate, dataSize));
+    SD_MMC.remove("/sliced.wav");
+    TEST_ASSERT_EQUAL_UINT16(1, channels);
+    TEST_ASSERT_EQUAL_UINT32(44100, sampleRate);
+    TEST_ASSERT_EQUAL_UINT32(SLICED_FRAMES * sizeof(int16_t), dataSize);
+
+    TEST_ASSERT_EQUAL_UINT32(SLICED_FRAMES, samples);
+    TEST_ASSERT_FALSE(stereo);
+    TEST_ASSERT_EQUAL_INT16(0, pcm[0]);
+    TEST_ASSERT_EQUAL_INT16(fixtureValue(SLICED_FRAMES - 1) | 1, pcm[SLICED_FRAMES - 1]);
+
+    /* cue points and the smpl loop start, sorted, the duplicate dropped */
+    const uint32_t expected[] = {0, 300, 600, 800};
+    TEST_ASSERT_EQUAL_UINT16(4, numMarkers);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(expected, markers, 4);
+
+    /* the list stops at maxMarkers */
+    PatchManager_LoadWavefileMarkers(SD_MMC, "/fixtures/mono.wav", pcm, sizeof(pcm), stereo, markers, numMarkers, 2);
+    TEST_ASSERT_EQUAL_UINT16(0, numMarkers);
+}
+
+void test_rejects_other_formats(void)
+{
+    /* 24 bit PCM and 32 bit float would come out as full scale noise in the int16 buffer */
+    static const struct wavFormat_s formats[] = {{1, 1, 44100, 132300, 3, 24}, {3, 1, 44100, 176400, 4, 32}, {1, 1, 44100, 44100, 1, 8}};
+    static uint8_t data[600];
+    static int16_t pcm[300];
+    for (const struct wavFormat_s &format : formats)
+    {
+        File f = SD_MMC.open("/other.wav", FILE_WRITE);
+        const uint32_t riffSize = 4 + (8 + sizeof(format)) + (8 + sizeof(data));
+        f.write((const uint8_t *)"RIFF", 4);
+        f.write((const uint8_t *)&riffSize, 4);
+        f.write((const uint8_t *)"WAVE", 4);
+        writeChunk(f, "fmt ", &format, sizeof(format));
+        writeChunk(f, "data", data, sizeof(data));
+        f.close();
+
+        bool stereo = false;
+        TEST_ASSERT_EQUAL_UINT32(0, PatchManager_LoadWavefile(SD_MMC, (char *)"/other.wav", pcm, sizeof(pcm), stereo));
+    }
+    SD_MMC.remove("/other.wav");
+}
+
+void test_loads_extensible_pcm(void)
+{
+    /* the 40 byte fmt  that 0xFFFE writers use, the SubFormat GUID starts with the real format_tag */
+    static const uint8_t guidTail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+    static int16_t data[300];
+    static int16_t pcm[300];
+    for (int i = 0; i < 300; i++)
+    {
+        data[i] = fixtureValue(i);
+    }
+    for (uint16_t subFormat : {0x0001, 0x0003})
+    {
+        const struct wavFormat_s format = {0xFFFE, 1, 44100, 88200, 2, 16};
+        const uint16_t extensionSize = 22;
+        const uint16_t validBits = 16;
+        const uint32_t channelMask = 0x4; /* front center */
+        uint8_t fmt[40];
+        memcpy(fmt, &format, 16);
+        memcpy(fmt + 16, &extensionSize, 2);
+        memcpy(fmt + 18, &validBits, 2);
+        memcpy(fmt + 20, &channelMask, 4);
+        memcpy(fmt + 24, &subFormat, 2);
+        memcpy(fmt + 26, guidTail, sizeof(guidTail));
+
+        File f = SD_MMC.open("/extensible.wav", FILE_WRITE);
+        const uint32_t riffSize = 4 + (8 + sizeof(fmt)) + (8 + sizeof(data));
+        f.write((const uint8_t *)"RIFF", 4);
+        f.write((const uint8_t *)&riffSize, 4);
+        f.write((const uint8_t *)"WAVE", 4);
+        writeChunk(f, "fmt ", fmt, sizeof(fmt));
+        writeChunk(f, "data", data, sizeof(data));
+        f.close();
+
+        bool stereo = true;
+        memset(pcm, 0, sizeof(pcm));
+        uint32_t frames = PatchManager_LoadWavefile(SD_MMC, (char *)"/extensible.wav", pcm, sizeof(pcm), stereo);
+        if (subFormat == 0x0001)
+        {
+            TEST_ASSERT_EQUAL_UINT32(300, frames);
+            TEST_ASSERT_FALSE(stereo);
+            TEST_ASSERT_EQUAL_INT16_ARRAY(data, pcm, 300);
+        }
+        else
+        {
+            /* extensible float is still float */
+            TEST_ASSERT_EQUAL_UINT32(0, frames);
+        }
+    }
+    SD_MMC.remove("/extensible.wav");
+}
+
+void test_kit_maps_slices_to_keys(void)
+{
+    writeSlicedWav("/sliced.wav");
+    File kit = SD_MMC.open("/sliced.txt", FILE_WRITE);
+    const char *lines = "1 36 40 36 0 127 /sliced.wav slices\n"
+                        "1 60 60 60 0 127 /sliced.wav\n";
+    kit.write((const uint8_t *)lines, strlen(lines));
+    kit.close();
+
+    static SamplePlayer player;
+    KitEntry entries[8];
+    const uint16_t buffersBefore = sampleStore.buffers();
+    uint16_t numEntries = player.loadKit("/sliced.txt", entries, 8, 8, 8);
+    SD_MMC.remove("/sliced.txt");
+    SD_MMC.remove("/sliced.wav");
+
+    /* five keys for four slices, plus the whole file */
+    TEST_ASSERT_EQUAL_UINT16(6, numEntries);
+    for (int i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(36 + i, entries[i].loKey);
+        TEST_ASSERT_EQUAL_UINT8(36 + i, entries[i].hiKey);
+        TEST_ASSERT_EQUAL_UINT8(36 + i, entries[i].rootKey);
+    }
+
+    /* one buffer behind every slot, the slices moved with the 50 trimmed frames */
+    TEST_ASSERT_EQUAL_UINT16(buffersBefore + 1, sampleStore.buffers());
+    const uint32_t frames[] = {250, 300, 200, 200};
+    SampleInfo info;
+    for (int i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_TRUE(player.sampleInfo(entries[i].sampleNum, info));
+        TEST_ASSERT_EQUAL_UINT32(frames[i], info.frames);
+        TEST_ASSERT_EQUAL_UINT32(SLICED_SILENCE, info.trimmedFrames);
+    }
+    TEST_ASSERT_TRUE(player.sampleInfo(entries[5].sampleNum, info));
+    TEST_ASSERT_EQUAL_UINT32(SLICED_FRAMES - SLICED_SILENCE, info.frames);
+
+    /* the key past the last slice stays silent */
+    TEST_ASSERT_FALSE(player.sampleInfo(entries[4].sampleNum, info));
+    TEST_ASSERT_FALSE(player.sampleOn(entries[4].sampleNum, 127));
+    TEST_ASSERT_TRUE(player.sampleOn(entries[1].sampleNum, 127));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_wave_size);
+    RUN_TEST(test_load_mono);
+    RUN_TEST(test_load_stereo);
+    RUN_TEST(test_load_missing_file);
+    RUN_TEST(test_player_load_wav);
+    RUN_TEST(test_player_trims_and_measures);
+    RUN_TEST(test_load_markers);
+    RUN_TEST(test_rejects_other_formats);
+    RUN_TEST(test_loads_extensible_pcm);
+    RUN_TEST(test_kit_maps_slices_to_keys);
+    return UNITY_END();
+}